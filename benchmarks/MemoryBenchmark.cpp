@@ -0,0 +1,56 @@
+// Resident memory of many compiled per-cell formulas. Usage: MemoryBenchmark [formulas]
+// g++ -std=c++11 -O2 -fopenmp benchmarks/MemoryBenchmark.cpp src/MathExpression.cpp -o MemoryBenchmark
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <unistd.h>
+#include "../src/MathExpression.h"
+
+// resident set size in bytes, 0 where /proc is not available
+static size_t ResidentBytes()
+{
+    FILE* f = fopen("/proc/self/statm", "r");
+    if(!f)
+        return 0;
+    unsigned long nPages = 0, nResident = 0;
+    int nRead = fscanf(f, "%lu %lu", &nPages, &nResident);
+    fclose(f);
+    return nRead == 2 ? static_cast<size_t>(nResident) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t nFormulas = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    
+    // spreadsheet-style cells, a few distinct names repeated across the sheet
+    vector<string> formulas(nFormulas);
+    char szFormula[128];
+    for(size_t i = 0; i < nFormulas; i++)
+    {
+        snprintf(szFormula, sizeof(szFormula), "A%zu * 1.07 + B%zu - C%zu / 2", i % 1000, (i + 1) % 1000, i % 10);
+        formulas[i] = szFormula;
+    }
+    
+    size_t nBefore = ResidentBytes();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    vector<shared_ptr<const MathExpressionProgram> > programs(nFormulas);
+    for(size_t i = 0; i < nFormulas; i++)
+        programs[i].reset(new MathExpressionProgram(formulas[i].c_str()));
+    double fSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t nAfter = ResidentBytes();
+    
+    size_t nOwned = 0, nFailed = 0;
+    for(size_t i = 0; i < nFormulas; i++)
+    {
+        nOwned += programs[i]->MemoryUsage();
+        nFailed += programs[i]->Error().empty() ? 0 : 1;
+    }
+    
+    // the resident figure includes the shared_ptr control blocks and allocator overhead
+    double fFormulas = static_cast<double>(nFormulas);
+    printf("%zu formulas like \"%s\", compiled in %.3f s\n", nFormulas, formulas[0].c_str(), fSeconds);
+    printf("MemoryUsage():  %8.1f bytes per formula\n", static_cast<double>(nOwned) / fFormulas);
+    if(nBefore && nAfter)
+        printf("resident:       %8.1f bytes per formula\n", static_cast<double>(nAfter - nBefore) / fFormulas);
+    return nFailed ? 1 : 0;
+}
@@ -0,0 +1,49 @@
+// The legacy ParseMathExpression symbol extractor on one long sum and on many short formulas.
+// Usage: ParserBenchmark [terms] [formulas]
+// g++ -std=c++11 -O2 benchmarks/ParserBenchmark.cpp src/MathExpressionParser.cpp -o ParserBenchmark
+// Built against src/MathExpressionParser.cpp before the arena rewrite, the long sum shows the
+// quadratic cost of appending tokens.
+#include <set>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include "../src/MathExpressionParser.h"
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    size_t nTerms = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+    size_t nFormulas = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+    
+    std::string sum;
+    char szTerm[32];
+    for(size_t i = 0; i < nTerms; i++)
+    {
+        snprintf(szTerm, sizeof(szTerm), "x%zu+", i % 100);
+        sum += szTerm;
+    }
+    sum += "1";
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::set<std::string> symbols;
+    ParseMathExpression(sum.c_str(), symbols);
+    double fLong = Seconds(start);
+    
+    size_t nSymbols = 0;
+    start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < nFormulas; i++)
+    {
+        std::set<std::string> names;
+        ParseMathExpression("a * exp(-b * x) + sin(t) / (1 + x^2)", names);
+        nSymbols += names.size();
+    }
+    double fShort = Seconds(start);
+    
+    printf("%zu-term sum:        %10.3f ms, %zu symbols\n", nTerms, fLong * 1e3, symbols.size());
+    printf("%zu short formulas: %10.3f ms, %.2f us each\n", nFormulas, fShort * 1e3, fShort * 1e6 / static_cast<double>(nFormulas));
+    return symbols.size() == 100 && nSymbols == 4 * nFormulas ? 0 : 1;
+}
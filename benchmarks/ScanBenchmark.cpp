@@ -0,0 +1,62 @@
+// Symbol and function discovery for a batch of formulas: Scan() against MathExpression
+// construction. Usage: ScanBenchmark [formulas]
+// g++ -std=c++17 -O2 -fopenmp benchmarks/ScanBenchmark.cpp src/MathExpression.cpp -o ScanBenchmark
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include "../src/MathExpression.h"
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    size_t nFormulas = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    
+    vector<string> formulas(nFormulas);
+    char szFormula[128];
+    for(size_t i = 0; i < nFormulas; i++)
+    {
+        snprintf(szFormula, sizeof(szFormula), "a%zu * exp(-b * x) + sin(t%zu) / (1 + x^2)", i % 97, i % 13);
+        formulas[i] = szFormula;
+    }
+    vector<string_view> views(formulas.begin(), formulas.end());
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    vector<MathExprNames> names;
+    bool bValid = MathExpressionProgram::Scan(views, names);
+    double fScan = Seconds(start);
+    
+    // the same names, one formula at a time on one thread
+    start = std::chrono::steady_clock::now();
+    size_t nScanned = 0;
+    for(size_t i = 0; i < nFormulas; i++)
+    {
+        MathExprNames one;
+        if(MathExpressionProgram::Scan(views[i], one))
+            nScanned += one.symbols.size() + one.functions.size();
+    }
+    double fSerial = Seconds(start);
+    
+    start = std::chrono::steady_clock::now();
+    size_t nConstructed = 0;
+    for(size_t i = 0; i < nFormulas; i++)
+    {
+        MathExpression me(formulas[i].c_str());
+        set<string> symbols, functions;
+        me.Symbols(symbols);
+        me.Functions(functions);
+        nConstructed += symbols.size() + functions.size();
+    }
+    double fConstruct = Seconds(start);
+    
+    printf("%zu formulas like \"%s\"\n", nFormulas, formulas[0].c_str());
+    printf("Scan, batch:           %8.3f s\n", fScan);
+    printf("Scan, one by one:      %8.3f s\n", fSerial);
+    printf("MathExpression:        %8.3f s\n", fConstruct);
+    bool bSame = bValid && nScanned == nConstructed;
+    printf("name counts %s\n", bSame ? "match" : "DIFFER");
+    return bSame ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+// Many threads evaluating one shared program, each with its own context, against one
+// MathExpression per thread. Usage: SharedProgramBenchmark [threads] [rows] [calls]
+// g++ -std=c++11 -O2 -fopenmp benchmarks/SharedProgramBenchmark.cpp src/MathExpression.cpp -o SharedProgramBenchmark
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <omp.h>
+#include "../src/MathExpression.h"
+
+static const char* g_lpcszExpr = "a * exp(-b * x) + c * sin(x) / (1 + x^2)";
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    size_t nThreads = argc > 1 ? strtoul(argv[1], NULL, 10) : std::thread::hardware_concurrency();
+    size_t nRows = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000;
+    size_t nCalls = argc > 3 ? strtoul(argv[3], NULL, 10) : 200;
+    if(!nThreads)
+        nThreads = 1;
+    
+    map<string, vector<double> > symbols;
+    symbols["a"] = vector<double>(1, 2.0);
+    symbols["b"] = vector<double>(1, 0.5);
+    symbols["c"] = vector<double>(1, 0.1);
+    vector<double>& x = symbols["x"];
+    for(size_t i = 0; i < nRows; i++)
+        x.push_back(static_cast<double>(i) * 1e-4);
+    
+    // each caller thread evaluates on one OpenMP thread, the callers are the parallelism
+    vector<vector<double> > results(nThreads);
+    vector<int> failed(nThreads, 0);
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    shared_ptr<const MathExpressionProgram> program(new MathExpressionProgram(g_lpcszExpr));
+    vector<std::thread> threads;
+    for(size_t t = 0; t < nThreads; t++)
+    {
+        threads.push_back(std::thread([&, t]() {
+            omp_set_num_threads(1);
+            MathExpressionContext context;
+            for(size_t k = 0; k < nCalls; k++)
+                failed[t] |= !program->Evaluate(results[t], symbols, context);
+        }));
+    }
+    for(size_t t = 0; t < nThreads; t++)
+        threads[t].join();
+    double fShared = Seconds(start);
+    vector<double> reference = results[0];
+    
+    start = std::chrono::steady_clock::now();
+    threads.clear();
+    vector<size_t> bytes(nThreads, 0);
+    for(size_t t = 0; t < nThreads; t++)
+    {
+        threads.push_back(std::thread([&, t]() {
+            omp_set_num_threads(1);
+            MathExpression me(g_lpcszExpr);
+            bytes[t] = me.MemoryUsage();
+            for(size_t k = 0; k < nCalls; k++)
+                failed[t] |= !me.Evaluate(results[t], symbols);
+        }));
+    }
+    for(size_t t = 0; t < nThreads; t++)
+        threads[t].join();
+    double fCopies = Seconds(start);
+    
+    bool bSame = true;
+    for(size_t t = 0; t < nThreads; t++)
+        bSame = bSame && !failed[t] && results[t] == reference;
+    size_t nCopyBytes = 0;
+    for(size_t t = 0; t < nThreads; t++)
+        nCopyBytes += bytes[t];
+    
+    double fRows = static_cast<double>(nThreads * nCalls * nRows);
+    printf("%zu threads x %zu calls x %zu rows of %s\n", nThreads, nCalls, nRows, g_lpcszExpr);
+    printf("shared program:     %8.3f s  %8.1f Mrows/s  %zu bytes\n", fShared, fRows / fShared * 1e-6, program->MemoryUsage());
+    printf("one copy per thread: %7.3f s  %8.1f Mrows/s  %zu bytes\n", fCopies, fRows / fCopies * 1e-6, nCopyBytes);
+    printf("results %s\n", bSame ? "identical" : "DIFFER");
+    return bSame ? 0 : 1;
+}
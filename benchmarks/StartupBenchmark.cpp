@@ -0,0 +1,72 @@
+// Cold start of many stored formulas: compiling the text against loading a saved file.
+// Usage: StartupBenchmark [formulas] [file]
+// g++ -std=c++11 -O2 -fopenmp benchmarks/StartupBenchmark.cpp src/MathExpression.cpp -o StartupBenchmark
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include "../src/MathExpression.h"
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    size_t nFormulas = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    const char* lpcszPath = argc > 2 ? argv[2] : "StartupBenchmark.bin";
+    
+    vector<string> formulas(nFormulas);
+    char szFormula[128];
+    for(size_t i = 0; i < nFormulas; i++)
+    {
+        snprintf(szFormula, sizeof(szFormula), "a%zu * exp(-b * x) + c * sin(x) / (1 + x^2) - %zu", i % 97, i);
+        formulas[i] = szFormula;
+    }
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    vector<shared_ptr<const MathExpressionProgram> > compiled(nFormulas);
+    for(size_t i = 0; i < nFormulas; i++)
+        compiled[i].reset(new MathExpressionProgram(formulas[i].c_str()));
+    double fParse = Seconds(start);
+    
+    string error;
+    start = std::chrono::steady_clock::now();
+    if(!MathExpressionProgram::Save(lpcszPath, compiled, error))
+    {
+        printf("save: %s\n", error.c_str());
+        return 1;
+    }
+    double fSave = Seconds(start);
+    
+    start = std::chrono::steady_clock::now();
+    vector<shared_ptr<const MathExpressionProgram> > loaded;
+    if(!MathExpressionProgram::Load(lpcszPath, loaded, error))
+    {
+        printf("load: %s\n", error.c_str());
+        return 1;
+    }
+    double fLoad = Seconds(start);
+    remove(lpcszPath);
+    
+    // a sample of the loaded programs evaluates as the compiled ones
+    map<string, vector<double> > symbols;
+    symbols["b"] = vector<double>(1, 0.5);
+    symbols["c"] = vector<double>(1, 0.1);
+    symbols["x"] = vector<double>(16, 0.25);
+    bool bSame = loaded.size() == nFormulas;
+    for(size_t i = 0; i < nFormulas && bSame; i += 997)
+    {
+        symbols["a" + to_string(i % 97)] = vector<double>(1, 2.0);
+        MathExpressionContext context;
+        vector<double> expected, results;
+        bSame = compiled[i]->Evaluate(expected, symbols, context) && loaded[i]->Evaluate(results, symbols, context) && results == expected;
+    }
+    
+    printf("%zu formulas like \"%s\"\n", nFormulas, formulas[0].c_str());
+    printf("parse:  %8.3f s\n", fParse);
+    printf("save:   %8.3f s\n", fSave);
+    printf("load:   %8.3f s\n", fLoad);
+    printf("loaded programs %s\n", bSame ? "evaluate the same" : "DIFFER");
+    return bSame ? 0 : 1;
+}
@@ -1,7 +1,7 @@
 #define _USE_MATH_DEFINES
 #include <cmath>
 
-#ifdef _MSC_VER
+#ifdef _OPENMP
 #include <omp.h>
 #endif
 
@@ -9,10 +9,30 @@
 #include <string>
 #include <set>
 #include <map>
+#include <unordered_set>
 #include <limits>
-//#include <algorithm>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
 //#include <functional>
 #include <cstdarg>
+#include <cstdio>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 //#define NDEBUG
 #include <cassert>
@@ -21,10 +41,30 @@
 
 using namespace std;
 
+typedef enum {
+    MathExprOpCode_Or,
+    MathExprOpCode_And,
+    MathExprOpCode_Equal,
+    MathExprOpCode_NotEqual,
+    MathExprOpCode_LessEqual,
+    MathExprOpCode_GreaterEqual,
+    MathExprOpCode_Less,
+    MathExprOpCode_Greater,
+    MathExprOpCode_Plus,
+    MathExprOpCode_Minus,
+    MathExprOpCode_Multiply,
+    MathExprOpCode_Divide,
+    MathExprOpCode_Power,
+    MathExprOpCode_Not,
+    
+    MathExprOpCodeCount
+} MathExprOpCode;
+
 typedef struct MathExpressionOperator
 {
     string repr;
     size_t precedence;
+    MathExprOpCode code;
     
     friend bool operator>(const MathExpressionOperator& l, const MathExpressionOperator& r)
     {
@@ -33,14 +73,37 @@ typedef struct MathExpressionOperator
     
 } MathExpressionOperator;
 
+// multi-character operators are listed before their single-character prefixes
 static MathExpressionOperator __MathExpression_operators__[] = {
-    {"+", 1},
-    {"-", 1},
-    {"*", 2},
-    {"/", 2},
-    {"^", 3}
+    {"||", 1, MathExprOpCode_Or},
+    {"&&", 2, MathExprOpCode_And},
+    {"==", 3, MathExprOpCode_Equal},
+    {"!=", 3, MathExprOpCode_NotEqual},
+    {"<=", 4, MathExprOpCode_LessEqual},
+    {">=", 4, MathExprOpCode_GreaterEqual},
+    {"<", 4, MathExprOpCode_Less},
+    {">", 4, MathExprOpCode_Greater},
+    {"+", 5, MathExprOpCode_Plus},
+    {"-", 5, MathExprOpCode_Minus},
+    {"*", 6, MathExprOpCode_Multiply},
+    {"/", 6, MathExprOpCode_Divide},
+    {"^", 7, MathExprOpCode_Power},
+    {"!", 8, MathExprOpCode_Not}    // unary only, i.e. a sign, applied to its operand alone
 };
 
+static bool FindOperator(const string& repr, size_t& offset)
+{
+    for(size_t i = 0; i < sizeof(__MathExpression_operators__)/sizeof(MathExpressionOperator); i++)
+    {
+        if(__MathExpression_operators__[i].repr == repr)
+        {
+            offset = i;
+            return true;
+        }
+    }
+    return false;
+}
+
 template <typename T>
 inline bool is_in_array(const T* ts, size_t n, const T t)
 {
@@ -56,237 +119,2883 @@ inline bool is_in_array(const T* ts, size_t n, const T t)
     return bFound;
 }
 
-inline bool EvalMathFunction_1(MathFunction_1& f, double* inout, size_t n)
-{
-    for(size_t i = 0; i < n; i++)
-        inout[i] = f(inout[i]);
-    return true;
-}
-template<typename op> inline bool EvalMathFunction_2(std::vector<double>& values_1, std::vector<double>& values_2, size_t& nResultPosition, op f)
+static const char* __MathExpression_reductions__[] = {
+    "sum", "mean", "min", "max", "norm"
+};
+
+static bool FindReduction(const string& repr, size_t& offset)
 {
-    if(values_1.size() == values_2.size())
+    for(size_t i = 0; i < sizeof(__MathExpression_reductions__)/sizeof(const char*); i++)
     {
-        nResultPosition = 0;
-        for(size_t i = 0; i < values_1.size(); i++)
-            values_1[i] = f(values_1[i], values_2[i]);
+        if(repr == __MathExpression_reductions__[i])
+        {
+            offset = i;
+            return true;
+        }
     }
-    else if(values_1.size() == 1)
+    return false;
+}
+static bool IsReduction(const string& repr)
+{
+    size_t offset;
+    return FindReduction(repr, offset);
+}
+static void CombineReductionPartial(const string& repr, MathExprReductionPartial& l, const MathExprReductionPartial& r)
+{
+    if(repr == "min")
     {
-        nResultPosition = 1;
-        double value_1 = values_1[0];
-        for(size_t i = 0; i < values_2.size(); i++)
-            values_2[i] = f(value_1, values_2[i]);
+        if(r.value < l.value || r.value != r.value)
+            l.value = r.value;
     }
-    else if(values_2.size() == 1)
+    else if(repr == "max")
     {
-        nResultPosition = 0;
-        double value_2 = values_2[0];
-        for(size_t i = 0; i < values_1.size(); i++)
-            values_1[i] = f(values_1[i], value_2);
+        if(r.value > l.value || r.value != r.value)
+            l.value = r.value;
     }
     else
+        l.value += r.value;
+    l.count += r.count;
+}
+static MathExprReductionPartial ReducePartialsTree(const string& repr, const MathExprReductionPartial* partials, size_t n)
+{
+    // pairwise, so the result only depends on the segmentation and never on the thread count
+    if(n == 1)
+        return partials[0];
+    MathExprReductionPartial l = ReducePartialsTree(repr, partials, n / 2);
+    CombineReductionPartial(repr, l, ReducePartialsTree(repr, partials + n / 2, n - n / 2));
+    return l;
+}
+
+static size_t GetThreadCount()
+{
+#ifdef _OPENMP
+    return static_cast<size_t>(omp_get_max_threads());
+#else
+    return 1;
+#endif
+}
+static size_t GetThreadIndex()
+{
+#ifdef _OPENMP
+    return static_cast<size_t>(omp_get_thread_num());
+#else
+    return 0;
+#endif
+}
+
+// Operands live in OutputQueue[0, nDepth). Vectors are swapped rather than moved or
+// popped, so that their capacity stays in the scratch space for the next segment.
+inline bool EvalMathSelect(std::vector<std::vector<double> >& OutputQueue, size_t& nDepth)
+{
+    // branchless: both alternatives are already evaluated, the select vectorizes to a blend
+    const std::vector<double>& values_c = OutputQueue[nDepth - 3];
+    const std::vector<double>& values_1 = OutputQueue[nDepth - 2];
+    const std::vector<double>& values_2 = OutputQueue[nDepth - 1];
+    size_t n = values_c.size();
+    if(n < values_1.size())
+        n = values_1.size();
+    if(n < values_2.size())
+        n = values_2.size();
+    if((values_c.size() != n && values_c.size() != 1) || (values_1.size() != n && values_1.size() != 1) || (values_2.size() != n && values_2.size() != 1))
         return false;
     
+    std::vector<double>& results = OutputQueue[nDepth];
+    results.resize(n);
+    const double* c = values_c.data();
+    const double* a = values_1.data();
+    const double* b = values_2.data();
+    size_t nc = values_c.size() == 1 ? 0 : 1;
+    size_t na = values_1.size() == 1 ? 0 : 1;
+    size_t nb = values_2.size() == 1 ? 0 : 1;
+    for(size_t i = 0; i < n; i++)
+        results[i] = c[i * nc] != 0 ? a[i * na] : b[i * nb];
+    OutputQueue[nDepth - 3].swap(results);
+    nDepth -= 2;
     return true;
 }
-
-MathExpression::MathExpression(const char* lpcszExpr)
+inline bool EvalMathFunction_n(std::vector<std::vector<double> >& OutputQueue, size_t& nDepth, MathFunction_n f, size_t nArgs, std::vector<MathExprNodeEvalTaskBuffer>& args)
 {
-    if(!IsBalanced(lpcszExpr))
+    // one call per segment, operands hold either n values or a single value
+    size_t n = 1;
+    args.resize(nArgs);
+    for(size_t j = 0; j < nArgs; j++)
     {
-        m_error = "Parentheses Not Balanced";
-        return;
+        std::vector<double>& values = OutputQueue[nDepth - nArgs + j];
+        if(n < values.size())
+            n = values.size();
+        args[j].p = values.data();
+        args[j].n = values.size();
     }
-    m_expr.assign(lpcszExpr);
-    
-    m_nodes.resize(0);
-    if(!GetTokens(lpcszExpr, m_nodes, m_error))
-        return;
-    
-    if(!Validate(m_nodes))
+    for(size_t j = 0; j < nArgs; j++)
     {
-        m_error = "Tokens Order Invalid.";
-        return;
+        if(args[j].n != n && args[j].n != 1)
+            return false;
     }
     
-    initialize_f1();
-    initialize_f2();
-    
-    vector<MathExpressionNode> results;
-    ShuntingYard(results, m_nodes, m_error);
-    m_nodes = results;
-    
-    return;
+    std::vector<double>& results = OutputQueue[nDepth];
+    results.resize(n);
+    if(!f(results.data(), n, args.data(), nArgs))
+        return false;
+    OutputQueue[nDepth - nArgs].swap(results);
+    nDepth = nDepth - nArgs + 1;
+    return true;
 }
-void MathExpression::Symbols(set<string>& symbols)
+static bool EvalMathMin(double* results, size_t n, const MathExprNodeEvalTaskBuffer* args, size_t nargs)
 {
-    symbols.clear();
-    for(size_t i = 0; i < m_nodes.size(); i++)
+    // NaN propagates, as it does for the min reduction
+    if(nargs < 2)
+        return false;
+    for(size_t i = 0; i < n; i++)
+        results[i] = args[0].p[args[0].n == 1 ? 0 : i];
+    for(size_t j = 1; j < nargs; j++)
     {
-        if(m_nodes[i].type == MathExprNodeType_Symbol)
-            symbols.insert(m_nodes[i].repr);
+        const double* a = args[j].p;
+        size_t s = args[j].n == 1 ? 0 : 1;
+        for(size_t i = 0; i < n; i++)
+            results[i] = (a[i * s] < results[i] || a[i * s] != a[i * s]) ? a[i * s] : results[i];
     }
+    return true;
 }
-void MathExpression::Functions(set<string>& functions)
+static bool EvalMathMax(double* results, size_t n, const MathExprNodeEvalTaskBuffer* args, size_t nargs)
 {
-    functions.clear();
-    for(size_t i = 0; i < m_nodes.size(); i++)
+    if(nargs < 2)
+        return false;
+    for(size_t i = 0; i < n; i++)
+        results[i] = args[0].p[args[0].n == 1 ? 0 : i];
+    for(size_t j = 1; j < nargs; j++)
     {
-        if(m_nodes[i].type == MathExprNodeType_Function)
-            functions.insert(m_nodes[i].repr);
+        const double* a = args[j].p;
+        size_t s = args[j].n == 1 ? 0 : 1;
+        for(size_t i = 0; i < n; i++)
+            results[i] = (a[i * s] > results[i] || a[i * s] != a[i * s]) ? a[i * s] : results[i];
     }
+    return true;
 }
-void MathExpression::BindSymbols(const map<string, double>& symbols)
+static bool EvalMathHypot(double* results, size_t n, const MathExprNodeEvalTaskBuffer* args, size_t nargs)
 {
-    if(!symbols.size())
-        return;
-    for(size_t i = 0; i < m_nodes.size(); i++)
+    // scaled by the largest magnitude so that squares neither overflow nor underflow,
+    // in blocks whose sums stay on the stack
+    if(nargs < 1)
+        return false;
+    const size_t nBlock = 256;
+    double sums[nBlock];
+    for(size_t k = 0; k < n; k += nBlock)
     {
-        if(m_nodes[i].type == MathExprNodeType_Symbol)
+        size_t m = n - k < nBlock ? n - k : nBlock;
+        double* r = results + k;
+        for(size_t i = 0; i < m; i++)
         {
-            map<string, double>::const_iterator it = symbols.find(m_nodes[i].repr);
-            if(it != symbols.end())
+            r[i] = 0;
+            sums[i] = 0;
+        }
+        for(size_t j = 0; j < nargs; j++)
+        {
+            const double* a = args[j].n == 1 ? args[j].p : args[j].p + k;
+            size_t s = args[j].n == 1 ? 0 : 1;
+            for(size_t i = 0; i < m; i++)
+                r[i] = (fabs(a[i * s]) > r[i] || a[i * s] != a[i * s]) ? fabs(a[i * s]) : r[i];
+        }
+        for(size_t j = 0; j < nargs; j++)
+        {
+            const double* a = args[j].n == 1 ? args[j].p : args[j].p + k;
+            size_t s = args[j].n == 1 ? 0 : 1;
+            for(size_t i = 0; i < m; i++)
             {
-                m_nodes[i].values.resize(1);
-                m_nodes[i].values[0] = it->second;
+                double q = r[i] > 0 && r[i] <= (numeric_limits<double>::max)() ? a[i * s] / r[i] : 0;
+                sums[i] += q * q;
             }
         }
+        for(size_t i = 0; i < m; i++)
+            r[i] = sums[i] > 0 ? r[i] * sqrt(sums[i]) : r[i];
     }
+    return true;
 }
-bool MathExpression::Evaluate(vector<double>& results, const map<string, vector<double> >& symbols)
+static bool EvalMathPoly(double* results, size_t n, const MathExprNodeEvalTaskBuffer* args, size_t nargs)
 {
-    results.resize(0);
-    
-    // nMaxLength is 1 in case expression has no symbol.
-    size_t nMaxLength = symbols.size() ? 0 : 1;
-    for(map<string, vector<double> >::const_iterator it = symbols.begin(); it != symbols.end(); it++)
+    // poly(x, c0, c1, ..., cd) = c0 + c1 * x + ... + cd * x^d by Horner's rule
+    if(nargs < 2)
+        return false;
+    const double* x = args[0].p;
+    size_t sx = args[0].n == 1 ? 0 : 1;
+    for(size_t i = 0; i < n; i++)
+        results[i] = args[nargs - 1].p[args[nargs - 1].n == 1 ? 0 : i];
+    for(size_t j = nargs - 1; j >= 2; j--)
     {
-        if(nMaxLength < it->second.size())
-            nMaxLength = it->second.size();
+        const double* c = args[j - 1].p;
+        size_t s = args[j - 1].n == 1 ? 0 : 1;
+#ifdef FP_FAST_FMA
+        for(size_t i = 0; i < n; i++)
+            results[i] = fma(results[i], x[i * sx], c[i * s]);
+#else
+        for(size_t i = 0; i < n; i++)
+            results[i] = results[i] * x[i * sx] + c[i * s];
+#endif
     }
-    
-    size_t nSegmentSize = GetSegmentSize();
-    size_t nTasks = nMaxLength / nSegmentSize;
-    if((numeric_limits<unsigned long long>::max)() < nTasks)
+    return true;
+}
+static inline void PhiloxRound(uint32_t& c0, uint32_t& c1, uint32_t& c2, uint32_t& c3, uint32_t k0, uint32_t k1)
+{
+    uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * c0;
+    uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * c2;
+    uint32_t t1 = c1, t3 = c3;
+    c0 = static_cast<uint32_t>(p1 >> 32) ^ t1 ^ k0;
+    c1 = static_cast<uint32_t>(p1);
+    c2 = static_cast<uint32_t>(p0 >> 32) ^ t3 ^ k1;
+    c3 = static_cast<uint32_t>(p0);
+}
+static inline void PhiloxKeys(uint32_t keys[20], uint32_t k0, uint32_t k1)
+{
+    // the key of each round, bumped by the Weyl constants
+    for(size_t r = 0; r < 10; r++)
     {
-        m_error = "Not Enough Memory.";
-        return false;
+        keys[2 * r] = k0 + static_cast<uint32_t>(r) * 0x9E3779B9u;
+        keys[2 * r + 1] = k1 + static_cast<uint32_t>(r) * 0xBB67AE85u;
     }
-    if(nMaxLength > nTasks * nSegmentSize)
-        nTasks++;
-    if(!nTasks)
-        return false;
-    
-    typedef struct {
-        vector<double> _results;
-        map<string, vector<double> > _symbols;
-        map<string, MathExprNodeEvalTaskBuffer> _symbols2;
-    } MathExprNodeEvalTask;
-    
-    vector<MathExprNodeEvalTask> tasks(nTasks);
-    for(size_t i = 0; i < nTasks; i++)
+}
+static inline void Philox4x32_10(uint32_t& c0, uint32_t& c1, uint32_t& c2, uint32_t& c3, const uint32_t keys[20])
+{
+    PhiloxRound(c0, c1, c2, c3, keys[0], keys[1]);
+    PhiloxRound(c0, c1, c2, c3, keys[2], keys[3]);
+    PhiloxRound(c0, c1, c2, c3, keys[4], keys[5]);
+    PhiloxRound(c0, c1, c2, c3, keys[6], keys[7]);
+    PhiloxRound(c0, c1, c2, c3, keys[8], keys[9]);
+    PhiloxRound(c0, c1, c2, c3, keys[10], keys[11]);
+    PhiloxRound(c0, c1, c2, c3, keys[12], keys[13]);
+    PhiloxRound(c0, c1, c2, c3, keys[14], keys[15]);
+    PhiloxRound(c0, c1, c2, c3, keys[16], keys[17]);
+    PhiloxRound(c0, c1, c2, c3, keys[18], keys[19]);
+}
+void MathExprPhilox4x32(uint32_t counter[4], const uint32_t key[2])
+{
+    uint32_t keys[20];
+    PhiloxKeys(keys, key[0], key[1]);
+    Philox4x32_10(counter[0], counter[1], counter[2], counter[3], keys);
+}
+static inline double ToUniform(uint32_t hi, uint32_t lo)
+{
+    // 22 + 31 random bits, exact in a double, in [0, 1)
+    return static_cast<double>(static_cast<int32_t>(hi >> 10)) * (1.0 / 4194304.0) + \
+           static_cast<double>(static_cast<int32_t>(lo >> 1)) * (1.0 / 9007199254740992.0);
+}
+static bool EvalMathRandom(double* values, size_t n, const MathExprScratch& scratch, bool bNormal)
+{
+    // Philox4x32-10 (Salmon et al., SC'11): the draw is a pure function of the counter, the
+    // row and the stream, and of the key, the seed, so it needs no state shared by threads.
+    // values hold the stream of each draw and receive the draws. Work goes in blocks whose
+    // loops have no branches or calls, the rounds are unrolled, so that they vectorize.
+    const size_t nBlock = 256;
+    uint32_t keys[20];
+    PhiloxKeys(keys, static_cast<uint32_t>(scratch.seed), static_cast<uint32_t>(scratch.seed >> 32));
+    uint32_t lo[nBlock], hi[nBlock], streams[nBlock];
+    double u1[nBlock], u2[nBlock];
+    for(size_t nStart = 0; nStart < n; nStart += nBlock)
     {
-        for(map<string, vector<double> >::const_iterator it = symbols.begin(); it != symbols.end(); it++)
+        size_t m = n - nStart < nBlock ? n - nStart : nBlock;
+        double* v = values + nStart;
+        for(size_t i = 0; i < m; i++)
         {
-            size_t N = (it->second.size() >= i * nSegmentSize + nSegmentSize ? nSegmentSize : it->second.size() - i * nSegmentSize);
-            if(it->second.size() == 0)
-                return false;
-            else
-            {
-                MathExprNodeEvalTaskBuffer buffer;
-                buffer.n = N;
-                buffer.p = const_cast<double*>(it->second.data() + i * nSegmentSize);
-                tasks[i]._symbols2[it->first] = buffer;
-                
-            }
+            uint64_t nRow = scratch.rows ? scratch.rows[nStart + i] : scratch.row + nStart + i;
+            lo[i] = static_cast<uint32_t>(nRow);
+            hi[i] = static_cast<uint32_t>(nRow >> 32);
         }
+        for(size_t i = 0; i < m; i++)
+            streams[i] = static_cast<uint32_t>(static_cast<int32_t>(v[i] >= 0 && v[i] < 2147483648.0 ? v[i] : 0));
+        for(size_t i = 0; i < m; i++)
+        {
+            uint32_t c0 = lo[i], c1 = hi[i], c2 = streams[i], c3 = 0;
+            Philox4x32_10(c0, c1, c2, c3, keys);
+            u1[i] = ToUniform(c0, c1);
+            u2[i] = ToUniform(c2, c3);
+        }
+        
+        // a stream that is negative, too large or NaN draws NaN
+        if(bNormal)
+        {
+            // Box-Muller on (0, 1] x [0, 1), one normal per row so that draws stay row-indexed
+            for(size_t i = 0; i < m; i++)
+                u1[i] = sqrt(-2.0 * log(1.0 - u1[i])) * cos(6.283185307179586 * u2[i]);
+        }
+        for(size_t i = 0; i < m; i++)
+            v[i] = v[i] >= 0 && v[i] < 2147483648.0 ? u1[i] : numeric_limits<double>::quiet_NaN();
     }
-    
-    signed long long N = static_cast<signed long long>(nTasks);
-    size_t nEvalError = 0;
-#pragma omp parallel for reduction(+: nEvalError)
-    for(signed long long i = 0; i < N; i++)
+    return true;
+}
+static bool EvalMathRand(double* values, size_t n, const MathExprScratch& scratch)
+{
+    return EvalMathRandom(values, n, scratch, false);
+}
+static bool EvalMathRandn(double* values, size_t n, const MathExprScratch& scratch)
+{
+    return EvalMathRandom(values, n, scratch, true);
+}
+static void SetPosition(MathExprScratch& scratch, unsigned long long nSeed, size_t nRow, const size_t* rows, size_t n)
+{
+    scratch.seed = nSeed;
+    scratch.row = nRow;
+    scratch.rows = rows;
+    scratch.n = n;
+}
+inline bool EvalMathFunction_1(MathFunction_1 f, double* inout, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+        inout[i] = f(inout[i]);
+    return true;
+}
+template<typename op> inline bool EvalMathFunction_2(std::vector<double>& values_1, std::vector<double>& values_2, size_t& nResultPosition, op f)
+{
+    if(values_1.size() == values_2.size())
     {
-        if(!EvaluateEx(tasks[i]._results, tasks[i]._symbols2, m_nodes))
-            nEvalError = 1;
-        else
-            nEvalError = 0;
+        nResultPosition = 0;
+        for(size_t i = 0; i < values_1.size(); i++)
+            values_1[i] = f(values_1[i], values_2[i]);
     }
-    if(nEvalError)
+    else if(values_1.size() == 1)
+    {
+        nResultPosition = 1;
+        double value_1 = values_1[0];
+        for(size_t i = 0; i < values_2.size(); i++)
+            values_2[i] = f(value_1, values_2[i]);
+    }
+    else if(values_2.size() == 1)
+    {
+        nResultPosition = 0;
+        double value_2 = values_2[0];
+        for(size_t i = 0; i < values_1.size(); i++)
+            values_1[i] = f(values_1[i], value_2);
+    }
+    else
         return false;
     
-    size_t nResultSize = 0;
-    for(size_t i = 0; i < tasks.size(); i++)
-        nResultSize += tasks[i]._results.size();
-    
-    results.reserve(nResultSize);
-    for(size_t i = 0; i < tasks.size(); i++)
-        results.insert(results.end(), tasks[i]._results.begin(), tasks[i]._results.end());
-    
     return true;
 }
+template<typename op> inline bool EvalMathOperator(std::vector<std::vector<double> >& OutputQueue, size_t& nDepth, op f)
+{
+    size_t nResultPosition;
+    if(!EvalMathFunction_2(OutputQueue[nDepth - 2], OutputQueue[nDepth - 1], nResultPosition, f))
+        return false;
+    if(nResultPosition == 1)
+        OutputQueue[nDepth - 2].swap(OutputQueue[nDepth - 1]);
+    nDepth--;
+    return true;
+}
+
+// kinds of MathExprNodeType_Function nodes, stored in MathExprOp::code
+typedef enum {
+    MathExprCall_Builtin    = 0,
+    MathExprCall_Select     = 1,
+    MathExprCall_Reduction  = 2,
+    MathExprCall_User       = 3
+} MathExprCallKind;
 
-bool MathExpression::IsBalanced(const char* lpcszExpr)
+// values: the stream of each draw in, the draws out; scratch: the rows and the seed
+typedef bool (*MathFunction_r)(double* values, size_t n, const MathExprScratch& scratch);
+
+typedef struct MathExprBuiltin
 {
-    size_t N = 0;
-    size_t nExprLength = strlen(lpcszExpr);
-    for(size_t i = 0; i < nExprLength; i++)
+    string name;
+    MathFunction_1 f1;
+    MathFunction_2 f2;
+    MathFunction_n fn;
+    MathFunction_r fr;
+    size_t arity;       // 0 for any number of arguments
+    bool pure;
+    double cost;        // nanoseconds per element, measured when the registry is built
+} MathExprBuiltin;
+
+// Built-in functions indexed by function ID, i.e. MathExprOp::index. IDs are registration
+// order, which saved files depend on, and names are looked up by binary search instead.
+typedef struct MathExprRegistry
+{
+    vector<MathExprBuiltin> builtins;
+    vector<size_t> byname;      // IDs sorted by name
+    double unit;                // nanoseconds per element of a multiply, i.e. any operator
+} MathExprRegistry;
+
+static void AddBuiltin(vector<MathExprBuiltin>& builtins, const char* name, MathFunction_1 f1, MathFunction_2 f2 = NULL, MathFunction_n fn = NULL, size_t nArity = 0)
+{
+    MathExprBuiltin builtin;
+    builtin.name = name;
+    builtin.f1 = f1;
+    builtin.f2 = f2;
+    builtin.fn = fn;
+    builtin.fr = NULL;
+    builtin.arity = f1 ? 1 : f2 ? 2 : nArity;
+    builtin.pure = true;
+    builtin.cost = 0;
+    builtins.push_back(builtin);
+}
+static void initialize_f1(vector<MathExprBuiltin>& builtins)
+{
+    AddBuiltin(builtins, "acos", acos);
+    AddBuiltin(builtins, "asin", asin);
+    AddBuiltin(builtins, "atan", atan);
+    AddBuiltin(builtins, "cos", cos);
+    AddBuiltin(builtins, "cosh", cosh);
+    AddBuiltin(builtins, "exp", exp);
+    AddBuiltin(builtins, "abs", abs);
+    AddBuiltin(builtins, "log", log);
+    AddBuiltin(builtins, "log10", log10);
+    AddBuiltin(builtins, "ln", [](double _){ return log(_)/log(exp(1)); });
+    AddBuiltin(builtins, "sin", sin);
+    AddBuiltin(builtins, "sinh", sinh);
+    AddBuiltin(builtins, "tan", tan);
+    AddBuiltin(builtins, "tanh", tanh);
+    AddBuiltin(builtins, "sqrt", sqrt);
+#ifdef _MSC_VER
+    AddBuiltin(builtins, "j0", _j0);
+    AddBuiltin(builtins, "j1", _j1);
+    AddBuiltin(builtins, "y0", _y0);
+    AddBuiltin(builtins, "y1", _y1);
+#elif defined __GNUC__
+    AddBuiltin(builtins, "j0", j0);
+    AddBuiltin(builtins, "j1", j1);
+    AddBuiltin(builtins, "y0", y0);
+    AddBuiltin(builtins, "y1", y1);
+#endif
+}
+static void initialize_f2(vector<MathExprBuiltin>& builtins)
+{
+    AddBuiltin(builtins, "atan2", NULL, atan2);
+}
+static void initialize_fn(vector<MathExprBuiltin>& builtins)
+{
+    AddBuiltin(builtins, "min", NULL, NULL, EvalMathMin);
+    AddBuiltin(builtins, "max", NULL, NULL, EvalMathMax);
+    AddBuiltin(builtins, "hypot", NULL, NULL, EvalMathHypot);
+    AddBuiltin(builtins, "poly", NULL, NULL, EvalMathPoly);
+}
+static void initialize_fr(vector<MathExprBuiltin>& builtins)
+{
+    // rand(stream) and randn(stream), a call without a stream is given one of its own
+    const char* names[] = {"rand", "randn"};
+    MathFunction_r kernels[] = {EvalMathRand, EvalMathRandn};
+    for(size_t i = 0; i < 2; i++)
     {
-        if(lpcszExpr[i] == '(')
+        AddBuiltin(builtins, names[i], NULL, NULL, NULL, 1);
+        builtins.back().fr = kernels[i];
+        builtins.back().pure = false;
+    }
+}
+static bool IsRandomFunction(const string& name)
+{
+    return name == "rand" || name == "randn";
+}
+static double MeasureBuiltinCost(const MathExprBuiltin* pBuiltin)
+{
+    // Best of a few runs over one small segment, with arguments inside every domain.
+    // pBuiltin is NULL for the reference multiply. Variadic kernels get two columns.
+    const size_t n = 2048;
+    vector<double> x(n), y(n), results(n);
+    for(size_t i = 0; i < n; i++)
+    {
+        x[i] = 0.1 + 0.8 * i / n;
+        y[i] = 0.9 - 0.8 * i / n;
+    }
+    MathExprNodeEvalTaskBuffer args[2] = {{x.data(), n}, {y.data(), n}};
+    
+    double fBest = numeric_limits<double>::infinity();
+    for(size_t nRun = 0; nRun < 5; nRun++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if(!pBuiltin)
         {
-            N++;
+            for(size_t i = 0; i < n; i++)
+                results[i] = x[i] * y[i];
         }
-        else if(lpcszExpr[i] == ')')
+        else if(pBuiltin->f1)
         {
-            if(N == 0)
-                return false;
-            N--;
+            for(size_t i = 0; i < n; i++)
+                results[i] = pBuiltin->f1(x[i]);
+        }
+        else if(pBuiltin->f2)
+        {
+            for(size_t i = 0; i < n; i++)
+                results[i] = pBuiltin->f2(x[i], y[i]);
+        }
+        else if(pBuiltin->fr)
+        {
+            MathExprScratch scratch;
+            SetPosition(scratch, 0, 0, NULL, n);
+            std::copy(x.begin(), x.end(), results.begin());
+            pBuiltin->fr(results.data(), n, scratch);
         }
+        else
+            pBuiltin->fn(results.data(), n, args, 2);
+        double fTime = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / n;
+        if(fTime < fBest)
+            fBest = fTime;
     }
     
-    return N == 0;
+    // timers are coarse, no entry is cheaper than a few cycles
+    return fBest < 0.25 ? 0.25 : fBest;
 }
-bool MathExpression::IsValidForNumberBeginning(char chr)
+static const MathExprRegistry& GetRegistry()
 {
-    return (chr >= '0' && chr <= '9') || chr == '.';
+    // built once, immutable and shared by every program
+    static const MathExprRegistry registry = []() {
+        MathExprRegistry _registry;
+        initialize_f1(_registry.builtins);
+        initialize_f2(_registry.builtins);
+        initialize_fn(_registry.builtins);
+        initialize_fr(_registry.builtins);
+        
+        _registry.unit = MeasureBuiltinCost(NULL);
+        for(size_t i = 0; i < _registry.builtins.size(); i++)
+        {
+            _registry.builtins[i].cost = MeasureBuiltinCost(&_registry.builtins[i]);
+            _registry.byname.push_back(i);
+        }
+        const vector<MathExprBuiltin>& builtins = _registry.builtins;
+        std::sort(_registry.byname.begin(), _registry.byname.end(), [&builtins](size_t l, size_t r){ return builtins[l].name < builtins[r].name; });
+        return _registry;
+    }();
+    return registry;
 }
-bool MathExpression::IsValidForName(char chr, bool bFirst)
+static const vector<MathExprBuiltin>& GetBuiltins()
 {
-    if(bFirst)
-        return (chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || chr == '_';
-    else
-        return IsValidForName(chr, 1) || (chr >= '0' && chr <= '9');
+    return GetRegistry().builtins;
 }
-bool MathExpression::IsValidOperator(char chr)
+static bool FindBuiltin(const string& name, size_t& offset)
 {
-    for(size_t i = 0; i < sizeof(__MathExpression_operators__)/sizeof(MathExpressionOperator); i++)
-    {
-        if(__MathExpression_operators__[i].repr[0] == chr)
-            return true;
-    }
-    return false;
+    const MathExprRegistry& registry = GetRegistry();
+    vector<size_t>::const_iterator it = std::lower_bound(registry.byname.begin(), registry.byname.end(), name, [&registry](size_t l, const string& r){ return registry.builtins[l].name < r; });
+    if(it == registry.byname.end() || registry.builtins[*it].name != name)
+        return false;
+    offset = *it;
+    return true;
 }
-bool MathExpression::IsValidWhiteSpace(char chr)
+
+static const string* InternName(const string& name)
 {
-    return chr == ' ' || chr == '\n' || chr == '\r' || chr == '\t' || chr == '\f' || chr == '\v';
+    // Names are never released. Elements of a hash set do not move, not even on rehash, so
+    // the returned pointer stays valid while other threads intern more names. The table is
+    // split into shards by hash, so that compiles running in parallel rarely wait.
+    static const size_t nShards = 64;
+    static std::mutex locks[nShards];
+    static unordered_set<string> names[nShards];
+    size_t nHash = std::hash<string>()(name);
+    size_t nShard = (nHash ^ (nHash >> 17)) % nShards;
+    std::lock_guard<std::mutex> guard(locks[nShard]);
+    return &*names[nShard].insert(name).first;
 }
-bool MathExpression::IsOperatorWithGreaterPrecedence(const string& A, const string& B)
+static size_t AddName(vector<const string*>& names, const string& name)
 {
-    // assumes that A and b are valid operators.
-    size_t offsetOpA = 0, offsetOpB = 0;
-    for(size_t i = 0; i < sizeof(__MathExpression_operators__)/sizeof(MathExpressionOperator); i++)
+    // a program has few names, a linear search avoids interning the same name again
+    for(size_t i = 0; i < names.size(); i++)
     {
-        if(__MathExpression_operators__[i].repr == A)
-            offsetOpA = i;
-        else if(__MathExpression_operators__[i].repr == B)
-            offsetOpB = i;
+        if(*names[i] == name)
+            return i;
     }
-    
-    return __MathExpression_operators__[offsetOpA] > __MathExpression_operators__[offsetOpB];
+    names.push_back(InternName(name));
+    return names.size() - 1;
 }
-bool MathExpression::GetSubExpressionLength(const char* lpcszExpr, size_t& nExprSubLength)    // leading '(' and ending ')' included
+static bool HasName(const vector<const string*>& names, const string& name)
 {
-    size_t nExprLength = strlen(lpcszExpr);
+    for(size_t i = 0; i < names.size(); i++)
+    {
+        if(*names[i] == name)
+            return true;
+    }
+    return false;
+}
+
+static void NumberRandomStreams(vector<MathExpressionNode>& nodes, size_t& nStream)
+{
+    // rand() and randn() become rand(k) for the k-th such call in the program, so that each
+    // call draws independently of the others. An explicit stream may share one on purpose.
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        MathExpressionNode& node = nodes[i];
+        if(node.type != MathExprNodeType_Expression)
+            continue;
+        if(node.children.empty() && i && nodes[i - 1].type == MathExprNodeType_Function && IsRandomFunction(nodes[i - 1].repr))
+        {
+            char repr[32];
+            snprintf(repr, sizeof(repr), "%zu", nStream);
+            MathExpressionNode stream;
+            stream.type = MathExprNodeType_Number;
+            stream.nargs = 0;
+            stream.repr = repr;
+            stream.values.assign(1, static_cast<double>(nStream++));
+            node.children.push_back(stream);
+            nodes[i - 1].nargs = 1;
+        }
+        else
+            NumberRandomStreams(node.children, nStream);
+    }
+}
+MathExpressionProgram::MathExpressionProgram(const char* lpcszExpr)
+{
+    if(!IsBalanced(lpcszExpr))
+    {
+        m_error = "Parentheses Not Balanced";
+        return;
+    }
+    
+    // Statements are compiled one by one and their code is concatenated. An assignment pops
+    // the value of its statement into a variable, later statements load it as a local.
+    vector<string> statements;
+    GetStatements(lpcszExpr, statements);
+    
+    // the token tree and the RPN nodes only live while compiling
+    vector<MathExpressionNode> results;
+    map<string, double> folded;     // variables whose statement is a single number
+    size_t nStream = 0;
+    for(size_t i = 0; i < statements.size(); i++)
+    {
+        string target;
+        size_t nExprOffset = 0;
+        bool bAssignment = GetAssignment(statements[i], target, nExprOffset);
+        if(!bAssignment && i + 1 < statements.size())
+        {
+            m_error = "Expression Not Assigned.";
+            return;
+        }
+        
+        vector<MathExpressionNode> nodes;
+        if(!GetTokens(statements[i].c_str() + nExprOffset, nodes, m_error))
+            return;
+        NumberRandomStreams(nodes, nStream);
+        
+        if(!Validate(nodes))
+        {
+            m_error = "Tokens Order Invalid.";
+            return;
+        }
+        
+        vector<MathExpressionNode> statement;
+        ShuntingYard(statement, nodes, m_error);
+        
+        // names are reported as written, before folding, pruning and lowering
+        for(size_t j = 0; j < statement.size(); j++)
+        {
+            MathExpressionNode& node = statement[j];
+            if(node.type == MathExprNodeType_Symbol)
+            {
+                map<string, double>::const_iterator it = folded.find(node.repr);
+                if(it != folded.end())
+                {
+                    node.type = MathExprNodeType_Number;
+                    node.values.assign(1, it->second);
+                }
+                else if(HasName(m_locals, node.repr))
+                    node.type = MathExprNodeType_Local;
+                else
+                    AddName(m_symbols, node.repr);
+            }
+            else if(node.type == MathExprNodeType_Function)
+                AddName(m_functions, node.repr);
+        }
+        Optimize(statement);
+        results.insert(results.end(), statement.begin(), statement.end());
+        
+        if(bAssignment)
+        {
+            AddName(m_locals, target);
+            if(statement.size() == 1 && statement[0].type == MathExprNodeType_Number)
+                folded[target] = statement[0].values[0];
+            else
+                folded.erase(target);
+            
+            MathExpressionNode node;
+            node.type = MathExprNodeType_Assignment;
+            node.nargs = 0;
+            node.repr = target;
+            results.push_back(node);
+        }
+    }
+    
+    // a program ending with an assignment evaluates to the last assigned variable
+    if(results.size() && results.back().type == MathExprNodeType_Assignment)
+    {
+        MathExpressionNode node = results.back();
+        node.type = MathExprNodeType_Local;
+        results.push_back(node);
+    }
+    if(!Compact(results, m_code))
+        m_code.ops.clear();
+    m_code.ops.shrink_to_fit();
+    m_code.constants.shrink_to_fit();
+    
+    return;
+}
+MathExpressionProgram::MathExpressionProgram()
+{
+}
+MathExprCodeView MathExpressionProgram::Code() const
+{
+    if(m_storage)
+        return m_mapped;
+    MathExprCodeView view = {m_code.ops.data(), m_code.ops.size(), m_code.constants.data(), m_code.constants.size()};
+    return view;
+}
+const string& MathExpressionProgram::Error() const
+{
+    return m_error;
+}
+void MathExpressionProgram::Symbols(set<string>& symbols) const
+{
+    symbols.clear();
+    for(size_t i = 0; i < m_symbols.size(); i++)
+        symbols.insert(*m_symbols[i]);
+}
+void MathExpressionProgram::Functions(set<string>& functions) const
+{
+    functions.clear();
+    for(size_t i = 0; i < m_functions.size(); i++)
+        functions.insert(*m_functions[i]);
+}
+void MathExpressionProgram::BindSymbols(const map<string, double>& symbols)
+{
+    if(!symbols.size())
+        return;
+    
+    // bound symbols become constants and are folded like literal numbers
+    vector<MathExpressionNode> nodes;
+    Expand(nodes);
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        if(nodes[i].type == MathExprNodeType_Symbol)
+        {
+            map<string, double>::const_iterator it = symbols.find(nodes[i].repr);
+            if(it != symbols.end())
+            {
+                nodes[i].type = MathExprNodeType_Number;
+                nodes[i].values.resize(1);
+                nodes[i].values[0] = it->second;
+            }
+        }
+    }
+    Optimize(nodes);
+    Compact(nodes, m_code);
+    m_storage.reset();
+}
+size_t MathExpressionProgram::MemoryUsage() const
+{
+    size_t nBytes = sizeof(*this);
+    nBytes += m_code.ops.capacity() * sizeof(MathExprOp);
+    nBytes += m_code.constants.capacity() * sizeof(double);
+    nBytes += (m_slots.capacity() + m_calls.capacity() + m_symbols.capacity() + m_functions.capacity() + m_locals.capacity()) * sizeof(const string*);
+    nBytes += m_fn.capacity() * sizeof(MathExprUserFunction);
+    if(m_error.capacity() > sizeof(string))
+        nBytes += m_error.capacity();
+    return nBytes;
+}
+size_t MathExpressionProgram::MaxStackDepth() const
+{
+    MathExprCodeView view = Code();
+    size_t nDepth = 0, nMaxDepth = 0;
+    for(size_t i = 0; i < view.nops; i++)
+    {
+        const MathExprOp& op = view.ops[i];
+        if(op.type == MathExprNodeType_Operator)
+            nDepth--;
+        else if(op.type == MathExprNodeType_Function)
+            nDepth = nDepth + 1 - op.nargs;
+        else if(op.type == MathExprNodeType_Assignment)
+            nDepth--;
+        else if(op.type != MathExprNodeType_Sign)
+            nDepth++;
+        if(nMaxDepth < nDepth)
+            nMaxDepth = nDepth;
+    }
+    return nMaxDepth;
+}
+static double GetOpCost(const MathExprOp& op)
+{
+    // Nanoseconds per row from the registry. Loading a column copies a segment and costs as
+    // much as an operator, i.e. a multiply, and a user function, whose cost is unknown, ten.
+    const MathExprRegistry& registry = GetRegistry();
+    if(op.type == MathExprNodeType_Operator || op.type == MathExprNodeType_Sign)
+        return registry.unit;
+    if(op.type == MathExprNodeType_Symbol || op.type == MathExprNodeType_Local)
+        return registry.unit;
+    if(op.type != MathExprNodeType_Function)
+        return 0;
+    if(op.code == MathExprCall_Builtin)
+        return registry.builtins[op.index].cost;
+    if(op.code == MathExprCall_User)
+        return 10 * registry.unit;
+    return op.nargs * registry.unit;
+}
+double MathExpressionProgram::GetRowCost() const
+{
+    MathExprCodeView view = Code();
+    double fCost = 0;
+    for(size_t i = 0; i < view.nops; i++)
+        fCost += GetOpCost(view.ops[i]);
+    return fCost;
+}
+bool MathExpressionProgram::Explain(string& text, size_t nRows, MathExpressionContext& context) const
+{
+    MathExprPlan plan;
+    if(!PlanEvaluation(context, nRows, 0, GetSegmentSize(), plan, context.m_error))
+        return false;
+    
+    // the mix of ops behind the cost, in order of first use
+    MathExprCodeView view = Code();
+    vector<string> names;
+    vector<size_t> counts;
+    vector<double> costs;
+    for(size_t i = 0; i < view.nops; i++)
+    {
+        const MathExprOp& op = view.ops[i];
+        if(GetOpCost(op) == 0)
+            continue;
+        string name;
+        if(op.type == MathExprNodeType_Symbol)
+            name = *m_slots[op.index];
+        else if(op.type == MathExprNodeType_Local)
+            name = *m_locals[op.index];
+        else if(op.type == MathExprNodeType_Function && op.code == MathExprCall_Builtin)
+            name = GetBuiltins()[op.index].name;
+        else if(op.type == MathExprNodeType_Function && op.code == MathExprCall_User)
+            name = *m_calls[op.index];
+        else if(op.type == MathExprNodeType_Function && op.code == MathExprCall_Reduction)
+            name = __MathExpression_reductions__[op.index];
+        else if(op.type == MathExprNodeType_Function)
+            name = "if";
+        else
+        {
+            for(size_t j = 0; j < sizeof(__MathExpression_operators__)/sizeof(MathExpressionOperator); j++)
+            {
+                if(__MathExpression_operators__[j].code == op.code)
+                    name = __MathExpression_operators__[j].repr;
+            }
+            if(op.type == MathExprNodeType_Sign && op.code != MathExprOpCode_Not)
+                name = "unary " + name;
+        }
+        size_t nName = std::find(names.begin(), names.end(), name) - names.begin();
+        if(nName == names.size())
+        {
+            names.push_back(name);
+            counts.push_back(0);
+            costs.push_back(GetOpCost(op));
+        }
+        counts[nName]++;
+    }
+    
+    char buf[128];
+    snprintf(buf, sizeof(buf), "rows: %zu\ncost: %.3g ns per row\n", plan.rows, plan.cost);
+    text = buf;
+    snprintf(buf, sizeof(buf), "kernel: %s, %zu thread(s), segments of %zu rows\n", plan.threads > 1 ? "parallel" : "serial", plan.threads, plan.segment);
+    text += buf;
+    for(size_t i = 0; i < names.size(); i++)
+    {
+        snprintf(buf, sizeof(buf), "  %-8s %zu x %.3g ns\n", names[i].c_str(), counts[i], costs[i]);
+        text += buf;
+    }
+    return true;
+}
+// Binary format, version 2. Every offset is relative to the start of the file and every
+// array is 8-byte aligned, so the file can be mapped at any address and used in place.
+// Names are stored once in a blob at the end and interned again on load. Version 2 adds
+// the variables of multi-statement programs.
+#define MATH_EXPRESSION_FILE_VERSION    2
+
+typedef struct MathExprFileHeader
+{
+    char magic[8];                  // "MEXPRBIN"
+    unsigned int version;
+    unsigned int byteorder;         // 0x01020304 as written
+    unsigned int opsize;            // sizeof(MathExprOp)
+    unsigned int nbuiltins;         // built-in table the code was compiled against
+    unsigned long long builtins;    // nbuiltins MathExprFileName
+    unsigned long long programs;    // nprograms MathExprFileProgram
+    unsigned long long nprograms;
+    unsigned long long names;       // name blob
+    unsigned long long nnames;      // bytes
+    unsigned long long size;        // bytes of the whole file
+} MathExprFileHeader;
+
+typedef struct MathExprFileName
+{
+    unsigned int offset;            // into the name blob
+    unsigned int length;
+} MathExprFileName;
+
+typedef struct MathExprFileProgram
+{
+    unsigned long long ops;         // nops MathExprOp
+    unsigned long long nops;
+    unsigned long long constants;   // nconstants double
+    unsigned long long nconstants;
+    unsigned long long names;       // nslots + ncalls + nsymbols + nfunctions + nlocals MathExprFileName
+    unsigned int nslots;
+    unsigned int ncalls;
+    unsigned int nsymbols;
+    unsigned int nfunctions;
+    MathExprFileName error;         // compile error, empty for a valid program
+    unsigned int nlocals;
+    unsigned int reserved;          // 0
+} MathExprFileProgram;
+
+static unsigned long long AppendAligned(vector<char>& buffer, const void* p, size_t nBytes)
+{
+    buffer.resize((buffer.size() + 7) / 8 * 8, 0);
+    unsigned long long offset = buffer.size();
+    if(nBytes)
+        buffer.insert(buffer.end(), static_cast<const char*>(p), static_cast<const char*>(p) + nBytes);
+    return offset;
+}
+static MathExprFileName AddFileName(string& blob, map<string, MathExprFileName>& names, const string& name)
+{
+    map<string, MathExprFileName>::const_iterator it = names.find(name);
+    if(it != names.end())
+        return it->second;
+    MathExprFileName ref;
+    ref.offset = static_cast<unsigned int>(blob.size());
+    ref.length = static_cast<unsigned int>(name.size());
+    blob += name;
+    names[name] = ref;
+    return ref;
+}
+static bool IsInFile(unsigned long long offset, unsigned long long count, size_t nItemSize, size_t nSize)
+{
+    // in bounds, 8-byte aligned and without overflow
+    if(offset % 8 || offset > nSize)
+        return false;
+    return count <= (nSize - offset) / nItemSize;
+}
+static bool ValidateCode(const MathExprOp* ops, size_t nOps, size_t nConstants, size_t nSlots, size_t nCalls, size_t nLocals)
+{
+    // every index must be in range, a variable must be assigned before it is loaded and
+    // the RPN must leave exactly one value
+    vector<bool> assigned(nLocals, false);
+    size_t nDepth = 0;
+    for(size_t i = 0; i < nOps; i++)
+    {
+        const MathExprOp& op = ops[i];
+        size_t nArgs = 0;
+        size_t nResults = 1;
+        switch(op.type)
+        {
+            case MathExprNodeType_Local:
+                if(op.index >= nLocals || !assigned[op.index])
+                    return false;
+                break;
+            case MathExprNodeType_Assignment:
+                if(op.index >= nLocals)
+                    return false;
+                assigned[op.index] = true;
+                nArgs = 1;
+                nResults = 0;
+                break;
+            case MathExprNodeType_Number:
+                if(op.index >= nConstants)
+                    return false;
+                break;
+            case MathExprNodeType_Symbol:
+                if(op.index >= nSlots)
+                    return false;
+                break;
+            case MathExprNodeType_Operator:
+            case MathExprNodeType_Sign:
+                if(op.code >= MathExprOpCodeCount)
+                    return false;
+                nArgs = op.type == MathExprNodeType_Operator ? 2 : 1;
+                break;
+            case MathExprNodeType_Function:
+                if((op.code == MathExprCall_Builtin && op.index >= GetBuiltins().size()) || \
+                   (op.code == MathExprCall_Select && op.index > 1) || \
+                   (op.code == MathExprCall_Reduction && op.index >= sizeof(__MathExpression_reductions__)/sizeof(const char*)) || \
+                   (op.code == MathExprCall_User && op.index >= nCalls) || op.code > MathExprCall_User)
+                    return false;
+                // the arity of a built-in is that of the running registry, user functions are checked when bound
+                if((op.code == MathExprCall_Builtin && GetBuiltins()[op.index].arity && op.nargs != GetBuiltins()[op.index].arity) || \
+                   (op.code == MathExprCall_Select && op.nargs != 3) || (op.code == MathExprCall_Reduction && op.nargs != 1))
+                    return false;
+                nArgs = op.nargs;
+                break;
+            default:
+                return false;
+        }
+        if(nDepth < nArgs)
+            return false;
+        nDepth = nDepth - nArgs + nResults;
+    }
+    return nOps == 0 || nDepth == 1;
+}
+
+bool MathExpressionProgram::Save(vector<char>& buffer, const vector<shared_ptr<const MathExpressionProgram> >& programs, string& error)
+{
+    buffer.assign(sizeof(MathExprFileHeader), 0);
+    
+    string blob;
+    map<string, MathExprFileName> names;
+    
+    const vector<MathExprBuiltin>& builtins = GetBuiltins();
+    vector<MathExprFileName> refs;
+    for(size_t i = 0; i < builtins.size(); i++)
+        refs.push_back(AddFileName(blob, names, builtins[i].name));
+    unsigned long long nBuiltinsOffset = AppendAligned(buffer, refs.data(), refs.size() * sizeof(MathExprFileName));
+    
+    vector<MathExprFileProgram> records(programs.size());
+    for(size_t i = 0; i < programs.size(); i++)
+    {
+        const MathExpressionProgram* pProgram = programs[i].get();
+        if(!pProgram)
+        {
+            error = "Invalid Program.";
+            return false;
+        }
+        MathExprCodeView view = pProgram->Code();
+        MathExprFileProgram& record = records[i];
+        record.nops = view.nops;
+        record.ops = AppendAligned(buffer, view.ops, view.nops * sizeof(MathExprOp));
+        record.nconstants = view.nconstants;
+        record.constants = AppendAligned(buffer, view.constants, view.nconstants * sizeof(double));
+        
+        refs.clear();
+        const vector<const string*>* lists[] = {&pProgram->m_slots, &pProgram->m_calls, &pProgram->m_symbols, &pProgram->m_functions, &pProgram->m_locals};
+        for(size_t j = 0; j < sizeof(lists)/sizeof(lists[0]); j++)
+        {
+            for(size_t k = 0; k < lists[j]->size(); k++)
+                refs.push_back(AddFileName(blob, names, *(*lists[j])[k]));
+        }
+        record.nslots = static_cast<unsigned int>(pProgram->m_slots.size());
+        record.ncalls = static_cast<unsigned int>(pProgram->m_calls.size());
+        record.nsymbols = static_cast<unsigned int>(pProgram->m_symbols.size());
+        record.nfunctions = static_cast<unsigned int>(pProgram->m_functions.size());
+        record.nlocals = static_cast<unsigned int>(pProgram->m_locals.size());
+        record.reserved = 0;
+        record.names = AppendAligned(buffer, refs.data(), refs.size() * sizeof(MathExprFileName));
+        record.error = AddFileName(blob, names, pProgram->m_error);
+    }
+    if(blob.size() > (numeric_limits<unsigned int>::max)())
+    {
+        error = "Too Many Names.";
+        return false;
+    }
+    
+    MathExprFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MEXPRBIN", sizeof(header.magic));
+    header.version = MATH_EXPRESSION_FILE_VERSION;
+    header.byteorder = 0x01020304;
+    header.opsize = sizeof(MathExprOp);
+    header.nbuiltins = static_cast<unsigned int>(builtins.size());
+    header.builtins = nBuiltinsOffset;
+    header.nprograms = records.size();
+    header.programs = AppendAligned(buffer, records.data(), records.size() * sizeof(MathExprFileProgram));
+    header.nnames = blob.size();
+    header.names = AppendAligned(buffer, blob.data(), blob.size());
+    buffer.resize((buffer.size() + 7) / 8 * 8, 0);
+    header.size = buffer.size();
+    memcpy(buffer.data(), &header, sizeof(header));
+    return true;
+}
+bool MathExpressionProgram::Save(const char* lpcszPath, const vector<shared_ptr<const MathExpressionProgram> >& programs, string& error)
+{
+    vector<char> buffer;
+    if(!Save(buffer, programs, error))
+        return false;
+    
+    FILE* fp = fopen(lpcszPath, "wb");
+    if(!fp)
+    {
+        error = "Cannot Open File.";
+        return false;
+    }
+    bool bOK = fwrite(buffer.data(), 1, buffer.size(), fp) == buffer.size();
+    bOK = fclose(fp) == 0 && bOK;
+    if(!bOK)
+        error = "Cannot Write File.";
+    return bOK;
+}
+bool MathExpressionProgram::Load(const shared_ptr<const void>& storage, size_t nSize, vector<shared_ptr<const MathExpressionProgram> >& programs, string& error)
+{
+    programs.clear();
+    
+    // nothing is parsed, the file is only validated before its code is used in place
+    const char* p = static_cast<const char*>(storage.get());
+    MathExprFileHeader header;
+    if(!p || nSize < sizeof(header) || reinterpret_cast<size_t>(p) % 8)
+    {
+        error = "Invalid File.";
+        return false;
+    }
+    memcpy(&header, p, sizeof(header));
+    if(memcmp(header.magic, "MEXPRBIN", sizeof(header.magic)) != 0 || header.byteorder != 0x01020304 || header.size != nSize)
+    {
+        error = "Invalid File.";
+        return false;
+    }
+    if(header.version != MATH_EXPRESSION_FILE_VERSION || header.opsize != sizeof(MathExprOp))
+    {
+        error = "Unsupported File Version.";
+        return false;
+    }
+    if(!IsInFile(header.builtins, header.nbuiltins, sizeof(MathExprFileName), nSize) || \
+       !IsInFile(header.programs, header.nprograms, sizeof(MathExprFileProgram), nSize) || \
+       header.names > nSize || header.nnames > nSize - header.names)
+    {
+        error = "Invalid File.";
+        return false;
+    }
+    
+    const char* blob = p + header.names;
+    const MathExprFileName* builtins = reinterpret_cast<const MathExprFileName*>(p + header.builtins);
+    // built-in IDs are registration order, so files from builds with fewer of them still load
+    if(header.nbuiltins > GetBuiltins().size())
+    {
+        error = "Built-in Functions Mismatch.";
+        return false;
+    }
+    for(size_t i = 0; i < header.nbuiltins; i++)
+    {
+        const string& name = GetBuiltins()[i].name;
+        if(builtins[i].offset > header.nnames || builtins[i].length > header.nnames - builtins[i].offset || \
+           name.size() != builtins[i].length || name.compare(0, name.size(), blob + builtins[i].offset, builtins[i].length) != 0)
+        {
+            error = "Built-in Functions Mismatch.";
+            return false;
+        }
+    }
+    
+    const MathExprFileProgram* records = reinterpret_cast<const MathExprFileProgram*>(p + header.programs);
+    programs.reserve(static_cast<size_t>(header.nprograms));
+    for(size_t i = 0; i < header.nprograms; i++)
+    {
+        const MathExprFileProgram& record = records[i];
+        unsigned long long nNames = static_cast<unsigned long long>(record.nslots) + record.ncalls + record.nsymbols + record.nfunctions + record.nlocals;
+        if(!IsInFile(record.ops, record.nops, sizeof(MathExprOp), nSize) || \
+           !IsInFile(record.constants, record.nconstants, sizeof(double), nSize) || \
+           !IsInFile(record.names, nNames, sizeof(MathExprFileName), nSize))
+        {
+            programs.clear();
+            error = "Invalid File.";
+            return false;
+        }
+        
+        shared_ptr<MathExpressionProgram> program(new MathExpressionProgram());
+        program->m_storage = storage;
+        program->m_mapped.ops = reinterpret_cast<const MathExprOp*>(p + record.ops);
+        program->m_mapped.nops = static_cast<size_t>(record.nops);
+        program->m_mapped.constants = reinterpret_cast<const double*>(p + record.constants);
+        program->m_mapped.nconstants = static_cast<size_t>(record.nconstants);
+        
+        const MathExprFileName* refs = reinterpret_cast<const MathExprFileName*>(p + record.names);
+        vector<const string*>* lists[] = {&program->m_slots, &program->m_calls, &program->m_symbols, &program->m_functions, &program->m_locals};
+        unsigned int counts[] = {record.nslots, record.ncalls, record.nsymbols, record.nfunctions, record.nlocals};
+        for(size_t j = 0; j < sizeof(lists)/sizeof(lists[0]); j++)
+        {
+            lists[j]->reserve(counts[j]);
+            for(size_t k = 0; k < counts[j]; k++, refs++)
+            {
+                if(refs->offset > header.nnames || refs->length > header.nnames - refs->offset)
+                {
+                    programs.clear();
+                    error = "Invalid File.";
+                    return false;
+                }
+                lists[j]->push_back(InternName(string(blob + refs->offset, refs->length)));
+            }
+        }
+        if(record.error.offset > header.nnames || record.error.length > header.nnames - record.error.offset)
+        {
+            programs.clear();
+            error = "Invalid File.";
+            return false;
+        }
+        program->m_error.assign(blob + record.error.offset, record.error.length);
+        MathExprUserFunction fn = {NULL, 0, false};
+        program->m_fn.assign(record.ncalls, fn);
+        
+        if(!ValidateCode(program->m_mapped.ops, program->m_mapped.nops, program->m_mapped.nconstants, record.nslots, record.ncalls, record.nlocals))
+        {
+            programs.clear();
+            error = "Invalid Program.";
+            return false;
+        }
+        programs.push_back(program);
+    }
+    return true;
+}
+bool MathExpressionProgram::Load(const char* lpcszPath, vector<shared_ptr<const MathExpressionProgram> >& programs, string& error)
+{
+    programs.clear();
+    
+    // the mapping is released with the last program that uses it
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(lpcszPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(hFile == INVALID_HANDLE_VALUE)
+    {
+        error = "Cannot Open File.";
+        return false;
+    }
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(hFile, &size) || size.QuadPart < static_cast<LONGLONG>(sizeof(MathExprFileHeader)))
+    {
+        CloseHandle(hFile);
+        error = "Invalid File.";
+        return false;
+    }
+    HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(hFile);
+    if(!hMapping)
+    {
+        error = "Cannot Map File.";
+        return false;
+    }
+    const void* pView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hMapping);
+    if(!pView)
+    {
+        error = "Cannot Map File.";
+        return false;
+    }
+    size_t nSize = static_cast<size_t>(size.QuadPart);
+    shared_ptr<const void> storage(pView, [](const void* p){ UnmapViewOfFile(p); });
+#else
+    int fd = open(lpcszPath, O_RDONLY);
+    if(fd < 0)
+    {
+        error = "Cannot Open File.";
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(MathExprFileHeader)))
+    {
+        close(fd);
+        error = "Invalid File.";
+        return false;
+    }
+    size_t nSize = static_cast<size_t>(st.st_size);
+    void* pView = mmap(NULL, nSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(pView == MAP_FAILED)
+    {
+        error = "Cannot Map File.";
+        return false;
+    }
+    shared_ptr<const void> storage(pView, [nSize](const void* p){ munmap(const_cast<void*>(p), nSize); });
+#endif
+    return Load(storage, nSize, programs, error);
+}
+bool MathExpressionProgram::Compile(const vector<string>& exprs, vector<shared_ptr<const MathExpressionProgram> >& programs)
+{
+    // Programs are independent, only the name table is shared and it is sharded by hash,
+    // so threads rarely wait on each other.
+    programs.assign(exprs.size(), shared_ptr<const MathExpressionProgram>());
+    
+    signed long long N = static_cast<signed long long>(exprs.size());
+    size_t nCompileError = 0;
+#pragma omp parallel for schedule(dynamic, 64) reduction(+: nCompileError)
+    for(signed long long i = 0; i < N; i++)
+    {
+        shared_ptr<MathExpressionProgram> program(new MathExpressionProgram(exprs[i].c_str()));
+        if(!program->Error().empty())
+            nCompileError++;
+        programs[i] = program;
+    }
+    return nCompileError == 0;
+}
+
+#ifdef MATH_EXPRESSION_HAS_STRING_VIEW
+static void AddName(vector<string_view>& names, string_view name)
+{
+    if(std::find(names.begin(), names.end(), name) == names.end())
+        names.push_back(name);
+}
+bool MathExpressionProgram::Scan(string_view expr, MathExprNames& names)
+{
+    // One pass over the characters, following the token rules of GetTokens(). Names are
+    // views into expr, so the only allocations are the growth of the name lists.
+    names.valid = false;
+    names.symbols.clear();
+    names.functions.clear();
+    
+    vector<string_view> locals;     // assigned by an earlier statement, not symbols
+    size_t nDepth = 0;
+    size_t nLength = expr.size();
+    for(size_t i = 0; i < nLength;)
+    {
+        char chr = expr[i];
+        if(chr == '(')
+        {
+            nDepth++;
+            i++;
+        }
+        else if(chr == ')')
+        {
+            if(!nDepth)
+                return false;
+            nDepth--;
+            i++;
+        }
+        else if(IsValidForName(chr, true))
+        {
+            size_t j = i + 1;
+            while(j < nLength && IsValidForName(expr[j], false))
+                j++;
+            string_view name = expr.substr(i, j - i);
+            
+            // a name followed by '(' is a function
+            i = j;
+            while(j < nLength && IsValidWhiteSpace(expr[j]))
+                j++;
+            if(j < nLength && expr[j] == '(')
+                AddName(names.functions, name);
+            else if(j < nLength && expr[j] == '=' && (j + 1 == nLength || expr[j + 1] != '='))
+            {
+                AddName(locals, name);
+                i = j + 1;
+            }
+            else if(std::find(locals.begin(), locals.end(), name) == locals.end())
+                AddName(names.symbols, name);
+        }
+        else if(IsValidForNumberBeginning(chr))
+        {
+            // decimal digits, fraction and exponent as accepted by strtod()
+            size_t j = i;
+            while(j < nLength && ((expr[j] >= '0' && expr[j] <= '9') || expr[j] == '.'))
+                j++;
+            if(j < nLength && (expr[j] == 'e' || expr[j] == 'E'))
+            {
+                size_t k = j + 1;
+                if(k < nLength && (expr[k] == '+' || expr[k] == '-'))
+                    k++;
+                if(k < nLength && expr[k] >= '0' && expr[k] <= '9')
+                {
+                    j = k;
+                    while(j < nLength && expr[j] >= '0' && expr[j] <= '9')
+                        j++;
+                }
+            }
+            i = j;
+        }
+        else if(chr == ',' || chr == ';' || IsValidWhiteSpace(chr))
+        {
+            i++;
+        }
+        else
+        {
+            size_t nOperatorLength = 0;
+            for(size_t j = 0; j < sizeof(__MathExpression_operators__)/sizeof(MathExpressionOperator) && !nOperatorLength; j++)
+            {
+                const string& repr = __MathExpression_operators__[j].repr;
+                if(repr.size() <= nLength - i && expr.compare(i, repr.size(), repr) == 0)
+                    nOperatorLength = repr.size();
+            }
+            if(!nOperatorLength)
+                return false;
+            i += nOperatorLength;
+        }
+    }
+    
+    names.valid = nDepth == 0;
+    return names.valid;
+}
+bool MathExpressionProgram::Scan(const vector<string_view>& exprs, vector<MathExprNames>& names)
+{
+    names.resize(exprs.size());
+    
+    signed long long N = static_cast<signed long long>(exprs.size());
+    size_t nScanError = 0;
+#pragma omp parallel for schedule(dynamic, 1024) reduction(+: nScanError)
+    for(signed long long i = 0; i < N; i++)
+    {
+        if(!Scan(exprs[i], names[i]))
+            nScanError++;
+    }
+    return nScanError == 0;
+}
+#endif
+bool MathExpressionProgram::Evaluate(vector<double>& results, MathExpressionContext& context) const
+{
+    return EvaluateBindings(results, context.m_bindings, context);
+}
+bool MathExpressionProgram::Evaluate(double* results, size_t n, MathExpressionContext& context) const
+{
+    if(!results || !n)
+    {
+        context.m_error = "Results Size Mismatch.";
+        return false;
+    }
+    vector<double> unused;
+    MathExprNodeEvalTaskBuffer target = {results, n};
+    return EvaluateBindings(unused, context.m_bindings, context, NULL, NULL, &target);
+}
+bool MathExpressionProgram::Evaluate(vector<double>& results, const map<string, vector<double> >& symbols, MathExpressionContext& context) const
+{
+    map<string, MathExprNodeEvalTaskBuffer> bindings;
+    for(map<string, vector<double> >::const_iterator it = symbols.begin(); it != symbols.end(); it++)
+    {
+        MathExprNodeEvalTaskBuffer buffer;
+        buffer.n = it->second.size();
+        buffer.p = const_cast<double*>(it->second.data());
+        bindings[it->first] = buffer;
+    }
+    return EvaluateBindings(results, bindings, context);
+}
+static bool CopyOutputs(vector<vector<double> >& outputs, size_t offset, size_t n, const MathExprScratch& scratch)
+{
+    // variables of the segment just evaluated, a single value stands for the whole segment
+    for(size_t i = 0; i < outputs.size(); i++)
+    {
+        if(i >= scratch.locals.size())
+            return false;
+        const vector<double>& values = scratch.locals[i];
+        if(values.size() == n)
+            std::copy(values.begin(), values.end(), outputs[i].begin() + offset);
+        else if(values.size() == 1)
+            std::fill(outputs[i].begin() + offset, outputs[i].begin() + offset + n, values[0]);
+        else
+            return false;
+    }
+    return true;
+}
+bool MathExpressionProgram::EvaluateBindings(vector<double>& results, const map<string, MathExprNodeEvalTaskBuffer>& bindings, MathExpressionContext& context, vector<vector<double> >* pOutputs, MathExprProgress* pProgress, const MathExprNodeEvalTaskBuffer* pTarget, const vector<MathExpressionSink*>* pSinks) const
+{
+    results.resize(0);
+    context.m_error.clear();
+    
+    // nMaxLength is 1 in case expression has no symbol.
+    size_t nMaxLength = 1;
+    for(map<string, MathExprNodeEvalTaskBuffer>::const_iterator it = bindings.begin(); it != bindings.end(); it++)
+    {
+        if(it->second.n == 0)
+        {
+            context.m_error = "Empty Symbol.";
+            return false;
+        }
+        if(nMaxLength < it->second.n)
+            nMaxLength = it->second.n;
+    }
+    
+    size_t nSegmentSize = GetSegmentSize();
+    size_t nThreads = 1;
+    if(!PlanMemory(context, nMaxLength, pSinks ? 1 : 0, nSegmentSize, nThreads))
+        return false;
+    size_t nTasks = nMaxLength / nSegmentSize;
+    if((numeric_limits<unsigned long long>::max)() < nTasks)
+    {
+        context.m_error = "Not Enough Memory.";
+        return false;
+    }
+    if(nMaxLength > nTasks * nSegmentSize)
+        nTasks++;
+    if(!nTasks)
+        return false;
+    
+    typedef struct {
+        size_t _offset;
+        size_t _n;
+        vector<MathExprNodeEvalTaskBuffer> _slots;  // unbound slots are empty
+    } MathExprNodeEvalTask;
+    
+    vector<MathExprNodeEvalTask> tasks(nTasks);
+    for(size_t i = 0; i < nTasks; i++)
+    {
+        tasks[i]._offset = i * nSegmentSize;
+        tasks[i]._n = nMaxLength - i * nSegmentSize < nSegmentSize ? nMaxLength - i * nSegmentSize : nSegmentSize;
+        MathExprNodeEvalTaskBuffer empty = {NULL, 0};
+        tasks[i]._slots.assign(m_slots.size() + 1, empty);
+        for(map<string, MathExprNodeEvalTaskBuffer>::const_iterator it = bindings.begin(); it != bindings.end(); it++)
+        {
+            MathExprNodeEvalTaskBuffer buffer;
+            if(it->second.n == 1)
+            {
+                // single values are shared by all segments
+                buffer = it->second;
+            }
+            else if(it->second.n == nMaxLength)
+            {
+                buffer.n = tasks[i]._n;
+                buffer.p = it->second.p + tasks[i]._offset;
+            }
+            else
+            {
+                context.m_error = "Symbol Size Mismatch.";
+                return false;
+            }
+            size_t nSlot;
+            if(FindSymbol(it->first, nSlot))
+                tasks[i]._slots[nSlot] = buffer;
+        }
+    }
+    
+    if(context.m_scratch.size() < GetThreadCount())
+        context.m_scratch.resize(GetThreadCount());
+    
+    signed long long N = static_cast<signed long long>(nTasks);
+    size_t nEvalError = 0;
+    
+    // Reductions are resolved innermost first. Each one is fused into a single pass over
+    // the segments, and its value then takes the place of the reduced sub-expression.
+    MathExprCodeView view = Code();
+    MathExprCode code;
+    bool bCopied = false;
+    size_t nReduction = 0;
+    if(pProgress)
+    {
+        size_t nPasses = 1;
+        for(size_t i = 0; i < view.nops; i++)
+            nPasses += view.ops[i].type == MathExprNodeType_Function && view.ops[i].code == MathExprCall_Reduction;
+        pProgress->total = nTasks * nPasses;
+    }
+    while(FindReduction(view.ops, view.nops, nReduction))
+    {
+        if(!bCopied)
+        {
+            code.ops.assign(view.ops, view.ops + view.nops);
+            code.constants.assign(view.constants, view.constants + view.nconstants);
+            bCopied = true;
+        }
+        
+        size_t nStart = 0;
+        if(!nReduction || !GetOperandStart(code.ops, nReduction - 1, nStart))
+        {
+            context.m_error = "Evaluation Failed.";
+            return false;
+        }
+        
+        // the operand may load variables, so the statements before its own one run first
+        vector<MathExprOp> operand;
+        for(size_t i = nStart; i >= 1; i--)
+        {
+            if(code.ops[i - 1].type == MathExprNodeType_Assignment)
+            {
+                operand.assign(code.ops.begin(), code.ops.begin() + i);
+                break;
+            }
+        }
+        operand.insert(operand.end(), code.ops.begin() + nStart, code.ops.begin() + nReduction);
+        
+        string repr(__MathExpression_reductions__[code.ops[nReduction].index]);
+        vector<MathExprReductionPartial> partials(nTasks);
+#pragma omp parallel for num_threads(nThreads) if(nThreads > 1) reduction(+: nEvalError)
+        for(signed long long i = 0; i < N; i++)
+        {
+            MathExprScratch& scratch = context.m_scratch[GetThreadIndex()];
+            SetPosition(scratch, context.m_seed, tasks[i]._offset, NULL, tasks[i]._n);
+            if(pProgress && pProgress->cancelled)
+                nEvalError++;
+            else if(!ReduceEx(partials[i], repr, tasks[i]._n, tasks[i]._slots.data(), operand.data(), operand.size(), code.constants.data(), scratch))
+                nEvalError++;
+            else if(pProgress)
+                pProgress->done++;
+        }
+        if(nEvalError)
+        {
+            context.m_error = pProgress && pProgress->cancelled ? "Evaluation Cancelled." : "Evaluation Failed.";
+            return false;
+        }
+        
+        MathExprOp op;
+        op.type = MathExprNodeType_Number;
+        op.code = 0;
+        op.nargs = 0;
+        op.index = static_cast<unsigned int>(code.constants.size());
+        code.constants.push_back(ReducePartials(repr, partials.data(), partials.size()));
+        code.ops.erase(code.ops.begin() + nStart, code.ops.begin() + nReduction + 1);
+        code.ops.insert(code.ops.begin() + nStart, op);
+        
+        MathExprCodeView reduced = {code.ops.data(), code.ops.size(), code.constants.data(), code.constants.size()};
+        view = reduced;
+    }
+    
+    // an expression without symbols, e.g. a fully reduced one, is a single value, unless
+    // it draws random numbers, which differ from row to row
+    bool bHasSymbol = false;
+    for(size_t i = 0; i < view.nops && !bHasSymbol; i++)
+        bHasSymbol = view.ops[i].type == MathExprNodeType_Symbol || \
+                     (view.ops[i].type == MathExprNodeType_Function && view.ops[i].code == MathExprCall_Builtin && GetBuiltins()[view.ops[i].index].fr);
+    if(!bHasSymbol)
+        nMaxLength = 1;
+    
+    // results go to the caller's buffer when there is one, a single value fills it
+    if(pTarget && bHasSymbol && pTarget->n != nMaxLength)
+    {
+        context.m_error = "Results Size Mismatch.";
+        return false;
+    }
+    if(!pTarget && !pSinks)
+        results.resize(nMaxLength);
+    double* pResults = pTarget ? pTarget->p : results.data();
+    if(pOutputs)
+        pOutputs->assign(m_locals.size(), vector<double>(nMaxLength));
+    
+    // sinks are fed by clones, one set per thread, so a failed call leaves them untouched
+    vector<vector<shared_ptr<MathExpressionSink> > > states;
+    if(pSinks)
+    {
+        states.resize(nThreads);
+        for(size_t i = 0; i < nThreads; i++)
+        {
+            for(size_t j = 0; j < pSinks->size(); j++)
+                states[i].push_back((*pSinks)[j]->Clone());
+        }
+    }
+    if(!bHasSymbol)
+    {
+        double value = 0;
+        SetPosition(context.m_scratch[0], context.m_seed, 0, NULL, 1);
+        if(EvaluateEx(pSinks ? &value : pResults, 1, tasks[0]._slots.data(), view.ops, view.nops, view.constants, context.m_scratch[0]) && \
+           (!pOutputs || CopyOutputs(*pOutputs, 0, 1, context.m_scratch[0])))
+        {
+            if(pTarget)
+                std::fill(pResults + 1, pResults + pTarget->n, pResults[0]);
+            for(size_t j = 0; pSinks && j < pSinks->size(); j++)
+                (*pSinks)[j]->Consume(&value, 0, 1);
+            if(pProgress)
+                pProgress->done += nTasks;
+            return true;
+        }
+        results.resize(0);
+        context.m_error = "Evaluation Failed.";
+        return false;
+    }
+    
+#pragma omp parallel for num_threads(nThreads) if(nThreads > 1) reduction(+: nEvalError)
+    for(signed long long i = 0; i < N; i++)
+    {
+        MathExprScratch& scratch = context.m_scratch[GetThreadIndex()];
+        SetPosition(scratch, context.m_seed, tasks[i]._offset, NULL, tasks[i]._n);
+        double* pSegment = pResults + tasks[i]._offset;
+        if(pSinks)
+        {
+            if(scratch.gathered.empty())
+                scratch.gathered.resize(1);
+            scratch.gathered[0].resize(tasks[i]._n);
+            pSegment = scratch.gathered[0].data();
+        }
+        if(pProgress && pProgress->cancelled)
+            nEvalError++;
+        else if(!EvaluateEx(pSegment, tasks[i]._n, tasks[i]._slots.data(), view.ops, view.nops, view.constants, scratch) || \
+                (pOutputs && !CopyOutputs(*pOutputs, tasks[i]._offset, tasks[i]._n, scratch)))
+            nEvalError++;
+        else
+        {
+            for(size_t j = 0; pSinks && j < pSinks->size(); j++)
+                states[GetThreadIndex()][j]->Consume(pSegment, tasks[i]._offset, tasks[i]._n);
+            if(pProgress)
+                pProgress->done++;
+        }
+    }
+    if(nEvalError)
+    {
+        results.resize(0);
+        context.m_error = pProgress && pProgress->cancelled ? "Evaluation Cancelled." : "Evaluation Failed.";
+        return false;
+    }
+    for(size_t i = 0; i < states.size(); i++)
+    {
+        for(size_t j = 0; j < pSinks->size(); j++)
+            (*pSinks)[j]->Merge(*states[i][j]);
+    }
+    
+    return true;
+}
+static size_t CountTrailingZeros(unsigned long long w)
+{
+    // w is not 0
+#if defined(__GNUC__)
+    return static_cast<size_t>(__builtin_ctzll(w));
+#else
+    size_t n = 0;
+    for(; !(w & 1); w >>= 1)
+        n++;
+    return n;
+#endif
+}
+static void MapToBindings(const map<string, vector<double> >& symbols, map<string, MathExprNodeEvalTaskBuffer>& bindings)
+{
+    for(map<string, vector<double> >::const_iterator it = symbols.begin(); it != symbols.end(); it++)
+    {
+        MathExprNodeEvalTaskBuffer buffer;
+        buffer.n = it->second.size();
+        buffer.p = const_cast<double*>(it->second.data());
+        bindings[it->first] = buffer;
+    }
+}
+bool MathExpressionProgram::Evaluate(const vector<MathExpressionSink*>& sinks, MathExpressionContext& context) const
+{
+    vector<double> unused;
+    return EvaluateBindings(unused, context.m_bindings, context, NULL, NULL, NULL, &sinks);
+}
+bool MathExpressionProgram::Evaluate(const vector<MathExpressionSink*>& sinks, const map<string, vector<double> >& symbols, MathExpressionContext& context) const
+{
+    map<string, MathExprNodeEvalTaskBuffer> bindings;
+    MapToBindings(symbols, bindings);
+    vector<double> unused;
+    return EvaluateBindings(unused, bindings, context, NULL, NULL, NULL, &sinks);
+}
+bool MathExpressionProgram::EvaluateAt(double* results, const size_t* rows, size_t nRows, bool bScatter, MathExpressionContext& context) const
+{
+    return EvaluateBindingsAt(results, rows, nRows, bScatter, context.m_bindings, context);
+}
+bool MathExpressionProgram::EvaluateAt(vector<double>& results, const vector<size_t>& rows, const map<string, vector<double> >& symbols, MathExpressionContext& context) const
+{
+    map<string, MathExprNodeEvalTaskBuffer> bindings;
+    MapToBindings(symbols, bindings);
+    results.resize(rows.size());
+    if(EvaluateBindingsAt(results.data(), rows.data(), rows.size(), false, bindings, context))
+        return true;
+    results.resize(0);
+    return false;
+}
+bool MathExpressionProgram::EvaluateMasked(vector<double>& results, const vector<unsigned long long>& mask, const map<string, vector<double> >& symbols, MathExpressionContext& context) const
+{
+    // only the set bits are visited, a zero word costs one test
+    vector<size_t> rows;
+    for(size_t i = 0; i < mask.size(); i++)
+    {
+        for(unsigned long long w = mask[i]; w; w &= w - 1)
+            rows.push_back(i * 64 + CountTrailingZeros(w));
+    }
+    return EvaluateAt(results, rows, symbols, context);
+}
+bool MathExpressionProgram::Sample(vector<double>& x, vector<double>& y, const char* lpcszSymbol, double a, double b, double tolerance, const map<string, double>& parameters, MathExpressionContext& context, size_t nMaxPoints) const
+{
+    x.clear();
+    y.clear();
+    context.m_error.clear();
+    if(!lpcszSymbol || !std::isfinite(a) || !std::isfinite(b) || !(a < b) || !(tolerance >= 0))
+    {
+        context.m_error = "Invalid Domain.";
+        return false;
+    }
+    
+    map<string, MathExprNodeEvalTaskBuffer> bindings;
+    for(map<string, double>::const_iterator it = parameters.begin(); it != parameters.end(); it++)
+    {
+        MathExprNodeEvalTaskBuffer buffer;
+        buffer.p = const_cast<double*>(&it->second);
+        buffer.n = 1;
+        bindings[it->first] = buffer;
+    }
+    
+    typedef struct {
+        double x0, y0, x1, y1;
+    } MathExprSampleInterval;
+    
+    // a coarse uniform grid first, then one round per level of refinement, evaluating the
+    // midpoints of every pending interval in one call that is split into segments as usual
+    size_t nInitial = 32;
+    double fMinWidth = ldexp((b - a) / static_cast<double>(nInitial), -32);
+    vector<double> xs(nInitial + 1), ys;
+    for(size_t i = 0; i <= nInitial; i++)
+        xs[i] = i == nInitial ? b : a + (b - a) * static_cast<double>(i) / static_cast<double>(nInitial);
+    vector<pair<double, double> > points;
+    vector<MathExprSampleInterval> pending, next;
+    for(size_t nRound = 0; xs.size(); nRound++)
+    {
+        MathExprNodeEvalTaskBuffer buffer = {xs.data(), xs.size()};
+        bindings[lpcszSymbol] = buffer;
+        if(!EvaluateBindings(ys, bindings, context))
+            return false;
+        if(ys.size() == 1)
+            ys.assign(xs.size(), ys[0]);
+        for(size_t i = 0; i < xs.size(); i++)
+            points.push_back(make_pair(xs[i], ys[i]));
+        
+        next.clear();
+        if(!nRound)
+        {
+            for(size_t i = 0; i < nInitial; i++)
+            {
+                MathExprSampleInterval interval = {xs[i], ys[i], xs[i + 1], ys[i + 1]};
+                next.push_back(interval);
+            }
+        }
+        for(size_t i = 0; nRound && i < pending.size(); i++)
+        {
+            const MathExprSampleInterval& interval = pending[i];
+            double xm = xs[i], ym = ys[i];
+            bool bFinite0 = std::isfinite(interval.y0), bFiniteM = std::isfinite(ym), bFinite1 = std::isfinite(interval.y1);
+            bool bRefine = bFinite0 != bFiniteM || bFiniteM != bFinite1 || fabs(ym - 0.5 * (interval.y0 + interval.y1)) > tolerance;
+            if(!bRefine || points.size() + next.size() + 2 > nMaxPoints)
+                continue;
+            MathExprSampleInterval left = {interval.x0, interval.y0, xm, ym};
+            MathExprSampleInterval right = {xm, ym, interval.x1, interval.y1};
+            next.push_back(left);
+            next.push_back(right);
+        }
+        
+        // intervals 32 levels below the initial grid are final, a jump or the edge of the
+        // domain is then located to about 1e-11 of the width of the domain
+        pending.clear();
+        xs.clear();
+        for(size_t i = 0; i < next.size(); i++)
+        {
+            double xm = next[i].x0 + 0.5 * (next[i].x1 - next[i].x0);
+            if(next[i].x1 - next[i].x0 > fMinWidth && xm > next[i].x0 && xm < next[i].x1 && points.size() + xs.size() < nMaxPoints)
+            {
+                pending.push_back(next[i]);
+                xs.push_back(xm);
+            }
+        }
+    }
+    
+    std::sort(points.begin(), points.end());
+    x.resize(points.size());
+    y.resize(points.size());
+    for(size_t i = 0; i < points.size(); i++)
+    {
+        x[i] = points[i].first;
+        y[i] = points[i].second;
+    }
+    return true;
+}
+void MathExpressionProgram::Outputs(vector<string>& outputs) const
+{
+    outputs.clear();
+    for(size_t i = 0; i < m_locals.size(); i++)
+        outputs.push_back(*m_locals[i]);
+}
+bool MathExpressionProgram::EvaluateOutputs(map<string, vector<double> >& outputs, const map<string, vector<double> >& symbols, MathExpressionContext& context) const
+{
+    outputs.clear();
+    map<string, MathExprNodeEvalTaskBuffer> bindings;
+    MapToBindings(symbols, bindings);
+    
+    // the variables are copied out of the scratch space after each segment
+    vector<double> results;
+    vector<vector<double> > values;
+    if(!EvaluateBindings(results, bindings, context, &values))
+        return false;
+    for(size_t i = 0; i < m_locals.size(); i++)
+        outputs[*m_locals[i]].swap(values[i]);
+    return true;
+}
+// Owns the buffers of an exported result, freed by the consumer through release.
+typedef struct MathExprArrowExport
+{
+    vector<double> values;
+    vector<unsigned char> validity;     // empty when no row is null
+    const void* buffers[2];
+} MathExprArrowExport;
+
+static void ReleaseArrowArray(struct ArrowArray* pArray)
+{
+    delete static_cast<MathExprArrowExport*>(pArray->private_data);
+    pArray->release = NULL;
+}
+static void ReleaseArrowSchema(struct ArrowSchema* pSchema)
+{
+    pSchema->release = NULL;
+}
+static size_t CountBits(unsigned char bits)
+{
+    size_t nCount = 0;
+    for(; bits; bits &= bits - 1)
+        nCount++;
+    return nCount;
+}
+bool MathExpressionProgram::EvaluateArrow(struct ArrowArray* pArray, struct ArrowSchema* pSchema, MathExpressionContext& context) const
+{
+    if(!pArray || !pSchema)
+    {
+        context.m_error = "Invalid Arrow Array.";
+        return false;
+    }
+    
+    // nulls of the columns this program reads, a single value is broadcast with its bit
+    vector<MathExprValidity> validity;
+    vector<size_t> lengths;
+    for(size_t i = 0; i < m_slots.size(); i++)
+    {
+        map<string, MathExprValidity>::const_iterator it = context.m_validity.find(*m_slots[i]);
+        if(it == context.m_validity.end())
+            continue;
+        validity.push_back(it->second);
+        lengths.push_back(context.m_bindings[*m_slots[i]].n);
+    }
+    MathExprCodeView view = Code();
+    size_t nReduction;
+    if(!validity.empty() && FindReduction(view.ops, view.nops, nReduction))
+    {
+        context.m_error = "Reductions Not Supported.";
+        return false;
+    }
+    
+    // the results are written once, into the buffer handed over to the consumer
+    unique_ptr<MathExprArrowExport> result(new MathExprArrowExport);
+    if(!EvaluateBindings(result->values, context.m_bindings, context))
+        return false;
+    size_t n = result->values.size();
+    size_t nBytes = (n + 7) / 8;
+    size_t nNulls = 0;
+    if(!validity.empty())
+    {
+        vector<unsigned char>& bits = result->validity;
+        bits.assign(nBytes, 0xFF);
+        for(size_t j = 0; j < validity.size(); j++)
+        {
+            const MathExprValidity& v = validity[j];
+            if(lengths[j] == 1 && !(v.bits[v.offset / 8] >> (v.offset % 8) & 1))
+                std::fill(bits.begin(), bits.end(), 0);
+            else if(lengths[j] == 1)
+                continue;
+            else if(v.offset % 8 == 0)
+            {
+                for(size_t k = 0; k < nBytes; k++)
+                    bits[k] &= v.bits[v.offset / 8 + k];
+            }
+            else
+            {
+                for(size_t i = 0; i < n; i++)
+                {
+                    size_t nBit = v.offset + i;
+                    if(!(v.bits[nBit / 8] >> (nBit % 8) & 1))
+                        bits[i / 8] &= static_cast<unsigned char>(~(1 << (i % 8)));
+                }
+            }
+        }
+        
+        // bits past the last row are cleared, as the format recommends
+        if(n % 8)
+            bits[nBytes - 1] &= static_cast<unsigned char>((1 << (n % 8)) - 1);
+        for(size_t k = 0; k < nBytes; k++)
+            nNulls += 8 - CountBits(bits[k]);
+        nNulls -= nBytes * 8 - n;
+    }
+    
+    MathExprArrowExport* pExport = result.release();
+    pExport->buffers[0] = nNulls ? pExport->validity.data() : NULL;
+    pExport->buffers[1] = pExport->values.data();
+    memset(pArray, 0, sizeof(*pArray));
+    pArray->length = static_cast<int64_t>(n);
+    pArray->null_count = static_cast<int64_t>(nNulls);
+    pArray->n_buffers = 2;
+    pArray->buffers = pExport->buffers;
+    pArray->release = ReleaseArrowArray;
+    pArray->private_data = pExport;
+    
+    memset(pSchema, 0, sizeof(*pSchema));
+    pSchema->format = "g";
+    pSchema->name = "";
+    pSchema->flags = ARROW_FLAG_NULLABLE;
+    pSchema->release = ReleaseArrowSchema;
+    return true;
+}
+// Process-wide queue of asynchronous jobs. Workers are started on demand, at most
+// nConcurrency jobs run at a time and the others wait in order of submission.
+typedef struct MathExprScheduler
+{
+    std::mutex lock;
+    std::condition_variable ready;
+    deque<shared_ptr<MathExpressionJob> > queue;
+    vector<std::thread> workers;
+    size_t nConcurrency;
+    size_t nRunning;
+    bool bStop;
+    
+    MathExprScheduler() : nConcurrency(2), nRunning(0), bStop(false)
+    {
+    }
+    ~MathExprScheduler()
+    {
+        // running jobs complete, queued ones are dropped
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            bStop = true;
+        }
+        ready.notify_all();
+        for(size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+} MathExprScheduler;
+
+static MathExprScheduler& GetScheduler()
+{
+    // built after the built-in table, so it is destroyed, and its workers joined, first
+    GetBuiltins();
+    static MathExprScheduler scheduler;
+    return scheduler;
+}
+
+MathExpressionJob::MathExpressionJob() : m_future(m_promise.get_future().share()), m_done(false)
+{
+    m_progress.done = 0;
+    m_progress.total = 0;
+    m_progress.cancelled = false;
+}
+bool MathExpressionJob::Wait() const
+{
+    return m_future.get();
+}
+bool MathExpressionJob::Done() const
+{
+    return m_done;
+}
+void MathExpressionJob::Cancel()
+{
+    m_progress.cancelled = true;
+}
+double MathExpressionJob::Progress() const
+{
+    size_t nTotal = m_progress.total;
+    if(!nTotal)
+        return m_done ? 1.0 : 0.0;
+    return static_cast<double>(m_progress.done) / static_cast<double>(nTotal);
+}
+shared_future<bool> MathExpressionJob::Future() const
+{
+    return m_future;
+}
+const vector<double>& MathExpressionJob::Results() const
+{
+    return m_results;
+}
+const string& MathExpressionJob::Error() const
+{
+    return m_context.Error();
+}
+MathExpressionHistogramSink::MathExpressionHistogramSink(double lo, double hi, size_t nBins) : m_lo(lo), m_hi(hi), m_counts(nBins ? nBins : 1, 0), m_nBelow(0), m_nAbove(0), m_nNaN(0)
+{
+}
+shared_ptr<MathExpressionSink> MathExpressionHistogramSink::Clone() const
+{
+    return shared_ptr<MathExpressionSink>(new MathExpressionHistogramSink(m_lo, m_hi, m_counts.size()));
+}
+void MathExpressionHistogramSink::Consume(const double* values, size_t, size_t n)
+{
+    double scale = m_hi > m_lo ? static_cast<double>(m_counts.size()) / (m_hi - m_lo) : 0;
+    size_t nLast = m_counts.size() - 1;
+    for(size_t i = 0; i < n; i++)
+    {
+        double v = values[i];
+        if(v != v)
+            m_nNaN++;
+        else if(v < m_lo)
+            m_nBelow++;
+        else if(v > m_hi)
+            m_nAbove++;
+        else
+        {
+            size_t nBin = static_cast<size_t>((v - m_lo) * scale);
+            m_counts[nBin < nLast ? nBin : nLast]++;
+        }
+    }
+}
+void MathExpressionHistogramSink::Merge(const MathExpressionSink& other)
+{
+    const MathExpressionHistogramSink& histogram = static_cast<const MathExpressionHistogramSink&>(other);
+    for(size_t i = 0; i < m_counts.size(); i++)
+        m_counts[i] += histogram.m_counts[i];
+    m_nBelow += histogram.m_nBelow;
+    m_nAbove += histogram.m_nAbove;
+    m_nNaN += histogram.m_nNaN;
+}
+const vector<size_t>& MathExpressionHistogramSink::Counts() const
+{
+    return m_counts;
+}
+size_t MathExpressionHistogramSink::Below() const
+{
+    return m_nBelow;
+}
+size_t MathExpressionHistogramSink::Above() const
+{
+    return m_nAbove;
+}
+size_t MathExpressionHistogramSink::NaN() const
+{
+    return m_nNaN;
+}
+double MathExpressionHistogramSink::Quantile(double q) const
+{
+    // of the values in range, assuming they are spread evenly within each bin
+    size_t nTotal = 0;
+    for(size_t i = 0; i < m_counts.size(); i++)
+        nTotal += m_counts[i];
+    if(!nTotal || !(q >= 0 && q <= 1))
+        return numeric_limits<double>::quiet_NaN();
+    double rank = q * static_cast<double>(nTotal);
+    double width = (m_hi - m_lo) / static_cast<double>(m_counts.size());
+    double cumulative = 0;
+    for(size_t i = 0; i < m_counts.size(); i++)
+    {
+        double count = static_cast<double>(m_counts[i]);
+        if(count > 0 && cumulative + count >= rank)
+            return m_lo + width * (static_cast<double>(i) + (rank - cumulative) / count);
+        cumulative += count;
+    }
+    return m_hi;
+}
+MathExpressionStatisticsSink::MathExpressionStatisticsSink() : m_n(0), m_mean(0), m_m2(0), m_min(numeric_limits<double>::quiet_NaN()), m_max(numeric_limits<double>::quiet_NaN())
+{
+}
+shared_ptr<MathExpressionSink> MathExpressionStatisticsSink::Clone() const
+{
+    return shared_ptr<MathExpressionSink>(new MathExpressionStatisticsSink());
+}
+void MathExpressionStatisticsSink::Consume(const double* values, size_t, size_t n)
+{
+    // the segment is in cache, so a second pass is cheap and keeps the deviations accurate
+    size_t nCount = 0;
+    double sum = 0, fMin = numeric_limits<double>::infinity(), fMax = -numeric_limits<double>::infinity();
+    for(size_t i = 0; i < n; i++)
+    {
+        double v = values[i];
+        if(v == v)
+        {
+            nCount++;
+            sum += v;
+            fMin = v < fMin ? v : fMin;
+            fMax = v > fMax ? v : fMax;
+        }
+    }
+    if(!nCount)
+        return;
+    double mean = sum / static_cast<double>(nCount), m2 = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+        double d = values[i] - mean;
+        if(d == d)
+            m2 += d * d;
+    }
+    Combine(nCount, mean, m2, fMin, fMax);
+}
+void MathExpressionStatisticsSink::Merge(const MathExpressionSink& other)
+{
+    const MathExpressionStatisticsSink& statistics = static_cast<const MathExpressionStatisticsSink&>(other);
+    Combine(statistics.m_n, statistics.m_mean, statistics.m_m2, statistics.m_min, statistics.m_max);
+}
+void MathExpressionStatisticsSink::Combine(size_t n, double mean, double m2, double fMin, double fMax)
+{
+    if(!n)
+        return;
+    if(!m_n)
+    {
+        m_n = n;
+        m_mean = mean;
+        m_m2 = m2;
+        m_min = fMin;
+        m_max = fMax;
+        return;
+    }
+    double na = static_cast<double>(m_n), nb = static_cast<double>(n), delta = mean - m_mean;
+    m_mean += delta * nb / (na + nb);
+    m_m2 += m2 + delta * delta * na * nb / (na + nb);
+    m_n += n;
+    m_min = fMin < m_min ? fMin : m_min;
+    m_max = fMax > m_max ? fMax : m_max;
+}
+size_t MathExpressionStatisticsSink::Count() const
+{
+    return m_n;
+}
+double MathExpressionStatisticsSink::Mean() const
+{
+    return m_n ? m_mean : numeric_limits<double>::quiet_NaN();
+}
+double MathExpressionStatisticsSink::Variance() const
+{
+    return m_n > 1 ? m_m2 / static_cast<double>(m_n - 1) : numeric_limits<double>::quiet_NaN();
+}
+double MathExpressionStatisticsSink::Min() const
+{
+    return m_min;
+}
+double MathExpressionStatisticsSink::Max() const
+{
+    return m_max;
+}
+MathExpressionTopKSink::MathExpressionTopKSink(size_t k) : m_k(k)
+{
+}
+shared_ptr<MathExpressionSink> MathExpressionTopKSink::Clone() const
+{
+    return shared_ptr<MathExpressionSink>(new MathExpressionTopKSink(m_k));
+}
+static bool IsGreaterValueOrEarlierRow(const pair<double, size_t>& a, const pair<double, size_t>& b)
+{
+    return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+void MathExpressionTopKSink::Push(double value, size_t nRow)
+{
+    // The heap is ordered by (value ascending, row descending): its top is the entry to
+    // evict, the smallest value and among equal values the latest row. The entries kept
+    // are thus the same for any segmentation and any order of the merges.
+    pair<double, size_t> entry(value, nRow);
+    if(m_heap.size() < m_k)
+    {
+        m_heap.push_back(entry);
+        push_heap(m_heap.begin(), m_heap.end(), IsGreaterValueOrEarlierRow);
+    }
+    else if(m_k && IsGreaterValueOrEarlierRow(entry, m_heap.front()))
+    {
+        pop_heap(m_heap.begin(), m_heap.end(), IsGreaterValueOrEarlierRow);
+        m_heap.back() = entry;
+        push_heap(m_heap.begin(), m_heap.end(), IsGreaterValueOrEarlierRow);
+    }
+}
+void MathExpressionTopKSink::Consume(const double* values, size_t nOffset, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        // most values are below the smallest one kept and cost a single comparison
+        if(values[i] == values[i] && (m_heap.size() < m_k || values[i] >= m_heap.front().first))
+            Push(values[i], nOffset + i);
+    }
+}
+void MathExpressionTopKSink::Merge(const MathExpressionSink& other)
+{
+    const vector<pair<double, size_t> >& heap = static_cast<const MathExpressionTopKSink&>(other).m_heap;
+    for(size_t i = 0; i < heap.size(); i++)
+        Push(heap[i].first, heap[i].second);
+}
+vector<pair<double, size_t> > MathExpressionTopKSink::Top() const
+{
+    vector<pair<double, size_t> > top(m_heap);
+    sort(top.begin(), top.end(), IsGreaterValueOrEarlierRow);
+    return top;
+}
+MathExpressionThresholdSink::MathExpressionThresholdSink(double threshold) : m_threshold(threshold)
+{
+}
+shared_ptr<MathExpressionSink> MathExpressionThresholdSink::Clone() const
+{
+    return shared_ptr<MathExpressionSink>(new MathExpressionThresholdSink(m_threshold));
+}
+void MathExpressionThresholdSink::Consume(const double* values, size_t nOffset, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        if(values[i] > m_threshold)
+            m_rows.push_back(nOffset + i);
+    }
+}
+void MathExpressionThresholdSink::Merge(const MathExpressionSink& other)
+{
+    // each thread takes its segments in increasing order, so every clone is already sorted
+    const vector<size_t>& rows = static_cast<const MathExpressionThresholdSink&>(other).m_rows;
+    size_t nMiddle = m_rows.size();
+    m_rows.insert(m_rows.end(), rows.begin(), rows.end());
+    inplace_merge(m_rows.begin(), m_rows.begin() + nMiddle, m_rows.end());
+}
+const vector<size_t>& MathExpressionThresholdSink::Rows() const
+{
+    return m_rows;
+}
+shared_ptr<MathExpressionJob> MathExpressionProgram::EvaluateAsync(const shared_ptr<const MathExpressionProgram>& program, const MathExpressionContext& context, MathExprCompletion completion)
+{
+    shared_ptr<MathExpressionJob> job(new MathExpressionJob());
+    job->m_program = program;
+    job->m_bindings = context.m_bindings;
+    job->m_context.m_memory.budget = context.m_memory.budget;
+    job->m_context.m_seed = context.m_seed;
+    job->m_completion = completion;
+    Schedule(job);
+    return job;
+}
+shared_ptr<MathExpressionJob> MathExpressionProgram::EvaluateAsync(const shared_ptr<const MathExpressionProgram>& program, map<string, vector<double> > symbols, MathExprCompletion completion)
+{
+    shared_ptr<MathExpressionJob> job(new MathExpressionJob());
+    job->m_program = program;
+    job->m_symbols.swap(symbols);
+    MapToBindings(job->m_symbols, job->m_bindings);
+    job->m_completion = completion;
+    Schedule(job);
+    return job;
+}
+void MathExpressionProgram::SetAsyncConcurrency(size_t nConcurrency)
+{
+    MathExprScheduler& scheduler = GetScheduler();
+    {
+        std::lock_guard<std::mutex> guard(scheduler.lock);
+        scheduler.nConcurrency = nConcurrency ? nConcurrency : 1;
+    }
+    scheduler.ready.notify_all();
+}
+void MathExpressionProgram::Schedule(const shared_ptr<MathExpressionJob>& job)
+{
+    MathExprScheduler& scheduler = GetScheduler();
+    std::lock_guard<std::mutex> guard(scheduler.lock);
+    scheduler.queue.push_back(job);
+    if(scheduler.workers.size() < scheduler.nConcurrency)
+    {
+        scheduler.workers.push_back(std::thread([&scheduler]()
+        {
+            std::unique_lock<std::mutex> lock(scheduler.lock);
+            for(;;)
+            {
+                scheduler.ready.wait(lock, [&scheduler](){ return scheduler.bStop || (scheduler.queue.size() && scheduler.nRunning < scheduler.nConcurrency); });
+                if(scheduler.bStop)
+                    return;
+                shared_ptr<MathExpressionJob> next = scheduler.queue.front();
+                scheduler.queue.pop_front();
+                scheduler.nRunning++;
+                lock.unlock();
+                Run(*next);
+                next.reset();
+                lock.lock();
+                scheduler.nRunning--;
+                scheduler.ready.notify_one();
+            }
+        }));
+    }
+    scheduler.ready.notify_one();
+}
+void MathExpressionProgram::Run(MathExpressionJob& job)
+{
+    // each job evaluates on its own context, its segments are split across threads as usual
+    bool bOK = false;
+    if(!job.m_program)
+        job.m_context.m_error = "Invalid Program.";
+    else if(job.m_progress.cancelled)
+        job.m_context.m_error = "Evaluation Cancelled.";
+    else
+        bOK = job.m_program->EvaluateBindings(job.m_results, job.m_bindings, job.m_context, NULL, &job.m_progress);
+    job.m_done = true;
+    job.m_promise.set_value(bOK);
+    if(job.m_completion)
+        job.m_completion(job);
+}
+bool MathExpressionProgram::EvaluateBindingsAt(double* results, const size_t* rows, size_t nRows, bool bScatter, const map<string, MathExprNodeEvalTaskBuffer>& bindings, MathExpressionContext& context) const
+{
+    context.m_error.clear();
+    
+    size_t nMaxLength = 1;
+    for(map<string, MathExprNodeEvalTaskBuffer>::const_iterator it = bindings.begin(); it != bindings.end(); it++)
+    {
+        if(it->second.n == 0)
+        {
+            context.m_error = "Empty Symbol.";
+            return false;
+        }
+        if(nMaxLength < it->second.n)
+            nMaxLength = it->second.n;
+    }
+    
+    // columns are read at the selected rows only, single values are shared
+    MathExprNodeEvalTaskBuffer empty = {NULL, 0};
+    vector<MathExprNodeEvalTaskBuffer> scalars(m_slots.size() + 1, empty);
+    vector<size_t> slots;
+    vector<const double*> columns;
+    for(map<string, MathExprNodeEvalTaskBuffer>::const_iterator it = bindings.begin(); it != bindings.end(); it++)
+    {
+        if(it->second.n != 1 && it->second.n != nMaxLength)
+        {
+            context.m_error = "Symbol Size Mismatch.";
+            return false;
+        }
+        size_t nSlot;
+        if(!FindSymbol(it->first, nSlot))
+            continue;
+        if(it->second.n == 1)
+            scalars[nSlot] = it->second;
+        else
+        {
+            slots.push_back(nSlot);
+            columns.push_back(it->second.p);
+        }
+    }
+    for(size_t k = 0; k < nRows; k++)
+    {
+        if(rows[k] >= nMaxLength)
+        {
+            context.m_error = "Row Out Of Range.";
+            return false;
+        }
+    }
+    
+    // a reduction needs every row, which is what selecting rows avoids
+    MathExprCodeView view = Code();
+    size_t nReduction;
+    if(FindReduction(view.ops, view.nops, nReduction))
+    {
+        context.m_error = "Reductions Not Supported.";
+        return false;
+    }
+    if(!nRows)
+        return true;
+    
+    size_t nSegmentSize = GetSegmentSize();
+    size_t nThreads = 1;
+    if(!PlanMemory(context, nRows, columns.size() + 1, nSegmentSize, nThreads))
+        return false;
+    size_t nTasks = nRows / nSegmentSize + (nRows % nSegmentSize ? 1 : 0);
+    if(context.m_scratch.size() < GetThreadCount())
+        context.m_scratch.resize(GetThreadCount());
+    
+    signed long long N = static_cast<signed long long>(nTasks);
+    size_t nEvalError = 0;
+#pragma omp parallel for num_threads(nThreads) if(nThreads > 1) reduction(+: nEvalError)
+    for(signed long long i = 0; i < N; i++)
+    {
+        MathExprScratch& scratch = context.m_scratch[GetThreadIndex()];
+        size_t nOffset = static_cast<size_t>(i) * nSegmentSize;
+        size_t n = nRows - nOffset < nSegmentSize ? nRows - nOffset : nSegmentSize;
+        const size_t* selected = rows + nOffset;
+        
+        // an indexed load per row, which compilers turn into SIMD gathers where available
+        if(scratch.gathered.size() < columns.size() + 1)
+            scratch.gathered.resize(columns.size() + 1);
+        vector<MathExprNodeEvalTaskBuffer> bindings(scalars);
+        for(size_t j = 0; j < columns.size(); j++)
+        {
+            vector<double>& values = scratch.gathered[j];
+            values.resize(n);
+            const double* column = columns[j];
+            for(size_t k = 0; k < n; k++)
+                values[k] = column[selected[k]];
+            bindings[slots[j]].p = values.data();
+            bindings[slots[j]].n = n;
+        }
+        
+        vector<double>& scattered = scratch.gathered[columns.size()];
+        if(bScatter)
+            scattered.resize(n);
+        SetPosition(scratch, context.m_seed, 0, selected, n);
+        if(!EvaluateEx(bScatter ? scattered.data() : results + nOffset, n, bindings.data(), view.ops, view.nops, view.constants, scratch))
+        {
+            nEvalError++;
+            continue;
+        }
+        if(bScatter)
+        {
+            for(size_t k = 0; k < n; k++)
+                results[selected[k]] = scattered[k];
+        }
+    }
+    if(nEvalError)
+    {
+        context.m_error = "Evaluation Failed.";
+        return false;
+    }
+    
+    return true;
+}
+bool MathExpressionProgram::Evaluate(vector<double>& results, vector<size_t>& shape, const map<string, MathExprShapedBuffer>& symbols, MathExpressionContext& context) const
+{
+    results.resize(0);
+    shape.resize(0);
+    context.m_error.clear();
+    
+    // broadcast shape: dimensions are right-aligned, each must be 1 or equal
+    size_t nDims = 0;
+    for(map<string, MathExprShapedBuffer>::const_iterator it = symbols.begin(); it != symbols.end(); it++)
+    {
+        if(!it->second.p)
+        {
+            context.m_error = "Empty Symbol.";
+            return false;
+        }
+        if(nDims < it->second.shape.size())
+            nDims = it->second.shape.size();
+    }
+    shape.assign(nDims, 1);
+    for(map<string, MathExprShapedBuffer>::const_iterator it = symbols.begin(); it != symbols.end(); it++)
+    {
+        const vector<size_t>& s = it->second.shape;
+        for(size_t d = 0; d < s.size(); d++)
+        {
+            size_t& D = shape[nDims - s.size() + d];
+            if(s[d] == D || s[d] == 1)
+                continue;
+            if(D != 1)
+            {
+                context.m_error = "Shapes Not Broadcastable.";
+                shape.resize(0);
+                return false;
+            }
+            D = s[d];
+        }
+    }
+    
+    // a reduction over a broadcast shape has no defined axis
+    MathExprCodeView view = Code();
+    size_t nReduction;
+    if(FindReduction(view.ops, view.nops, nReduction))
+    {
+        context.m_error = "Reductions Not Supported.";
+        shape.resize(0);
+        return false;
+    }
+    
+    size_t nTotal = 1;
+    for(size_t d = 0; d < nDims; d++)
+        nTotal *= shape[d];
+    if(!nTotal)
+        return true;
+    
+    // element strides of every operand in the broadcast shape, 0 along broadcast dimensions
+    vector<size_t> slots;
+    vector<const double*> bases;
+    vector<vector<size_t> > strides;
+    for(map<string, MathExprShapedBuffer>::const_iterator it = symbols.begin(); it != symbols.end(); it++)
+    {
+        const vector<size_t>& s = it->second.shape;
+        vector<size_t> stride(nDims, 0);
+        size_t nStride = 1;
+        for(size_t d = s.size(); d >= 1; d--)
+        {
+            if(s[d - 1] != 1)
+                stride[nDims - s.size() + d - 1] = nStride;
+            nStride *= s[d - 1];
+        }
+        size_t nSlot = m_slots.size();
+        FindSymbol(it->first, nSlot);
+        slots.push_back(nSlot);     // bindings the program does not use get a spare slot
+        bases.push_back(it->second.p);
+        strides.push_back(stride);
+    }
+    
+    // dimensions of extent 1 are dropped, every operand has stride 0 along them, then
+    // adjacent dimensions are coalesced wherever every operand is contiguous across them
+    vector<size_t> dims;
+    for(size_t d = 0; d < nDims; d++)
+    {
+        if(shape[d] != 1)
+            dims.push_back(shape[d]);
+    }
+    for(size_t j = 0; j < strides.size(); j++)
+    {
+        vector<size_t> stride;
+        for(size_t d = 0; d < nDims; d++)
+        {
+            if(shape[d] != 1)
+                stride.push_back(strides[j][d]);
+        }
+        strides[j].swap(stride);
+    }
+    for(size_t d = dims.size(); d >= 2; d--)
+    {
+        bool bMergeable = true;
+        for(size_t j = 0; j < strides.size() && bMergeable; j++)
+            bMergeable = strides[j][d - 2] == strides[j][d - 1] * dims[d - 1];
+        if(!bMergeable)
+            continue;
+        dims[d - 2] *= dims[d - 1];
+        dims.erase(dims.begin() + (d - 1));
+        // the merged dimension steps like the inner one
+        for(size_t j = 0; j < strides.size(); j++)
+            strides[j].erase(strides[j].begin() + (d - 2));
+    }
+    if(dims.empty())
+    {
+        dims.push_back(1);
+        for(size_t j = 0; j < strides.size(); j++)
+            strides[j].push_back(0);
+    }
+    
+    // a tile is a run along the innermost dimension, where every operand is either
+    // contiguous or a single value, which is exactly what EvaluateEx() consumes.
+    size_t nSegmentSize = GetSegmentSize();
+    size_t nThreads = 1;
+    if(!PlanMemory(context, nTotal, 0, nSegmentSize, nThreads))
+        return false;
+    size_t nInner = dims.back();
+    size_t nTileSize = nInner < nSegmentSize ? nInner : nSegmentSize;
+    size_t nTilesPerRow = nInner / nTileSize + (nInner % nTileSize ? 1 : 0);
+    size_t nRows = nTotal / nInner;
+    size_t nTilesPerTask = nSegmentSize / nTileSize;
+    size_t nTiles = nRows * nTilesPerRow;
+    size_t nTasks = nTiles / nTilesPerTask + (nTiles % nTilesPerTask ? 1 : 0);
+    
+    results.resize(nTotal);
+    if(context.m_scratch.size() < GetThreadCount())
+        context.m_scratch.resize(GetThreadCount());
+    
+    signed long long N = static_cast<signed long long>(nTasks);
+    size_t nEvalError = 0;
+#pragma omp parallel for num_threads(nThreads) if(nThreads > 1) reduction(+: nEvalError)
+    for(signed long long i = 0; i < N; i++)
+    {
+        MathExprNodeEvalTaskBuffer empty = {NULL, 0};
+        MathExprScratch& scratch = context.m_scratch[GetThreadIndex()];
+        vector<MathExprNodeEvalTaskBuffer>& bindings = scratch.slots;
+        bindings.assign(m_slots.size() + 1, empty);
+        size_t nEnd = (static_cast<size_t>(i) + 1) * nTilesPerTask < nTiles ? (static_cast<size_t>(i) + 1) * nTilesPerTask : nTiles;
+        for(size_t t = static_cast<size_t>(i) * nTilesPerTask; t < nEnd; t++)
+        {
+            size_t nRow = t / nTilesPerRow;
+            size_t nStart = (t % nTilesPerRow) * nTileSize;
+            size_t n = nInner - nStart < nTileSize ? nInner - nStart : nTileSize;
+            
+            for(size_t j = 0; j < slots.size(); j++)
+            {
+                size_t nOffset = 0, r = nRow;
+                for(size_t d = dims.size() - 1; d >= 1; d--)
+                {
+                    nOffset += (r % dims[d - 1]) * strides[j][d - 1];
+                    r /= dims[d - 1];
+                }
+                size_t nInnerStride = strides[j].back();
+                bindings[slots[j]].p = const_cast<double*>(bases[j]) + nOffset + nStart * nInnerStride;
+                bindings[slots[j]].n = nInnerStride ? n : 1;
+            }
+            
+            SetPosition(scratch, context.m_seed, nRow * nInner + nStart, NULL, n);
+            if(!EvaluateEx(results.data() + nRow * nInner + nStart, n, bindings.data(), view.ops, view.nops, view.constants, scratch))
+            {
+                nEvalError++;
+                break;
+            }
+        }
+    }
+    if(nEvalError)
+    {
+        results.resize(0);
+        shape.resize(0);
+        context.m_error = "Evaluation Failed.";
+        return false;
+    }
+    
+    return true;
+}
+bool MathExpressionProgram::EvaluateSweep(vector<double>& results, const map<string, vector<double> >& symbols, const vector<string>& parameters, const vector<double>& values, MathExpressionContext& context) const
+{
+    results.resize(0);
+    context.m_error.clear();
+    
+    size_t P = parameters.size();
+    if(!P || values.size() % P)
+    {
+        context.m_error = "Parameter Matrix Size Mismatch.";
+        return false;
+    }
+    size_t K = values.size() / P;
+    
+    // data columns are either full length or length-1
+    size_t N = 1;
+    for(map<string, vector<double> >::const_iterator it = symbols.begin(); it != symbols.end(); it++)
+    {
+        if(it->second.size() == 0)
+        {
+            context.m_error = "Empty Symbol.";
+            return false;
+        }
+        if(it->second.size() > 1)
+        {
+            if(N > 1 && N != it->second.size())
+            {
+                context.m_error = "Symbol Size Mismatch.";
+                return false;
+            }
+            N = it->second.size();
+        }
+    }
+    for(size_t j = 0; j < P; j++)
+    {
+        if(symbols.find(parameters[j]) != symbols.end())
+        {
+            context.m_error = "Symbol Bound Twice.";
+            return false;
+        }
+    }
+    if(!K)
+        return true;
+    
+    // A reduction is over the rows of one parameter set, e.g. a chi-square per set, so each
+    // set is then a call of its own, whose segment loop fuses the reductions as usual.
+    MathExprCodeView view = Code();
+    size_t nReduction;
+    if(FindReduction(view.ops, view.nops, nReduction))
+    {
+        map<string, MathExprNodeEvalTaskBuffer> bindings;
+        MapToBindings(symbols, bindings);
+        results.resize(K * N);
+        vector<double> row;
+        for(size_t k = 0; k < K; k++)
+        {
+            for(size_t j = 0; j < P; j++)
+            {
+                MathExprNodeEvalTaskBuffer buffer = {const_cast<double*>(values.data() + k * P + j), 1};
+                bindings[parameters[j]] = buffer;
+            }
+            if(!EvaluateBindings(row, bindings, context) || (row.size() != N && row.size() != 1))
+            {
+                if(context.m_error.empty())
+                    context.m_error = "Evaluation Failed.";
+                results.resize(0);
+                return false;
+            }
+            std::fill(results.begin() + k * N, results.begin() + (k + 1) * N, row[0]);
+            if(row.size() == N)
+                std::copy(row.begin(), row.end(), results.begin() + k * N);
+        }
+        return true;
+    }
+    
+    // Tiles are (data segment, parameter block) pairs in segment-major order so that
+    // threads working at the same time share one data segment, which stays hot in
+    // cache while every parameter set of the block is evaluated against it.
+    size_t nSegmentSize = GetSweepSegmentSize(symbols.size());
+    size_t nThreads = 1;
+    if(!PlanMemory(context, K * N, 0, nSegmentSize, nThreads))
+        return false;
+    size_t nSegments = N / nSegmentSize + (N % nSegmentSize ? 1 : 0);
+    size_t nBlockSize = 64;
+    size_t nBlocks = K / nBlockSize + (K % nBlockSize ? 1 : 0);
+    
+    results.resize(K * N);
+    if(context.m_scratch.size() < GetThreadCount())
+        context.m_scratch.resize(GetThreadCount());
+    
+    signed long long T = static_cast<signed long long>(nSegments * nBlocks);
+    size_t nEvalError = 0;
+#pragma omp parallel for num_threads(nThreads) if(nThreads > 1) schedule(static, 1) reduction(+: nEvalError)
+    for(signed long long t = 0; t < T; t++)
+    {
+        size_t nSegment = static_cast<size_t>(t) / nBlocks;
+        size_t nBlock = static_cast<size_t>(t) % nBlocks;
+        size_t nOffset = nSegment * nSegmentSize;
+        size_t n = (N - nOffset < nSegmentSize ? N - nOffset : nSegmentSize);
+        
+        MathExprNodeEvalTaskBuffer empty = {NULL, 0};
+        vector<MathExprNodeEvalTaskBuffer> bindings(m_slots.size() + 1, empty);
+        for(map<string, vector<double> >::const_iterator it = symbols.begin(); it != symbols.end(); it++)
+        {
+            size_t nSlot;
+            if(!FindSymbol(it->first, nSlot))
+                continue;
+            bindings[nSlot].n = (it->second.size() == 1 ? 1 : n);
+            bindings[nSlot].p = const_cast<double*>(it->second.data() + (it->second.size() == 1 ? 0 : nOffset));
+        }
+        vector<MathExprNodeEvalTaskBuffer*> params(P);
+        for(size_t j = 0; j < P; j++)
+        {
+            size_t nSlot = m_slots.size();     // unused parameters write to the spare slot
+            FindSymbol(parameters[j], nSlot);
+            params[j] = &bindings[nSlot];
+        }
+        
+        MathExprScratch& scratch = context.m_scratch[GetThreadIndex()];
+        size_t kEnd = (nBlock + 1) * nBlockSize < K ? (nBlock + 1) * nBlockSize : K;
+        for(size_t k = nBlock * nBlockSize; k < kEnd; k++)
+        {
+            for(size_t j = 0; j < P; j++)
+            {
+                params[j]->p = const_cast<double*>(values.data() + k * P + j);
+                params[j]->n = 1;
+            }
+            
+            SetPosition(scratch, context.m_seed, k * N + nOffset, NULL, n);
+            if(!EvaluateEx(results.data() + k * N + nOffset, n, bindings.data(), view.ops, view.nops, view.constants, scratch))
+            {
+                nEvalError++;
+                break;
+            }
+        }
+    }
+    if(nEvalError)
+    {
+        results.resize(0);
+        context.m_error = "Evaluation Failed.";
+        return false;
+    }
+    
+    return true;
+}
+
+bool MathExpressionProgram::RegisterFunction(const char* lpcszName, MathFunction_n f, size_t nArity, bool bPure, string& error)
+{
+    string name(lpcszName ? lpcszName : "");
+    bool bValidName = name.size() && IsValidForName(name[0], true);
+    for(size_t i = 1; i < name.size() && bValidName; i++)
+        bValidName = IsValidForName(name[i], false);
+    if(!bValidName || !f || !nArity)
+    {
+        error = "Invalid Function.";
+        return false;
+    }
+    size_t nBuiltin;
+    if(FindBuiltin(name, nBuiltin) || IsReduction(name) || name == "if" || name == "where")
+    {
+        error = "Function Already Defined.";
+        return false;
+    }
+    
+    // only names called by the expression have an entry
+    const string* pName = InternName(name);
+    for(size_t i = 0; i < m_calls.size(); i++)
+    {
+        if(m_calls[i] != pName)
+            continue;
+        m_fn[i].f = f;
+        m_fn[i].arity = nArity;
+        m_fn[i].pure = bPure;
+        
+        // calls with constant arguments can be folded now
+        vector<MathExpressionNode> nodes;
+        Expand(nodes);
+        Optimize(nodes);
+        Compact(nodes, m_code);
+        m_storage.reset();
+        break;
+    }
+    return true;
+}
+bool MathExpressionProgram::IsBalanced(const char* lpcszExpr)
+{
+    size_t N = 0;
+    size_t nExprLength = strlen(lpcszExpr);
+    for(size_t i = 0; i < nExprLength; i++)
+    {
+        if(lpcszExpr[i] == '(')
+        {
+            N++;
+        }
+        else if(lpcszExpr[i] == ')')
+        {
+            if(N == 0)
+                return false;
+            N--;
+        }
+    }
+    
+    return N == 0;
+}
+bool MathExpressionProgram::IsValidForNumberBeginning(char chr)
+{
+    return (chr >= '0' && chr <= '9') || chr == '.';
+}
+bool MathExpressionProgram::IsValidForName(char chr, bool bFirst)
+{
+    if(bFirst)
+        return (chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || chr == '_';
+    else
+        return IsValidForName(chr, 1) || (chr >= '0' && chr <= '9');
+}
+bool MathExpressionProgram::IsValidOperator(char chr)
+{
+    for(size_t i = 0; i < sizeof(__MathExpression_operators__)/sizeof(MathExpressionOperator); i++)
+    {
+        if(__MathExpression_operators__[i].repr[0] == chr)
+            return true;
+    }
+    return false;
+}
+bool MathExpressionProgram::IsValidOperator(const char* lpcszExpr, size_t& nLength)
+{
+    for(size_t i = 0; i < sizeof(__MathExpression_operators__)/sizeof(MathExpressionOperator); i++)
+    {
+        const string& repr = __MathExpression_operators__[i].repr;
+        if(strncmp(lpcszExpr, repr.c_str(), repr.size()) == 0)
+        {
+            nLength = repr.size();
+            return true;
+        }
+    }
+    return false;
+}
+bool MathExpressionProgram::IsValidWhiteSpace(char chr)
+{
+    return chr == ' ' || chr == '\n' || chr == '\r' || chr == '\t' || chr == '\f' || chr == '\v';
+}
+bool MathExpressionProgram::IsOperatorWithGreaterPrecedence(const string& A, const string& B)
+{
+    // assumes that A and b are valid operators.
+    size_t offsetOpA = 0, offsetOpB = 0;
+    for(size_t i = 0; i < sizeof(__MathExpression_operators__)/sizeof(MathExpressionOperator); i++)
+    {
+        if(__MathExpression_operators__[i].repr == A)
+            offsetOpA = i;
+        if(__MathExpression_operators__[i].repr == B)
+            offsetOpB = i;
+    }
+    
+    return __MathExpression_operators__[offsetOpA] > __MathExpression_operators__[offsetOpB];
+}
+bool MathExpressionProgram::GetSubExpressionLength(const char* lpcszExpr, size_t& nExprSubLength)    // leading '(' and ending ')' included
+{
+    size_t nExprLength = strlen(lpcszExpr);
     if(!nExprLength || lpcszExpr[0] != '(')
         return false;
     
@@ -316,13 +3025,65 @@ bool MathExpression::GetSubExpressionLength(const char* lpcszExpr, size_t& nExpr
     
     return false;
 }
-bool MathExpression::GetTokens(const char* lpcszExpr, vector<MathExpressionNode>& nodes, string& error)
+void MathExpressionProgram::GetStatements(const char* lpcszExpr, vector<string>& statements)
+{
+    // ';' separates statements at the top level, blank statements are skipped
+    statements.clear();
+    size_t nDepth = 0;
+    size_t nStart = 0;
+    size_t nExprLength = strlen(lpcszExpr);
+    for(size_t i = 0; i <= nExprLength; i++)
+    {
+        if(lpcszExpr[i] == '(')
+            nDepth++;
+        else if(lpcszExpr[i] == ')' && nDepth)
+            nDepth--;
+        else if((lpcszExpr[i] == ';' && !nDepth) || i == nExprLength)
+        {
+            string statement(lpcszExpr + nStart, i - nStart);
+            bool bBlank = true;
+            for(size_t j = 0; j < statement.size() && bBlank; j++)
+                bBlank = IsValidWhiteSpace(statement[j]);
+            if(!bBlank)
+                statements.push_back(statement);
+            nStart = i + 1;
+        }
+    }
+    
+    // an empty expression reports the same error as before
+    if(statements.empty())
+        statements.push_back(lpcszExpr);
+}
+bool MathExpressionProgram::GetAssignment(const string& statement, string& target, size_t& nExprOffset)
+{
+    // name = expression, where '=' is not the first character of '=='
+    size_t i = 0;
+    while(i < statement.size() && IsValidWhiteSpace(statement[i]))
+        i++;
+    size_t nStart = i;
+    if(i == statement.size() || !IsValidForName(statement[i], true))
+        return false;
+    while(i < statement.size() && IsValidForName(statement[i], false))
+        i++;
+    size_t nEnd = i;
+    while(i < statement.size() && IsValidWhiteSpace(statement[i]))
+        i++;
+    if(i == statement.size() || statement[i] != '=' || (i + 1 < statement.size() && statement[i + 1] == '='))
+        return false;
+    
+    target = statement.substr(nStart, nEnd - nStart);
+    nExprOffset = i + 1;
+    return true;
+}
+bool MathExpressionProgram::GetTokens(const char* lpcszExpr, vector<MathExpressionNode>& nodes, string& error)
 {
     size_t nExprLength = strlen(lpcszExpr);
+    size_t nOperatorLength = 0;
     for(size_t i = 0; i < nExprLength;)
     {
         char chr = lpcszExpr[i];
         MathExpressionNode node;
+        node.nargs = 0;
         node.values.resize(0);
         node.children.resize(0);
         
@@ -342,12 +3103,21 @@ bool MathExpression::GetTokens(const char* lpcszExpr, vector<MathExpressionNode>
             if(!GetTokens(node.repr.c_str(), children, error))
                 return false;
             
-            node.children.assign(children.begin(), children.end());
-            
             if(nodes.size() && nodes.back().type == MathExprNodeType_Symbol)
+            {
+                // arguments are separated at the top level of the following expression
                 nodes.back().type = MathExprNodeType_Function;
+                nodes.back().nargs = 1;
+                for(size_t j = 0; j < children.size(); j++)
+                {
+                    if(children[j].type == MathExprNodeType_Separator)
+                        nodes.back().nargs++;
+                }
+            }
             
-            nodes.push_back(node);
+            // the sub-tree is moved, not copied, at every level
+            node.children.swap(children);
+            nodes.push_back(std::move(node));
             
             i += nSubSize;
             continue;
@@ -368,10 +3138,10 @@ bool MathExpression::GetTokens(const char* lpcszExpr, vector<MathExpressionNode>
             i = j;
             continue;
         }
-        else if(IsValidOperator(chr))
+        else if(IsValidOperator(lpcszExpr + i, nOperatorLength))
         {
             node.type = MathExprNodeType_Operator;
-            node.repr = chr;
+            node.repr.assign(lpcszExpr + i, nOperatorLength);
             
             bool SignMerged = false;
             
@@ -380,13 +3150,14 @@ bool MathExpression::GetTokens(const char* lpcszExpr, vector<MathExpressionNode>
                nodes.back().type == MathExprNodeType_Operator  || nodes.back().type == MathExprNodeType_Sign)
             {
                 node.type = MathExprNodeType_Sign;
-                if(node.repr != "+" && node.repr != "-")
+                if(node.repr != "+" && node.repr != "-" && node.repr != "!")
                 {
                     error = "Invalid Operator.";
                     return false;
                 }
                 
-                if(nodes.size())
+                // logical NOT is never merged with +/-
+                if(nodes.size() && node.repr != "!" && nodes.back().repr != "!")
                 {
                     if(nodes.back().type == MathExprNodeType_Sign)
                     {
@@ -402,19 +3173,25 @@ bool MathExpression::GetTokens(const char* lpcszExpr, vector<MathExpressionNode>
                         }
                         else if(nodes.back().repr == "-")
                         {
+                            SignMerged = true;
                             nodes.back().repr = (node.repr == "+" ? "-" : "+");
                         }
                         
                     }
                 }
             }
+            else if(node.repr == "!")
+            {
+                error = "Invalid Operator.";
+                return false;
+            }
             
             if(!SignMerged)
                 nodes.push_back(node);
             if(nodes.size() && nodes.back().type == MathExprNodeType_Sign && nodes.back().repr == "+")
                 nodes.pop_back();
             
-            i++;
+            i += nOperatorLength;
             continue;
         }
         else if(IsValidForNumberBeginning(chr))
@@ -458,7 +3235,7 @@ bool MathExpression::GetTokens(const char* lpcszExpr, vector<MathExpressionNode>
     
     return true;
 }
-bool MathExpression::ValidatePreviousNext(const vector<MathExpressionNode>& nodes, size_t offset, const MathExprNodeType* pValidPrevious, size_t nValidPrevious, const MathExprNodeType* pValidNext, size_t nValidNext)
+bool MathExpressionProgram::ValidatePreviousNext(const vector<MathExpressionNode>& nodes, size_t offset, const MathExprNodeType* pValidPrevious, size_t nValidPrevious, const MathExprNodeType* pValidNext, size_t nValidNext)
 {
     if(offset >= nodes.size())
         return false;
@@ -476,7 +3253,7 @@ bool MathExpression::ValidatePreviousNext(const vector<MathExpressionNode>& node
     }
     return true;
 }
-bool MathExpression::Validate(const vector<MathExpressionNode>& nodes) {
+bool MathExpressionProgram::Validate(const vector<MathExpressionNode>& nodes) {
     /***********************************************************************************************************************
      *  MathExprNodeType_Number,     MathExprNodeType_Operator, MathExprNodeType_Symbol, MathExprNodeType_Function,        *
      *  MathExprNodeType_Expression, MathExprNodeType_Sign,     MathExprNodeType_Separator                                 *
@@ -581,8 +3358,9 @@ bool MathExpression::Validate(const vector<MathExpressionNode>& nodes) {
             }
             case MathExprNodeType_Sign:
             {
-                static MathExprNodeType prev[] = {MathExprNodeType_Operator, MathExprNodeType_Separator};
-                static MathExprNodeType next[] = {MathExprNodeType_Number, MathExprNodeType_Symbol, MathExprNodeType_Function, MathExprNodeType_Expression};
+                // only logical NOT is kept next to another sign, e.g. -!x
+                static MathExprNodeType prev[] = {MathExprNodeType_Operator, MathExprNodeType_Separator, MathExprNodeType_Sign};
+                static MathExprNodeType next[] = {MathExprNodeType_Number, MathExprNodeType_Symbol, MathExprNodeType_Function, MathExprNodeType_Expression, MathExprNodeType_Sign};
                 if(!ValidatePreviousNext(nodes, i, prev, sizeof(prev)/sizeof(MathExprNodeType), next, sizeof(next)/sizeof(MathExprNodeType)))
                     return false;
                 if(i == nodes.size() - 1)
@@ -594,7 +3372,7 @@ bool MathExpression::Validate(const vector<MathExpressionNode>& nodes) {
     }
     return true;
 }
-bool MathExpression::ShuntingYard(vector<MathExpressionNode>& results, const vector<MathExpressionNode>& nodes, string& error)
+bool MathExpressionProgram::ShuntingYard(vector<MathExpressionNode>& results, const vector<MathExpressionNode>& nodes, string& error)
 {
     // Shunting Yard Algorighm: https://en.wikipedia.org/wiki/Shunting-yard_algorithm
     
@@ -620,15 +3398,60 @@ bool MathExpression::ShuntingYard(vector<MathExpressionNode>& results, const vec
             OperatorStack.push_back(nodes[i]);
         else if(nodes[i].type == MathExprNodeType_Sign)
         {
+            // + and - take the terms of higher precedence that follow, ! only its operand,
+            // with the signs in front of it and the arguments of a call
             vector<MathExpressionNode> _results, _nodes;
             for(size_t j = i + 1; j < nodes.size(); j++)
             {
+                if(nodes[i].repr == "!")
+                {
+                    if(nodes[j].type == MathExprNodeType_Sign || nodes[j].type == MathExprNodeType_Function)
+                    {
+                        _nodes.push_back(nodes[j]);
+                        continue;
+                    }
+                    if(nodes[j].type == MathExprNodeType_Number || nodes[j].type == MathExprNodeType_Symbol || nodes[j].type == MathExprNodeType_Expression)
+                        _nodes.push_back(nodes[j]);
+                    break;
+                }
                 if(nodes[j].type == MathExprNodeType_Number      || \
                    nodes[j].type == MathExprNodeType_Symbol      || \
                    nodes[j].type == MathExprNodeType_Function    || \
                    nodes[j].type == MathExprNodeType_Expression  || \
                    nodes[j].type == MathExprNodeType_Sign        || \
-                   (nodes[j].type == MathExprNodeType_Operator && nodes[j].repr != "+" && nodes[j].repr != "-"))
+                   (nodes[j].type == MathExprNodeType_Operator && IsOperatorWithGreaterPrecedence(nodes[j].repr, "+")))
+                {
+                    _nodes.push_back(nodes[j]);
+                }
+                else
+                    break;
+            }
+            if(!ShuntingYard(_results, _nodes, error))
+                return false;
+            OutputQueue.insert(OutputQueue.end(), _results.begin(), _results.end());
+            OutputQueue.push_back(nodes[i]);
+            i += _nodes.size();
+        }
+        else if(nodes[i].type == MathExprNodeType_Separator)
+        {
+            // top of the stack first, as at the end of the expression
+            OutputQueue.insert(OutputQueue.end(), OperatorStack.rbegin(), OperatorStack.rend());
+            OperatorStack.resize(0);
+            
+            // unnecessary to push back separator
+            //OutputQueue.push_back(nodes[i]);
+        }
+        else if(nodes[i].type == MathExprNodeType_Operator && nodes[i].repr == "^")
+        {
+            vector<MathExpressionNode> _results, _nodes;
+            for(size_t j = i + 1; j < nodes.size(); j++)
+            {
+                if(nodes[j].type == MathExprNodeType_Number     || \
+                   nodes[j].type == MathExprNodeType_Symbol     || \
+                   nodes[j].type == MathExprNodeType_Function   || \
+                   nodes[j].type == MathExprNodeType_Expression || \
+                   nodes[j].type == MathExprNodeType_Sign       || \
+                   (nodes[j].type == MathExprNodeType_Operator && nodes[j].repr == "^"))
                 {
                     _nodes.push_back(nodes[j]);
                 }
@@ -641,92 +3464,621 @@ bool MathExpression::ShuntingYard(vector<MathExpressionNode>& results, const vec
             OutputQueue.push_back(nodes[i]);
             i += _nodes.size();
         }
-        else if(nodes[i].type == MathExprNodeType_Separator)
+        else if(nodes[i].type == MathExprNodeType_Operator && nodes[i].repr != "^")
+        {
+            if(OperatorStack.size())
+            {
+                for(size_t j = OperatorStack.size(); j >= 1; j--)
+                {
+                    MathExprNodeType toptype = OperatorStack.back().type;
+                    string toprepr = OperatorStack.back().repr;
+                    
+                    if(toptype == MathExprNodeType_Function || !IsOperatorWithGreaterPrecedence(nodes[i].repr, toprepr))
+                    {
+                        OutputQueue.push_back(OperatorStack.back());
+                        OperatorStack.pop_back();
+                    }
+                    else
+                        break;
+                }
+            }
+            
+            OperatorStack.push_back(nodes[i]);
+            
+        }
+    }
+    
+    for(size_t i = OperatorStack.size(); i >= 1; i--)
+        OutputQueue.push_back(OperatorStack[i - 1]);
+    
+    results.swap(OutputQueue);
+    
+    return true;
+}
+bool MathExpressionProgram::IsPureFunction(const string& repr) const
+{
+    // reductions depend on all rows and are never folded
+    for(size_t i = 0; i < m_calls.size(); i++)
+    {
+        if(*m_calls[i] == repr)
+            return m_fn[i].f && m_fn[i].pure;
+    }
+    size_t nBuiltin;
+    return repr == "if" || repr == "where" || (FindBuiltin(repr, nBuiltin) && GetBuiltins()[nBuiltin].pure);
+}
+bool MathExpressionProgram::Compact(const vector<MathExpressionNode>& nodes, MathExprCode& code)
+{
+    code.ops.resize(nodes.size());
+    code.constants.resize(0);
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        const MathExpressionNode& node = nodes[i];
+        MathExprOp& op = code.ops[i];
+        op.type = static_cast<unsigned char>(node.type);
+        op.code = 0;
+        op.nargs = 0;
+        op.index = 0;
+        if(node.type == MathExprNodeType_Number)
+        {
+            op.index = static_cast<unsigned int>(code.constants.size());
+            code.constants.push_back(node.values.size() ? node.values[0] : 0);
+        }
+        else if(node.type == MathExprNodeType_Symbol)
+        {
+            op.index = static_cast<unsigned int>(AddName(m_slots, node.repr));
+        }
+        else if(node.type == MathExprNodeType_Local || node.type == MathExprNodeType_Assignment)
+        {
+            op.index = static_cast<unsigned int>(AddName(m_locals, node.repr));
+        }
+        else if(node.type == MathExprNodeType_Operator || node.type == MathExprNodeType_Sign)
+        {
+            size_t nOperator;
+            if(!FindOperator(node.repr, nOperator))
+                return false;
+            op.code = static_cast<unsigned char>(__MathExpression_operators__[nOperator].code);
+        }
+        else if(node.type == MathExprNodeType_Function)
+        {
+            if(node.nargs > numeric_limits<unsigned short>::max())
+            {
+                m_error = "Too Many Arguments.";
+                return false;
+            }
+            op.nargs = static_cast<unsigned short>(node.nargs);
+            
+            size_t nIndex;
+            if(node.nargs == 1 && ::FindReduction(node.repr, nIndex))
+                op.code = MathExprCall_Reduction;
+            else if(node.repr == "if" || node.repr == "where")
+            {
+                op.code = MathExprCall_Select;
+                nIndex = node.repr == "where" ? 1 : 0;
+            }
+            else if(FindBuiltin(node.repr, nIndex))
+                op.code = MathExprCall_Builtin;
+            else
+            {
+                // unknown until registered
+                const string* pName = InternName(node.repr);
+                nIndex = std::find(m_calls.begin(), m_calls.end(), pName) - m_calls.begin();
+                if(nIndex == m_calls.size())
+                {
+                    MathExprUserFunction fn = {NULL, 0, false};
+                    m_calls.push_back(pName);
+                    m_fn.push_back(fn);
+                }
+                op.code = MathExprCall_User;
+            }
+            op.index = static_cast<unsigned int>(nIndex);
+            if((op.code == MathExprCall_Builtin && GetBuiltins()[nIndex].arity && op.nargs != GetBuiltins()[nIndex].arity) || \
+               (op.code == MathExprCall_Select && op.nargs != 3))
+            {
+                m_error = "Invalid Number of Arguments.";
+                return false;
+            }
+        }
+        else
+            return false;
+    }
+    return true;
+}
+void MathExpressionProgram::Expand(vector<MathExpressionNode>& nodes) const
+{
+    MathExprCodeView view = Code();
+    nodes.resize(view.nops);
+    for(size_t i = 0; i < view.nops; i++)
+    {
+        const MathExprOp& op = view.ops[i];
+        MathExpressionNode& node = nodes[i];
+        node.type = static_cast<MathExprNodeType>(op.type);
+        node.nargs = op.nargs;
+        node.values.resize(0);
+        node.children.resize(0);
+        if(op.type == MathExprNodeType_Number)
+        {
+            char repr[32];
+            snprintf(repr, sizeof(repr), "%.17g", view.constants[op.index]);
+            node.repr = repr;
+            node.values.push_back(view.constants[op.index]);
+        }
+        else if(op.type == MathExprNodeType_Symbol)
+            node.repr = *m_slots[op.index];
+        else if(op.type == MathExprNodeType_Local || op.type == MathExprNodeType_Assignment)
+            node.repr = *m_locals[op.index];
+        else if(op.type == MathExprNodeType_Operator || op.type == MathExprNodeType_Sign)
+        {
+            for(size_t j = 0; j < sizeof(__MathExpression_operators__)/sizeof(MathExpressionOperator); j++)
+            {
+                if(__MathExpression_operators__[j].code == op.code)
+                    node.repr = __MathExpression_operators__[j].repr;
+            }
+        }
+        else if(op.code == MathExprCall_Reduction)
+            node.repr = __MathExpression_reductions__[op.index];
+        else if(op.code == MathExprCall_Select)
+            node.repr = op.index ? "where" : "if";
+        else if(op.code == MathExprCall_Builtin)
+            node.repr = GetBuiltins()[op.index].name;
+        else
+            node.repr = *m_calls[op.index];
+    }
+}
+bool MathExpressionProgram::FindSymbol(const string& name, size_t& slot) const
+{
+    for(size_t i = 0; i < m_slots.size(); i++)
+    {
+        if(*m_slots[i] == name)
+        {
+            slot = i;
+            return true;
+        }
+    }
+    return false;
+}
+void MathExpressionProgram::Optimize(vector<MathExpressionNode>& nodes)
+{
+    // Nodes before i are already optimized, so a folded or pruned result is seen as a
+    // plain number by every node that consumes it.
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        if(nodes[i].type == MathExprNodeType_Operator || nodes[i].type == MathExprNodeType_Sign || \
+           (nodes[i].type == MathExprNodeType_Function && IsPureFunction(nodes[i].repr)))
+        {
+            // operators, signs and pure functions with constant operands are folded
+            size_t nStart = 0;
+            if(!GetOperandStart(nodes, i, nStart))
+                continue;
+            bool bConstant = true;
+            for(size_t j = nStart; j < i && bConstant; j++)
+                bConstant = nodes[j].type == MathExprNodeType_Number;
+            if(!bConstant)
+                continue;
+            
+            vector<MathExpressionNode> operand(nodes.begin() + nStart, nodes.begin() + i + 1);
+            MathExprCode code;
+            MathExprScratch scratch;
+            MathExprNodeEvalTaskBuffer result;
+            if(!Compact(operand, code) || !EvaluateEx(result, NULL, code.ops.data(), code.ops.size(), code.constants.data(), scratch) || result.n != 1)
+                continue;
+            vector<double> values(result.p, result.p + 1);
+            
+            char repr[32];
+            snprintf(repr, sizeof(repr), "%.17g", values[0]);
+            MathExpressionNode node;
+            node.type = MathExprNodeType_Number;
+            node.nargs = 0;
+            node.repr = repr;
+            node.values = values;
+            nodes.erase(nodes.begin() + nStart, nodes.begin() + i + 1);
+            nodes.insert(nodes.begin() + nStart, node);
+            i = nStart;
+        }
+        if(nodes[i].type == MathExprNodeType_Function && (nodes[i].repr == "if" || nodes[i].repr == "where"))
+        {
+            // a constant condition selects one alternative, the other one is dropped
+            size_t nStart2 = 0, nStart1 = 0, nStartC = 0;
+            if(!i || !GetOperandStart(nodes, i - 1, nStart2))
+                continue;
+            if(!nStart2 || !GetOperandStart(nodes, nStart2 - 1, nStart1))
+                continue;
+            if(!nStart1 || !GetOperandStart(nodes, nStart1 - 1, nStartC))
+                continue;
+            if(nStart1 - nStartC != 1 || nodes[nStartC].type != MathExprNodeType_Number)
+                continue;
+            
+            vector<MathExpressionNode> selected;
+            if(nodes[nStartC].values[0] != 0)
+                selected.assign(nodes.begin() + nStart1, nodes.begin() + nStart2);
+            else
+                selected.assign(nodes.begin() + nStart2, nodes.begin() + i);
+            nodes.erase(nodes.begin() + nStartC, nodes.begin() + i + 1);
+            nodes.insert(nodes.begin() + nStartC, selected.begin(), selected.end());
+            i = nStartC + selected.size() - 1;
+        }
+    }
+    
+    LowerPolynomials(nodes);
+}
+bool MathExpressionProgram::GetMonomial(const vector<MathExpressionNode>& nodes, size_t end, string& symbol, double& coefficient, size_t& degree) const
+{
+    // c, x, x^k with a constant integer k, and products of those
+    const MathExpressionNode& node = nodes[end];
+    if(node.type == MathExprNodeType_Number)
+    {
+        coefficient = node.values[0];
+        degree = 0;
+        return true;
+    }
+    if(node.type == MathExprNodeType_Symbol)
+    {
+        if(symbol.size() && symbol != node.repr)
+            return false;
+        symbol = node.repr;
+        coefficient = 1;
+        degree = 1;
+        return true;
+    }
+    if(node.type == MathExprNodeType_Sign && node.repr == "-")
+    {
+        if(!end || !GetMonomial(nodes, end - 1, symbol, coefficient, degree))
+            return false;
+        coefficient = -coefficient;
+        return true;
+    }
+    if(node.type != MathExprNodeType_Operator || (node.repr != "*" && node.repr != "^"))
+        return false;
+    
+    size_t nStart2 = 0;
+    if(!end || !GetOperandStart(nodes, end - 1, nStart2) || !nStart2)
+        return false;
+    if(node.repr == "^")
+    {
+        const MathExpressionNode& exponent = nodes[end - 1];
+        const MathExpressionNode& base = nodes[nStart2 - 1];
+        if(nStart2 != end - 1 || exponent.type != MathExprNodeType_Number || base.type != MathExprNodeType_Symbol)
+            return false;
+        double k = exponent.values[0];
+        if(!(k >= 0 && k <= 64) || k != floor(k) || (symbol.size() && symbol != base.repr))
+            return false;
+        symbol = base.repr;
+        coefficient = 1;
+        degree = static_cast<size_t>(k);
+        return true;
+    }
+    
+    double c1 = 0, c2 = 0;
+    size_t k1 = 0, k2 = 0;
+    if(!GetMonomial(nodes, nStart2 - 1, symbol, c1, k1) || !GetMonomial(nodes, end - 1, symbol, c2, k2))
+        return false;
+    coefficient = c1 * c2;
+    degree = k1 + k2;
+    return degree <= 64;
+}
+bool MathExpressionProgram::GetPolynomialTerms(const vector<MathExpressionNode>& nodes, size_t end, double sign, string& symbol, vector<double>& coefficients) const
+{
+    // adds the terms of a sum into coefficients[k] for c * symbol^k
+    const MathExpressionNode& node = nodes[end];
+    if(node.type == MathExprNodeType_Operator && (node.repr == "+" || node.repr == "-"))
+    {
+        size_t nStart2 = 0;
+        if(!end || !GetOperandStart(nodes, end - 1, nStart2) || !nStart2)
+            return false;
+        return GetPolynomialTerms(nodes, nStart2 - 1, sign, symbol, coefficients) && \
+               GetPolynomialTerms(nodes, end - 1, node.repr == "-" ? -sign : sign, symbol, coefficients);
+    }
+    if(node.type == MathExprNodeType_Sign && node.repr == "-")
+        return end && GetPolynomialTerms(nodes, end - 1, -sign, symbol, coefficients);
+    
+    double coefficient = 0;
+    size_t degree = 0;
+    if(!GetMonomial(nodes, end, symbol, coefficient, degree))
+        return false;
+    if(coefficients.size() <= degree)
+        coefficients.resize(degree + 1, 0.0);
+    coefficients[degree] += sign * coefficient;
+    return true;
+}
+void MathExpressionProgram::LowerPolynomials(vector<MathExpressionNode>& nodes)
+{
+    // Sums of monomials in one symbol become poly(x, c0, c1, ...), evaluated by Horner's rule
+    // instead of one pow() per term. Outer sums are tried first. Not value-preserving at
+    // infinite x: Horner's rule gives the limit where the sum as written may be inf - inf.
+    for(size_t i = nodes.size(); i >= 1; i--)
+    {
+        size_t end = i - 1;
+        if(nodes[end].type != MathExprNodeType_Operator || (nodes[end].repr != "+" && nodes[end].repr != "-"))
+            continue;
+        size_t nStart = 0;
+        if(!GetOperandStart(nodes, end, nStart))
+            continue;
+        
+        string symbol;
+        vector<double> coefficients;
+        if(!GetPolynomialTerms(nodes, end, 1.0, symbol, coefficients) || symbol.empty())
+            continue;
+        while(coefficients.size() && coefficients.back() == 0)
+            coefficients.pop_back();
+        if(coefficients.size() < 3)
+            continue;
+        
+        vector<MathExpressionNode> poly;
+        MathExpressionNode node;
+        node.type = MathExprNodeType_Symbol;
+        node.nargs = 0;
+        node.repr = symbol;
+        poly.push_back(node);
+        for(size_t j = 0; j < coefficients.size(); j++)
+        {
+            char repr[32];
+            snprintf(repr, sizeof(repr), "%.17g", coefficients[j]);
+            node.type = MathExprNodeType_Number;
+            node.repr = repr;
+            node.values.assign(1, coefficients[j]);
+            poly.push_back(node);
+        }
+        node.type = MathExprNodeType_Function;
+        node.nargs = coefficients.size() + 1;
+        node.repr = "poly";
+        node.values.resize(0);
+        poly.push_back(node);
+        
+        nodes.erase(nodes.begin() + nStart, nodes.begin() + end + 1);
+        nodes.insert(nodes.begin() + nStart, poly.begin(), poly.end());
+        i = nStart + 1;
+    }
+}
+bool MathExpressionProgram::FindReduction(const MathExprOp* ops, size_t nOps, size_t& offset) const
+{
+    // in RPN, the first reduction never has another reduction in its operand;
+    // min and max with more than one argument are element-wise
+    for(size_t i = 0; i < nOps; i++)
+    {
+        if(ops[i].type == MathExprNodeType_Function && ops[i].code == MathExprCall_Reduction)
+        {
+            offset = i;
+            return true;
+        }
+    }
+    return false;
+}
+template<typename T> static bool GetOperandStartT(const vector<T>& nodes, size_t end, size_t& start)
+{
+    // walks back from the last node of an operand until exactly one value is produced
+    size_t nRequired = 1;
+    for(size_t i = end + 1; i >= 1; i--)
+    {
+        const T& node = nodes[i - 1];
+        nRequired--;
+        if(node.type == MathExprNodeType_Operator)
+            nRequired += 2;
+        else if(node.type == MathExprNodeType_Sign)
+            nRequired += 1;
+        else if(node.type == MathExprNodeType_Function)
+            nRequired += node.nargs;
+        else if(node.type == MathExprNodeType_Assignment)
+            nRequired += 2;     // consumes a value and produces none
+        
+        if(nRequired == 0)
+        {
+            start = i - 1;
+            return true;
+        }
+    }
+    return false;
+}
+bool MathExpressionProgram::GetOperandStart(const vector<MathExpressionNode>& nodes, size_t end, size_t& start) const
+{
+    return GetOperandStartT(nodes, end, start);
+}
+bool MathExpressionProgram::GetOperandStart(const vector<MathExprOp>& ops, size_t end, size_t& start) const
+{
+    return GetOperandStartT(ops, end, start);
+}
+bool MathExpressionProgram::ReduceEx(MathExprReductionPartial& partial, const string& repr, size_t n, const MathExprNodeEvalTaskBuffer* slots, const MathExprOp* ops, size_t nOps, const double* constants, MathExprScratch& scratch) const
+{
+    MathExprNodeEvalTaskBuffer result;
+    if(!EvaluateEx(result, slots, ops, nOps, constants, scratch))
+        return false;
+    if(result.n != n && result.n != 1)
+        return false;
+    const double* values = result.p;
+    
+    // a single value stands for the whole segment
+    double weight = static_cast<double>(result.n == 1 ? n : 1);
+    partial.count = static_cast<double>(n);
+    if(repr == "min")
+    {
+        partial.value = numeric_limits<double>::infinity();
+        for(size_t i = 0; i < result.n; i++)
+        {
+            if(values[i] < partial.value || values[i] != values[i])
+                partial.value = values[i];
+        }
+    }
+    else if(repr == "max")
+    {
+        partial.value = -numeric_limits<double>::infinity();
+        for(size_t i = 0; i < result.n; i++)
         {
-            OutputQueue.insert(OutputQueue.end(), OperatorStack.begin(), OperatorStack.end());
-            OperatorStack.resize(0);
-            
-            // unnecessary to push back separator
-            //OutputQueue.push_back(nodes[i]);
+            if(values[i] > partial.value || values[i] != values[i])
+                partial.value = values[i];
         }
-        else if(nodes[i].type == MathExprNodeType_Operator && nodes[i].repr == "^")
+    }
+    else if(repr == "norm")
+    {
+        partial.value = 0;
+        for(size_t i = 0; i < result.n; i++)
+            partial.value += values[i] * values[i];
+        partial.value *= weight;
+    }
+    else
+    {
+        partial.value = 0;
+        for(size_t i = 0; i < result.n; i++)
+            partial.value += values[i];
+        partial.value *= weight;
+    }
+    return true;
+}
+double MathExpressionProgram::ReducePartials(const string& repr, const MathExprReductionPartial* partials, size_t n) const
+{
+    if(!n)
+        return numeric_limits<double>::quiet_NaN();
+    MathExprReductionPartial partial = ReducePartialsTree(repr, partials, n);
+    if(repr == "mean")
+        return partial.value / partial.count;
+    if(repr == "norm")
+        return sqrt(partial.value);
+    return partial.value;
+}
+size_t MathExpressionProgram::GetSegmentSize() const
+{
+    // upper bound, the plan of each call picks the segment size that fits in cache
+    return 128 * 1024 * 1;  // 1MB for 131,072 doubles
+}
+bool MathExpressionProgram::PlanEvaluation(const MathExpressionContext& context, size_t nRows, size_t nGathered, size_t nMaxSegmentSize, MathExprPlan& plan, string& error) const
+{
+    // A thread holds the operand stack, one spare slot, the variables and the gathered
+    // columns, one segment each. Segments are sized so that these stay in a typical L2
+    // cache. Only the program and the budget decide the segment size, never the thread
+    // count, so that reductions, which depend on the segmentation, do not change.
+    size_t nStack = MaxStackDepth() + 1;
+    size_t nRowBytes = (nStack + m_locals.size() + nGathered) * sizeof(double);
+    size_t nMinSegmentSize = 1024;
+    size_t nSegmentSize = 256 * 1024 / nRowBytes / nMinSegmentSize * nMinSegmentSize;
+    if(nSegmentSize < nMinSegmentSize)
+        nSegmentSize = nMinSegmentSize;
+    if(nSegmentSize > nMaxSegmentSize)
+        nSegmentSize = nMaxSegmentSize;
+    
+    // Waking a thread team takes tens of microseconds, so each thread gets at least 25us
+    // of estimated work and at least one segment. One thread runs on the calling thread.
+    plan.rows = nRows;
+    plan.cost = GetRowCost();
+    size_t nMaxThreads = static_cast<size_t>(nRows * plan.cost / 25000);
+    size_t nSegments = nRows / nSegmentSize + (nRows % nSegmentSize ? 1 : 0);
+    if(nMaxThreads > nSegments)
+        nMaxThreads = nSegments;
+    if(nMaxThreads > GetThreadCount())
+        nMaxThreads = GetThreadCount();
+    if(nMaxThreads < 1)
+        nMaxThreads = 1;
+    size_t nThreads = nMaxThreads;
+    
+    // Within a budget, the segment is sized for a fixed number of shares of the budget, so
+    // that it still only depends on the program and the budget, not on the cores or the
+    // measured costs. The threads then take as many shares as fit, at least one segment.
+    size_t nBudget = context.m_memory.budget;
+    if(nBudget)
+    {
+        const size_t nShares = 8;
+        size_t nBudgetRows = nBudget / nRowBytes / nShares / nMinSegmentSize * nMinSegmentSize;
+        if(nBudgetRows < nSegmentSize)
+            nSegmentSize = nBudgetRows < nMinSegmentSize ? nMinSegmentSize : nBudgetRows;
+        nThreads = nBudget / nRowBytes / nSegmentSize;
+        if(nThreads > nMaxThreads)
+            nThreads = nMaxThreads;
+        if(!nThreads)
         {
-            vector<MathExpressionNode> _results, _nodes;
-            for(size_t j = i + 1; j < nodes.size(); j++)
-            {
-                if(nodes[j].type == MathExprNodeType_Number     || \
-                   nodes[j].type == MathExprNodeType_Symbol     || \
-                   nodes[j].type == MathExprNodeType_Function   || \
-                   nodes[j].type == MathExprNodeType_Expression || \
-                   nodes[j].type == MathExprNodeType_Sign       || \
-                   (nodes[j].type == MathExprNodeType_Operator && nodes[j].repr == "^"))
-                {
-                    _nodes.push_back(nodes[j]);
-                }
-                else
-                    break;
-            }
-            if(!ShuntingYard(_results, _nodes, error))
-                return false;
-            OutputQueue.insert(OutputQueue.end(), _results.begin(), _results.end());
-            OutputQueue.push_back(nodes[i]);
-            i += _nodes.size();
+            error = "Memory Budget Too Small.";
+            return false;
         }
-        else if(nodes[i].type == MathExprNodeType_Operator && nodes[i].repr != "^")
+    }
+    plan.threads = nThreads;
+    plan.segment = nSegmentSize;
+    plan.bytes = nThreads * nSegmentSize * nRowBytes;
+    return true;
+}
+bool MathExpressionProgram::PlanMemory(MathExpressionContext& context, size_t nRows, size_t nGathered, size_t& nSegmentSize, size_t& nThreads) const
+{
+    MathExprPlan plan;
+    if(!PlanEvaluation(context, nRows, nGathered, nSegmentSize, plan, context.m_error))
+        return false;
+    nSegmentSize = plan.segment;
+    nThreads = plan.threads;
+    
+    // buffers of earlier calls that this plan does not use are released
+    if(context.m_memory.budget)
+    {
+        for(size_t i = 0; i < context.m_scratch.size(); i++)
         {
-            if(OperatorStack.size())
+            MathExprScratch& scratch = context.m_scratch[i];
+            vector<vector<double> >* lists[] = {&scratch.stack, &scratch.locals, &scratch.gathered};
+            size_t counts[] = {MaxStackDepth() + 1, m_locals.size(), nGathered};
+            for(size_t j = 0; j < sizeof(lists)/sizeof(lists[0]); j++)
             {
-                for(size_t j = OperatorStack.size(); j >= 1; j--)
+                for(size_t k = 0; k < lists[j]->size(); k++)
                 {
-                    MathExprNodeType toptype = OperatorStack.back().type;
-                    string toprepr = OperatorStack.back().repr;
-                    
-                    if(toptype == MathExprNodeType_Function || !IsOperatorWithGreaterPrecedence(nodes[i].repr, toprepr))
-                    {
-                        OutputQueue.push_back(OperatorStack.back());
-                        OperatorStack.pop_back();
-                    }
-                    else
-                        break;
+                    if(i >= nThreads || k >= counts[j] || (*lists[j])[k].capacity() > nSegmentSize)
+                        vector<double>().swap((*lists[j])[k]);
                 }
             }
-            
-            OperatorStack.push_back(nodes[i]);
-            
         }
     }
-    
-    for(size_t i = OperatorStack.size(); i >= 1; i--)
-        OutputQueue.push_back(OperatorStack[i - 1]);
-    
-    results.resize(0);
-    results.insert(results.end(), OutputQueue.begin(), OutputQueue.end());
-    
+    context.m_plan = plan;
+    context.m_memory.estimate = plan.bytes;
+    context.m_memory.segment = nSegmentSize;
+    context.m_memory.threads = nThreads;
     return true;
 }
-size_t MathExpression::GetSegmentSize()
+size_t MathExpressionProgram::GetSweepSegmentSize(size_t nColumns) const
 {
-    // to-do: calculate segment size according to available memory.
-    return 128 * 1024 * 1;  // 1MB for 131,072 doubles
+    // keep the data columns of one segment within ~256KB, i.e. a typical L2 cache
+    size_t nSegmentSize = 32 * 1024 / (nColumns ? nColumns : 1);
+    return nSegmentSize < 1024 ? 1024 : nSegmentSize;
 }
-bool MathExpression::EvaluateEx(vector<double>& results, map<string, MathExprNodeEvalTaskBuffer>& bindings, const vector<MathExpressionNode>& nodes)
+bool MathExpressionProgram::EvaluateEx(double* results, size_t n, const MathExprNodeEvalTaskBuffer* slots, const MathExprOp* ops, size_t nOps, const double* constants, MathExprScratch& scratch) const
 {
-    results.resize(0);
+    MathExprNodeEvalTaskBuffer result;
+    if(!EvaluateEx(result, slots, ops, nOps, constants, scratch))
+        return false;
+    if(result.n == n)
+        std::copy(result.p, result.p + n, results);
+    else if(result.n == 1)
+        std::fill(results, results + n, result.p[0]);
+    else
+        return false;
+    return true;
+}
+bool MathExpressionProgram::EvaluateEx(MathExprNodeEvalTaskBuffer& result, const MathExprNodeEvalTaskBuffer* slots, const MathExprOp* ops, size_t nOps, const double* constants, MathExprScratch& scratch) const
+{
+    result.p = NULL;
+    result.n = 0;
     
-    vector<vector<double> > OutputQueue;
-    OutputQueue.reserve(nodes.size());
+    // The operand stack lives in the scratch space, its slots keep their capacity between
+    // calls so that a segment is evaluated without allocating once the scratch is warm.
+    vector<vector<double> >& OutputQueue = scratch.stack;
+    if(OutputQueue.size() < nOps + 1)
+        OutputQueue.resize(nOps + 1);
+    size_t nDepth = 0;
     
-    for(size_t i = 0; i < nodes.size(); i++)
+    for(size_t i = 0; i < nOps; i++)
     {
-        MathExprNodeType nodetype = nodes[i].type;
+        const MathExprOp& op = ops[i];
+        MathExprNodeType nodetype = static_cast<MathExprNodeType>(op.type);
         if(nodetype == MathExprNodeType_Number)
-            OutputQueue.push_back(nodes[i].values);
+            OutputQueue[nDepth++].assign(constants + op.index, constants + op.index + 1);
         else if(nodetype == MathExprNodeType_Symbol)
         {
-            map<string, MathExprNodeEvalTaskBuffer>::iterator it = bindings.find(string(nodes[i].repr));
-            if(it == bindings.end())
+            if(!slots || !slots[op.index].n)
+                return false;
+            OutputQueue[nDepth++].assign(slots[op.index].p, slots[op.index].p + slots[op.index].n);
+        }
+        else if(nodetype == MathExprNodeType_Local)
+        {
+            // assigned earlier in the same call, statements always run in order
+            if(op.index >= scratch.locals.size() || scratch.locals[op.index].empty())
+                return false;
+            OutputQueue[nDepth++].assign(scratch.locals[op.index].begin(), scratch.locals[op.index].end());
+        }
+        else if(nodetype == MathExprNodeType_Assignment)
+        {
+            if(!nDepth)
                 return false;
-            OutputQueue.push_back(vector<double>(it->second.p, it->second.p + it->second.n));
+            if(scratch.locals.size() <= op.index)
+                scratch.locals.resize(op.index + 1);
+            scratch.locals[op.index].swap(OutputQueue[--nDepth]);
         }
         else if(nodetype == MathExprNodeType_Separator)
         {
@@ -735,143 +4087,146 @@ bool MathExpression::EvaluateEx(vector<double>& results, map<string, MathExprNod
         }
         else if(nodetype == MathExprNodeType_Function)
         {
-            size_t nOutputQueues = OutputQueue.size();
-            if(!nOutputQueues)
+            if(!nDepth)
                 return false;
             
-            std::map<std::string, MathFunction_1>::iterator it1 = m_f1.find(std::string(nodes[i].repr));
-            std::map<std::string, MathFunction_2>::iterator it2 = m_f2.find(std::string(nodes[i].repr));
-            if(it1 != m_f1.end())
+            size_t nArgs = op.nargs;
+            if(nDepth < nArgs)
+                return false;
+            
+            if(op.code == MathExprCall_User)
             {
-                if(nOutputQueues < 1)
+                const MathExprUserFunction& fn = m_fn[op.index];
+                if(!fn.f || nArgs != fn.arity || !EvalMathFunction_n(OutputQueue, nDepth, fn.f, nArgs, scratch.args))
                     return false;
-                EvalMathFunction_1(it1->second, OutputQueue.back().data(), OutputQueue.back().size());
             }
-            else if(it2 != m_f2.end())
+            else if(op.code == MathExprCall_Select)
             {
-                if(nOutputQueues < 2)
+                if(nArgs != 3)
                     return false;
-                size_t nResultPosition;
-                EvalMathFunction_2(OutputQueue[nOutputQueues - 2], OutputQueue[nOutputQueues - 1], nResultPosition, it2->second);
-                if(nResultPosition == 1)
-                    OutputQueue[nOutputQueues - 2] = std::move(OutputQueue[nOutputQueues - 1]);
-                else if(nResultPosition != 0)
+                if(!EvalMathSelect(OutputQueue, nDepth))
                     return false;
-                OutputQueue.pop_back();
             }
-            else
-                return false;
-        }
-        else if(nodetype == MathExprNodeType_Operator)
-        {
-            size_t nOutputQueues = OutputQueue.size();
-            if(nodes[i].repr == "+" || nodes[i].repr == "-" || nodes[i].repr == "*" || nodes[i].repr == "/" || nodes[i].repr == "^")
+            else if(op.code == MathExprCall_Builtin)
             {
-                if(nOutputQueues < 2)
-                    return false;
-                size_t nOperand1Size = OutputQueue[nOutputQueues - 2].size();
-                size_t nOperand2Size = OutputQueue[nOutputQueues - 1].size();
-                if(!nOperand1Size || !nOperand2Size)
+                const MathExprBuiltin& builtin = GetBuiltins()[op.index];
+                if(builtin.arity && nArgs != builtin.arity)
                     return false;
-                
-                if(nodes[i].repr == "+")
-                {
-                    size_t nResultPosition;
-                    EvalMathFunction_2(OutputQueue[nOutputQueues - 2], OutputQueue[nOutputQueues - 1], nResultPosition, std::plus<double>());
-                    if(nResultPosition == 1)
-                        OutputQueue[nOutputQueues - 2] = std::move(OutputQueue[nOutputQueues - 1]);
-                }
-                else if(nodes[i].repr == "-")
-                {
-                    size_t nResultPosition;
-                    EvalMathFunction_2(OutputQueue[nOutputQueues - 2], OutputQueue[nOutputQueues - 1], nResultPosition, std::minus<double>());
-                    if(nResultPosition == 1)
-                        OutputQueue[nOutputQueues - 2] = std::move(OutputQueue[nOutputQueues - 1]);
-                }
-                else if(nodes[i].repr == "*")
-                {
-                    size_t nResultPosition;
-                    EvalMathFunction_2(OutputQueue[nOutputQueues - 2], OutputQueue[nOutputQueues - 1], nResultPosition, std::multiplies<double>());
-                    if(nResultPosition == 1)
-                        OutputQueue[nOutputQueues - 2] = std::move(OutputQueue[nOutputQueues - 1]);
-                }
-                else if(nodes[i].repr == "/")
+                if(builtin.fr)
                 {
-                    size_t nResultPosition;
-                    EvalMathFunction_2(OutputQueue[nOutputQueues - 2], OutputQueue[nOutputQueues - 1], nResultPosition, std::divides<double>());
-                    if(nResultPosition == 1)
-                        OutputQueue[nOutputQueues - 2] = std::move(OutputQueue[nOutputQueues - 1]);
+                    // one draw per value of the segment, a single stream is shared by all
+                    vector<double>& values = OutputQueue[nDepth - 1];
+                    if(values.size() == 1 && scratch.n > 1)
+                    {
+                        double stream = values[0];
+                        values.assign(scratch.n, stream);
+                    }
+                    if(!scratch.n || values.size() != scratch.n || !builtin.fr(values.data(), values.size(), scratch))
+                        return false;
                 }
-                else if(nodes[i].repr == "^")
+                else if(builtin.fn)
                 {
-                    size_t nResultPosition;
-                    EvalMathFunction_2(OutputQueue[nOutputQueues - 2], OutputQueue[nOutputQueues - 1], nResultPosition, [](double A, double B){return pow(A, B);});
-                    if(nResultPosition == 1)
-                        OutputQueue[nOutputQueues - 2] = std::move(OutputQueue[nOutputQueues - 1]);
+                    if(!EvalMathFunction_n(OutputQueue, nDepth, builtin.fn, nArgs, scratch.args))
+                        return false;
                 }
-                
-                OutputQueue.pop_back();
+                else if(builtin.f1)
+                    EvalMathFunction_1(builtin.f1, OutputQueue[nDepth - 1].data(), OutputQueue[nDepth - 1].size());
+                else if(!EvalMathOperator(OutputQueue, nDepth, builtin.f2))
+                    return false;
             }
             else
+                return false;   // reductions are resolved before evaluation
+        }
+        else if(nodetype == MathExprNodeType_Operator)
+        {
+            if(nDepth < 2)
+                return false;
+            size_t nOperand1Size = OutputQueue[nDepth - 2].size();
+            size_t nOperand2Size = OutputQueue[nDepth - 1].size();
+            if(!nOperand1Size || !nOperand2Size)
+                return false;
+            
+            // comparison and logical operators yield 1 or 0 without branching
+            bool bOK = false;
+            switch(op.code)
+            {
+                case MathExprOpCode_Plus:
+                    bOK = EvalMathOperator(OutputQueue, nDepth, std::plus<double>());
+                    break;
+                case MathExprOpCode_Minus:
+                    bOK = EvalMathOperator(OutputQueue, nDepth, std::minus<double>());
+                    break;
+                case MathExprOpCode_Multiply:
+                    bOK = EvalMathOperator(OutputQueue, nDepth, std::multiplies<double>());
+                    break;
+                case MathExprOpCode_Divide:
+                    bOK = EvalMathOperator(OutputQueue, nDepth, std::divides<double>());
+                    break;
+                case MathExprOpCode_Power:
+                    bOK = EvalMathOperator(OutputQueue, nDepth, [](double A, double B){return pow(A, B);});
+                    break;
+                case MathExprOpCode_Less:
+                    bOK = EvalMathOperator(OutputQueue, nDepth, [](double A, double B){return static_cast<double>(A < B);});
+                    break;
+                case MathExprOpCode_LessEqual:
+                    bOK = EvalMathOperator(OutputQueue, nDepth, [](double A, double B){return static_cast<double>(A <= B);});
+                    break;
+                case MathExprOpCode_Greater:
+                    bOK = EvalMathOperator(OutputQueue, nDepth, [](double A, double B){return static_cast<double>(A > B);});
+                    break;
+                case MathExprOpCode_GreaterEqual:
+                    bOK = EvalMathOperator(OutputQueue, nDepth, [](double A, double B){return static_cast<double>(A >= B);});
+                    break;
+                case MathExprOpCode_Equal:
+                    bOK = EvalMathOperator(OutputQueue, nDepth, [](double A, double B){return static_cast<double>(A == B);});
+                    break;
+                case MathExprOpCode_NotEqual:
+                    bOK = EvalMathOperator(OutputQueue, nDepth, [](double A, double B){return static_cast<double>(A != B);});
+                    break;
+                case MathExprOpCode_And:
+                    bOK = EvalMathOperator(OutputQueue, nDepth, [](double A, double B){return static_cast<double>((A != 0) & (B != 0));});
+                    break;
+                case MathExprOpCode_Or:
+                    bOK = EvalMathOperator(OutputQueue, nDepth, [](double A, double B){return static_cast<double>((A != 0) | (B != 0));});
+                    break;
+                default:
+                    break;
+            }
+            
+            if(!bOK)
                 return false;
         }
         else if(nodetype == MathExprNodeType_Sign)
         {
-            if(!OutputQueue.size())
+            if(!nDepth)
                 return false;
-            if(nodes[i].repr == "-")
+            if(op.code == MathExprOpCode_Minus)
             {
-                vector<double>& values = OutputQueue.back();
+                vector<double>& values = OutputQueue[nDepth - 1];
                 for(size_t j = 0; j < values.size(); j++)
                     values[j] = -values[j];
             }
-            else if(nodes[i].repr != "+")
+            else if(op.code == MathExprOpCode_Not)
+            {
+                vector<double>& values = OutputQueue[nDepth - 1];
+                for(size_t j = 0; j < values.size(); j++)
+                    values[j] = static_cast<double>(values[j] == 0);
+            }
+            else if(op.code != MathExprOpCode_Plus)
                 return false;
         }
     }
     
     
-    if(OutputQueue.size() != 1)
+    if(nDepth != 1 || OutputQueue[0].empty())
         return false;
     
-    results = OutputQueue[0];
+    result.p = OutputQueue[0].data();
+    result.n = OutputQueue[0].size();
     
     return true;
 }
-void MathExpression::initialize_f1()
-{
-    m_f1["acos"] = acos;
-    m_f1["asin"] = asin;
-    m_f1["atan"] = atan;
-    m_f1["cos"] = cos;
-    m_f1["cosh"] = cosh;
-    m_f1["exp"] = exp;
-    m_f1["abs"] = abs;
-    m_f1["log"] = log;
-    m_f1["log10"] = log10;
-    m_f1["ln"] = [](double _){ return log(_)/log(exp(1)); };
-    m_f1["sin"] = sin;
-    m_f1["sinh"] = sinh;
-    m_f1["tan"] = tan;
-    m_f1["tanh"] = tanh;
-    m_f1["sqrt"] = sqrt;
-#ifdef _MSC_VER
-    m_f1["j0"] = _j0;
-    m_f1["j1"] = _j1;
-    m_f1["y0"] = _y0;
-    m_f1["y1"] = _y1;
-#elif defined __GNUC__
-    m_f1["j0"] = j0;
-    m_f1["j1"] = j1;
-    m_f1["y0"] = y0;
-    m_f1["y1"] = y1;
-#endif
-}
-void MathExpression::initialize_f2()
-{
-    m_f2["atan2"] = atan2;
-}
-void MathExpression::initialize_constants()
+void MathExpressionProgram::initialize_constants()
 {
     map<string, double> constants;
     constants["pi"] = M_PI;
@@ -879,3 +4234,237 @@ void MathExpression::initialize_constants()
     BindSymbols(constants);
     return;
 }
+
+void MathExpressionContext::Bind(const char* lpcszSymbol, const double* p, size_t n)
+{
+    MathExprNodeEvalTaskBuffer buffer;
+    buffer.p = const_cast<double*>(p);
+    buffer.n = n;
+    m_bindings[lpcszSymbol] = buffer;
+    m_validity.erase(lpcszSymbol);
+    m_converted.erase(lpcszSymbol);
+}
+void MathExpressionContext::Unbind(const char* lpcszSymbol)
+{
+    m_bindings.erase(lpcszSymbol);
+    m_validity.erase(lpcszSymbol);
+    m_converted.erase(lpcszSymbol);
+}
+bool MathExpressionContext::BindArrow(const char* lpcszSymbol, const struct ArrowSchema* pSchema, const struct ArrowArray* pArray)
+{
+    return BindArrowColumn(lpcszSymbol, pSchema, pArray, NULL);
+}
+bool MathExpressionContext::BindArrow(const struct ArrowSchema* pSchema, const struct ArrowArray* pArray)
+{
+    // a record batch: the offset and length of the struct apply to its fields, nulls of rows
+    // would need a bitmap of their own and are not supported
+    if(!pSchema || !pArray || !pSchema->format || !pArray->release || pArray->length < 0 || pArray->offset < 0)
+    {
+        m_error = "Invalid Arrow Array.";
+        return false;
+    }
+    if(strcmp(pSchema->format, "+s") || pArray->null_count || pSchema->n_children != pArray->n_children)
+    {
+        m_error = "Unsupported Arrow Type.";
+        return false;
+    }
+    for(int64_t i = 0; i < pSchema->n_children; i++)
+    {
+        const char* lpcszName = pSchema->children[i]->name;
+        if(!lpcszName || !*lpcszName)
+        {
+            m_error = "Invalid Arrow Array.";
+            return false;
+        }
+        if(!BindArrowColumn(lpcszName, pSchema->children[i], pArray->children[i], pArray))
+            return false;
+    }
+    return true;
+}
+bool MathExpressionContext::BindArrowColumn(const char* lpcszSymbol, const struct ArrowSchema* pSchema, const struct ArrowArray* pArray, const struct ArrowArray* pParent)
+{
+    if(!pSchema || !pArray || !pSchema->format || !pArray->release || pArray->length < 0 || pArray->offset < 0)
+    {
+        m_error = "Invalid Arrow Array.";
+        return false;
+    }
+    bool bDouble = !strcmp(pSchema->format, "g");
+    if((!bDouble && strcmp(pSchema->format, "f")) || pSchema->dictionary || pArray->n_buffers != 2)
+    {
+        m_error = "Unsupported Arrow Type.";
+        return false;
+    }
+    const void* pData = pArray->buffers[1];
+    size_t nOffset = static_cast<size_t>(pArray->offset + (pParent ? pParent->offset : 0));
+    size_t n = static_cast<size_t>(pParent ? pParent->length : pArray->length);
+    if((!pData && n) || (pParent && pParent->offset + pParent->length > pArray->length))
+    {
+        m_error = "Invalid Arrow Array.";
+        return false;
+    }
+    
+    // float64 is used in place, float32 is widened into a column the context owns
+    if(bDouble)
+        Bind(lpcszSymbol, static_cast<const double*>(pData) + nOffset, n);
+    else
+    {
+        const float* pFloat = static_cast<const float*>(pData) + nOffset;
+        vector<double> column(pFloat, pFloat + n);
+        Bind(lpcszSymbol, column.data(), n);
+        m_converted[lpcszSymbol].swap(column);
+    }
+    if(pArray->null_count != 0 && pArray->buffers[0])
+    {
+        MathExprValidity validity;
+        validity.bits = static_cast<const unsigned char*>(pArray->buffers[0]);
+        validity.offset = nOffset;
+        m_validity[lpcszSymbol] = validity;
+    }
+    return true;
+}
+MathExpressionContext::MathExpressionContext()
+{
+    memset(&m_memory, 0, sizeof(m_memory));
+    memset(&m_plan, 0, sizeof(m_plan));
+    m_seed = 0;
+}
+void MathExpressionContext::SetSeed(unsigned long long nSeed)
+{
+    m_seed = nSeed;
+}
+void MathExpressionContext::SetMemoryBudget(size_t nBytes)
+{
+    m_memory.budget = nBytes;
+}
+MathExprPlan MathExpressionContext::Plan() const
+{
+    return m_plan;
+}
+MathExprMemoryReport MathExpressionContext::Memory() const
+{
+    // buffers keep their capacity, what is held after a call is what it needed at most
+    MathExprMemoryReport report = m_memory;
+    report.peak = 0;
+    for(size_t i = 0; i < m_scratch.size(); i++)
+    {
+        const vector<vector<double> >* lists[] = {&m_scratch[i].stack, &m_scratch[i].gathered, &m_scratch[i].locals};
+        for(size_t j = 0; j < sizeof(lists)/sizeof(lists[0]); j++)
+        {
+            for(size_t k = 0; k < lists[j]->size(); k++)
+                report.peak += (*lists[j])[k].capacity() * sizeof(double);
+        }
+    }
+    return report;
+}
+const string& MathExpressionContext::Error() const
+{
+    return m_error;
+}
+
+MathExpression::MathExpression(const char* lpcszExpr) : m_program(new MathExpressionProgram(lpcszExpr))
+{
+    m_error = m_program->Error();
+}
+void MathExpression::Symbols(set<string>& symbols)
+{
+    m_program->Symbols(symbols);
+}
+void MathExpression::Functions(set<string>& functions)
+{
+    m_program->Functions(functions);
+}
+void MathExpression::BindSymbols(const map<string, double>& symbols)
+{
+    MutableProgram()->BindSymbols(symbols);
+}
+bool MathExpression::Evaluate(vector<double>& results, const map<string, vector<double> >& symbols)
+{
+    if(m_program->Evaluate(results, symbols, m_context))
+        return true;
+    m_error = m_context.Error();
+    return false;
+}
+bool MathExpression::Evaluate(vector<double>& results, vector<size_t>& shape, const map<string, MathExprShapedBuffer>& symbols)
+{
+    if(m_program->Evaluate(results, shape, symbols, m_context))
+        return true;
+    m_error = m_context.Error();
+    return false;
+}
+bool MathExpression::Evaluate(const vector<MathExpressionSink*>& sinks, const map<string, vector<double> >& symbols)
+{
+    if(m_program->Evaluate(sinks, symbols, m_context))
+        return true;
+    m_error = m_context.Error();
+    return false;
+}
+bool MathExpression::EvaluateSweep(vector<double>& results, const map<string, vector<double> >& symbols, const vector<string>& parameters, const vector<double>& values)
+{
+    if(m_program->EvaluateSweep(results, symbols, parameters, values, m_context))
+        return true;
+    m_error = m_context.Error();
+    return false;
+}
+bool MathExpression::EvaluateAt(vector<double>& results, const vector<size_t>& rows, const map<string, vector<double> >& symbols)
+{
+    if(m_program->EvaluateAt(results, rows, symbols, m_context))
+        return true;
+    m_error = m_context.Error();
+    return false;
+}
+bool MathExpression::EvaluateMasked(vector<double>& results, const vector<unsigned long long>& mask, const map<string, vector<double> >& symbols)
+{
+    if(m_program->EvaluateMasked(results, mask, symbols, m_context))
+        return true;
+    m_error = m_context.Error();
+    return false;
+}
+bool MathExpression::Sample(vector<double>& x, vector<double>& y, const char* lpcszSymbol, double a, double b, double tolerance, const map<string, double>& parameters, size_t nMaxPoints)
+{
+    if(m_program->Sample(x, y, lpcszSymbol, a, b, tolerance, parameters, m_context, nMaxPoints))
+        return true;
+    m_error = m_context.Error();
+    return false;
+}
+void MathExpression::Outputs(vector<string>& outputs)
+{
+    m_program->Outputs(outputs);
+}
+bool MathExpression::EvaluateOutputs(map<string, vector<double> >& outputs, const map<string, vector<double> >& symbols)
+{
+    if(m_program->EvaluateOutputs(outputs, symbols, m_context))
+        return true;
+    m_error = m_context.Error();
+    return false;
+}
+bool MathExpression::Explain(string& text, size_t nRows)
+{
+    if(m_program->Explain(text, nRows, m_context))
+        return true;
+    m_error = m_context.Error();
+    return false;
+}
+shared_ptr<MathExpressionJob> MathExpression::EvaluateAsync(map<string, vector<double> > symbols, MathExprCompletion completion)
+{
+    return MathExpressionProgram::EvaluateAsync(m_program, std::move(symbols), completion);
+}
+bool MathExpression::RegisterFunction(const char* lpcszName, MathFunction_n f, size_t nArity, bool bPure)
+{
+    return MutableProgram()->RegisterFunction(lpcszName, f, nArity, bPure, m_error);
+}
+shared_ptr<const MathExpressionProgram> MathExpression::Program() const
+{
+    return m_program;
+}
+size_t MathExpression::MemoryUsage() const
+{
+    // a program shared with other owners is counted in full
+    return sizeof(*this) + m_program->MemoryUsage();
+}
+MathExpressionProgram* MathExpression::MutableProgram()
+{
+    // programs handed out by Program() are never modified, changes go to a private copy
+    if(m_program.use_count() > 1)
+        m_program.reset(new MathExpressionProgram(*m_program));
+    return m_program.get();
+}
@@ -5,6 +5,16 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <memory>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <cstdint>
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <string_view>
+#define MATH_EXPRESSION_HAS_STRING_VIEW
+#endif
 
 using namespace std;
 
@@ -16,6 +26,8 @@ typedef enum {
     MathExprNodeType_Expression   = 4,
     MathExprNodeType_Sign         = 5,
     MathExprNodeType_Separator    = 6,
+    MathExprNodeType_Local        = 7,    // a variable assigned by an earlier statement
+    MathExprNodeType_Assignment   = 8,    // pops the value of a statement into a variable
     
     MathExprNodeTypeCount
 } MathExprNodeType;
@@ -23,6 +35,7 @@ typedef enum {
 typedef struct MathExpressionNode
 {
     MathExprNodeType type;
+    size_t nargs;   // number of arguments of a function
     string repr;
     vector<double> values;
     vector<MathExpressionNode> children;
@@ -35,49 +48,490 @@ typedef struct MathExprNodeEvalTaskBuffer
     size_t n;
 } MathExprNodeEvalTaskBuffer;
 
+typedef struct MathExprReductionPartial
+{
+    double value;
+    double count;
+} MathExprReductionPartial;
+
+typedef struct MathExprShapedBuffer
+{
+    const double* p;
+    vector<size_t> shape;   // row-major, broadcast like NumPy
+} MathExprShapedBuffer;
+
 typedef double (*MathFunction_1)(double);
 typedef double (*MathFunction_2)(double, double);
-typedef double (*MathFunction_n)(double*, size_t);
+// results: n values; args: nargs operands, each holding n values or a single value
+typedef bool (*MathFunction_n)(double* results, size_t n, const MathExprNodeEvalTaskBuffer* args, size_t nargs);
+
+typedef struct MathExprUserFunction
+{
+    MathFunction_n f;
+    size_t arity;
+    bool pure;      // pure functions with constant arguments are folded
+} MathExprUserFunction;
+
+// Compiled node: 8 bytes, names and values are referenced by index.
+typedef struct MathExprOp
+{
+    unsigned char type;     // MathExprNodeType
+    unsigned char code;     // operator of an operator or sign, kind of a function call
+    unsigned short nargs;   // number of arguments of a function
+    unsigned int index;     // constant, symbol slot, built-in, reduction or user function
+} MathExprOp;
+
+typedef struct MathExprCode
+{
+    vector<MathExprOp> ops;     // RPN
+    vector<double> constants;
+} MathExprCode;
+
+typedef struct MathExprCodeView
+{
+    const MathExprOp* ops;
+    size_t nops;
+    const double* constants;
+    size_t nconstants;
+} MathExprCodeView;
+
+typedef struct MathExprScratch
+{
+    vector<vector<double> > stack;     // operand stack, reused across segments
+    vector<vector<double> > gathered;  // selected rows of each column, then the results
+    vector<vector<double> > locals;    // variables of a multi-statement program
+    vector<MathExprNodeEvalTaskBuffer> args;    // operands of a function call
+    vector<MathExprNodeEvalTaskBuffer> slots;   // bindings of a broadcast tile
+    
+    // segment being evaluated, the random functions draw value i for row + i, or rows[i]
+    unsigned long long seed;
+    size_t row;
+    const size_t* rows;
+    size_t n;
+} MathExprScratch;
+
+// Temporary memory of the last call on a context. Each thread holds a few segment-sized
+// buffers, at most the stack depth plus one plus the variables, the results not counted.
+typedef struct MathExprMemoryReport
+{
+    size_t budget;      // bytes, 0 for no limit
+    size_t estimate;    // worst case of the plan
+    size_t peak;        // bytes held by the scratch space after the call
+    size_t segment;     // rows per segment
+    size_t threads;
+} MathExprMemoryReport;
+
+// Execution plan of a call, chosen from the estimated cost of the program and the rows.
+typedef struct MathExprPlan
+{
+    size_t rows;
+    double cost;        // estimated nanoseconds per row, from costs measured at startup
+    size_t threads;     // 1 runs on the calling thread, without a parallel region
+    size_t segment;     // rows per segment
+    size_t bytes;       // temporary memory, see MathExprMemoryReport
+} MathExprPlan;
 
+// Shared with a running evaluation: segments done so far, out of total, and cancellation.
+// Every reduction is a pass over the segments of its own, so it adds to the total.
+typedef struct MathExprProgress
+{
+    atomic<size_t> done;
+    atomic<size_t> total;
+    atomic<bool> cancelled;    // segments not started yet are skipped
+} MathExprProgress;
+
+#ifdef MATH_EXPRESSION_HAS_STRING_VIEW
+typedef struct MathExprNames
+{
+    bool valid;                     // tokens and parentheses only, the order is not checked
+    vector<string_view> symbols;    // views into the scanned expression, each name once
+    vector<string_view> functions;
+} MathExprNames;
+#endif
+
+// Arrow C Data Interface, as defined by the Arrow specification. The guard lets this header
+// be included together with Arrow's own or any other copy of the definition.
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    // Array type description
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+    
+    // Release callback
+    void (*release)(struct ArrowSchema*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+struct ArrowArray {
+    // Array data description
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+    
+    // Release callback
+    void (*release)(struct ArrowArray*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+// Validity bitmap of a bound column, bit (offset + i) is set where row i is not null.
+typedef struct MathExprValidity
+{
+    const unsigned char* bits;
+    size_t offset;
+} MathExprValidity;
+
+// The generator of rand() and randn(), Philox4x32-10, on one counter in place. A draw of
+// rand() is counter {row, row >> 32, stream, 0} under key {seed, seed >> 32}, of which the
+// first two words give 22 + 31 bits of the value.
+void MathExprPhilox4x32(uint32_t counter[4], const uint32_t key[2]);
 
 // #pragma GCC visibility push(hidden)
 
-class MathExpression
+class MathExpressionProgram;
+class MathExpressionJob;
+
+// called on a scheduler thread when the job has completed, evaluated or not
+typedef function<void(const MathExpressionJob&)> MathExprCompletion;
+
+// Per-call state: bindings, scratch space and the last error. A context must not be
+// used by two calls at the same time, a program can be shared by any number of them.
+class MathExpressionContext
 {
 public:
-    MathExpression(const char* lpcszExpr);
-    void Symbols(set<string>& symbols);
-    void Functions(set<string>& functions);
+    void Bind(const char* lpcszSymbol, const double* p, size_t n);
+    void Unbind(const char* lpcszSymbol);
+    const string& Error() const;
+    
+    // Arrow float64 columns are bound in place, float32 ones are converted. Nulls in the
+    // validity bitmaps are carried to the results of EvaluateArrow(). A struct array binds
+    // each of its fields by name. The arrays are not released and must outlive the calls.
+    bool BindArrow(const char* lpcszSymbol, const struct ArrowSchema* pSchema, const struct ArrowArray* pArray);
+    bool BindArrow(const struct ArrowSchema* pSchema, const struct ArrowArray* pArray);
+    
+    // Segment size and threads are chosen so that the temporary memory of a call stays
+    // within the budget, a call fails if not even one thread fits with small segments.
+    MathExpressionContext();
+    void SetMemoryBudget(size_t nBytes);
+    MathExprMemoryReport Memory() const;
+    MathExprPlan Plan() const;      // of the last call
+    
+    // rand() and randn() are a function of the seed, the row and the call, never of the
+    // threads or segments, so the same seed gives the same draws on any plan. 0 by default.
+    void SetSeed(unsigned long long nSeed);
+    
+protected:
+    friend class MathExpressionProgram;
+    bool BindArrowColumn(const char* lpcszSymbol, const struct ArrowSchema* pSchema, const struct ArrowArray* pArray, const struct ArrowArray* pParent);
+    map<string, MathExprNodeEvalTaskBuffer> m_bindings;
+    map<string, MathExprValidity> m_validity;   // bound columns that have nulls
+    map<string, vector<double> > m_converted;   // bound columns that are not float64
+    vector<MathExprScratch> m_scratch;     // one per thread
+    string m_error;
+    MathExprMemoryReport m_memory;
+    MathExprPlan m_plan;
+    unsigned long long m_seed;
+};
+
+// Asynchronous evaluation, queued on the scheduler of the library. The job keeps its program
+// alive, and its own columns if it was given any. Results and Error are final once Done.
+class MathExpressionJob
+{
+public:
+    bool Wait() const;      // true when evaluated
+    bool Done() const;
+    void Cancel();
+    double Progress() const;
+    shared_future<bool> Future() const;
+    const vector<double>& Results() const;
+    const string& Error() const;
+    
+protected:
+    friend class MathExpressionProgram;
+    MathExpressionJob();
+    shared_ptr<const MathExpressionProgram> m_program;
+    map<string, vector<double> > m_symbols;
+    map<string, MathExprNodeEvalTaskBuffer> m_bindings;
+    MathExpressionContext m_context;
+    MathExprCompletion m_completion;
+    MathExprProgress m_progress;
+    vector<double> m_results;
+    promise<bool> m_promise;
+    shared_future<bool> m_future;
+    atomic<bool> m_done;
+};
+
+// Consumer of results, fed segment by segment while they are still in cache, so that a
+// histogram or a statistic never needs the full results. Each thread feeds a clone of its
+// own, the clones are merged into the sink in thread order once the whole call succeeded.
+// Sinks accumulate across calls, rows are counted from 0 in each call.
+class MathExpressionSink
+{
+public:
+    virtual ~MathExpressionSink() {}
+    virtual shared_ptr<MathExpressionSink> Clone() const = 0;   // empty, same parameters
+    virtual void Consume(const double* values, size_t nOffset, size_t n) = 0;  // rows nOffset..
+    virtual void Merge(const MathExpressionSink& other) = 0;    // a clone of this sink
+};
+
+// n equal bins over [lo, hi], hi falls in the last bin. NaN and out of range values are counted apart.
+class MathExpressionHistogramSink : public MathExpressionSink
+{
+public:
+    MathExpressionHistogramSink(double lo, double hi, size_t nBins);
+    shared_ptr<MathExpressionSink> Clone() const;
+    void Consume(const double* values, size_t nOffset, size_t n);
+    void Merge(const MathExpressionSink& other);
+    const vector<size_t>& Counts() const;
+    size_t Below() const;
+    size_t Above() const;
+    size_t NaN() const;
+    double Quantile(double q) const;    // interpolated within a bin, NaN if empty
+    
+protected:
+    double m_lo;
+    double m_hi;
+    vector<size_t> m_counts;
+    size_t m_nBelow;
+    size_t m_nAbove;
+    size_t m_nNaN;
+};
+
+// Count, mean, variance, min and max of the values that are not NaN. Each segment is summed
+// in two passes and combined with the running state by the pairwise update of Chan et al.
+class MathExpressionStatisticsSink : public MathExpressionSink
+{
+public:
+    MathExpressionStatisticsSink();
+    shared_ptr<MathExpressionSink> Clone() const;
+    void Consume(const double* values, size_t nOffset, size_t n);
+    void Merge(const MathExpressionSink& other);
+    size_t Count() const;
+    double Mean() const;
+    double Variance() const;    // sample variance, NaN below 2 values
+    double Min() const;
+    double Max() const;
+    
+protected:
+    void Combine(size_t n, double mean, double m2, double fMin, double fMax);
+    size_t m_n;
+    double m_mean;
+    double m_m2;    // sum of squared deviations from the mean
+    double m_min;
+    double m_max;
+};
+
+// The k largest values and their rows, NaN skipped. Top() is sorted by value, then by row.
+class MathExpressionTopKSink : public MathExpressionSink
+{
+public:
+    MathExpressionTopKSink(size_t k);
+    shared_ptr<MathExpressionSink> Clone() const;
+    void Consume(const double* values, size_t nOffset, size_t n);
+    void Merge(const MathExpressionSink& other);
+    vector<pair<double, size_t> > Top() const;
+    
+protected:
+    void Push(double value, size_t nRow);
+    size_t m_k;
+    vector<pair<double, size_t> > m_heap;   // at most k entries, the one to evict on top
+};
+
+// Rows whose value is greater than the threshold, in increasing order.
+class MathExpressionThresholdSink : public MathExpressionSink
+{
+public:
+    MathExpressionThresholdSink(double threshold);
+    shared_ptr<MathExpressionSink> Clone() const;
+    void Consume(const double* values, size_t nOffset, size_t n);
+    void Merge(const MathExpressionSink& other);
+    const vector<size_t>& Rows() const;
+    
+protected:
+    double m_threshold;
+    vector<size_t> m_rows;
+};
+
+// Compiled expression. All evaluation is const, so one instance can be shared through
+// shared_ptr<const MathExpressionProgram> and evaluated from many threads at once.
+class MathExpressionProgram
+{
+public:
+    MathExpressionProgram(const char* lpcszExpr);
+    const string& Error() const;
+    void Symbols(set<string>& symbols) const;
+    void Functions(set<string>& functions) const;
+    bool Evaluate(vector<double>& results, MathExpressionContext& context) const;
+    // in place: n must be the number of rows, a single value is broadcast to all of them
+    bool Evaluate(double* results, size_t n, MathExpressionContext& context) const;
+    bool Evaluate(vector<double>& results, const map<string, vector<double> >& symbols, MathExpressionContext& context) const;
+    bool Evaluate(vector<double>& results, vector<size_t>& shape, const map<string, MathExprShapedBuffer>& symbols, MathExpressionContext& context) const;
+    bool EvaluateSweep(vector<double>& results, const map<string, vector<double> >& symbols, const vector<string>& parameters, const vector<double>& values, MathExpressionContext& context) const;
+    // results go to the sinks only, see MathExpressionSink, a constant result is one value
+    bool Evaluate(const vector<MathExpressionSink*>& sinks, MathExpressionContext& context) const;
+    bool Evaluate(const vector<MathExpressionSink*>& sinks, const map<string, vector<double> >& symbols, MathExpressionContext& context) const;
+    
+    // Selected rows only, their operands are gathered segment by segment. Compact: results[k]
+    // is the value at rows[k]. Scattered: results[rows[k]] is written, other rows are untouched.
+    bool EvaluateAt(double* results, const size_t* rows, size_t nRows, bool bScatter, MathExpressionContext& context) const;
+    bool EvaluateAt(vector<double>& results, const vector<size_t>& rows, const map<string, vector<double> >& symbols, MathExpressionContext& context) const;
+    // rows whose bit i % 64 of mask[i / 64] is set, results are compact in row order
+    bool EvaluateMasked(vector<double>& results, const vector<unsigned long long>& mask, const map<string, vector<double> >& symbols, MathExpressionContext& context) const;
+    
+    // Adaptive sampling of a function of one symbol over [a, b], other symbols are bound to
+    // single values. Intervals are split where the midpoint is off the chord by more than
+    // the tolerance or where the values turn infinite or NaN. x is sorted, y = f(x).
+    bool Sample(vector<double>& x, vector<double>& y, const char* lpcszSymbol, double a, double b, double tolerance, const map<string, double>& parameters, MathExpressionContext& context, size_t nMaxPoints = 100000) const;
+    
+    // Multi-statement programs, e.g. "r = sqrt(x*x + y*y); r * sin(r)": the assigned variables,
+    // in order of first assignment, and all of their values from one pass over the rows.
+    void Outputs(vector<string>& outputs) const;
+    bool EvaluateOutputs(map<string, vector<double> >& outputs, const map<string, vector<double> >& symbols, MathExpressionContext& context) const;
+    
+    // Results as a nullable float64 Arrow array that the caller owns and releases, a row
+    // is null where any column it reads is null. Reductions are not supported with nulls.
+    bool EvaluateArrow(struct ArrowArray* pArray, struct ArrowSchema* pSchema, MathExpressionContext& context) const;
+    
+    // Queued on a process-wide scheduler that runs at most SetAsyncConcurrency() evaluations
+    // at a time, each one split into segments as usual. The bindings of a context are copied,
+    // their columns must stay valid until the job is done, columns passed by value are moved.
+    static shared_ptr<MathExpressionJob> EvaluateAsync(const shared_ptr<const MathExpressionProgram>& program, const MathExpressionContext& context, MathExprCompletion completion = MathExprCompletion());
+    static shared_ptr<MathExpressionJob> EvaluateAsync(const shared_ptr<const MathExpressionProgram>& program, map<string, vector<double> > symbols, MathExprCompletion completion = MathExprCompletion());
+    static void SetAsyncConcurrency(size_t nConcurrency);    // 2 by default
+    
     void BindSymbols(const map<string, double>& symbols);
-    bool Evaluate(vector<double>& results, const map<string, vector<double> >& symbols);
+    // a failure is reported in error, Error() stays the compile error of the program
+    bool RegisterFunction(const char* lpcszName, MathFunction_n f, size_t nArity, bool bPure, string& error);
+    size_t MemoryUsage() const;     // bytes owned by this program
+    size_t MaxStackDepth() const;   // operands alive at once, from the code
+    // the plan Evaluate() would pick for nRows rows on this context, and its cost per op
+    bool Explain(string& text, size_t nRows, MathExpressionContext& context) const;
+    
+    // Binary format: versioned, position independent, the code of a loaded program is
+    // used in place from the mapped file, which stays mapped while any program uses it.
+    static bool Save(const char* lpcszPath, const vector<shared_ptr<const MathExpressionProgram> >& programs, string& error);
+    static bool Save(vector<char>& buffer, const vector<shared_ptr<const MathExpressionProgram> >& programs, string& error);
+    static bool Load(const char* lpcszPath, vector<shared_ptr<const MathExpressionProgram> >& programs, string& error);
+    static bool Load(const shared_ptr<const void>& storage, size_t nSize, vector<shared_ptr<const MathExpressionProgram> >& programs, string& error);
+    
+    // one program per expression, built in parallel, false if any has an Error()
+    static bool Compile(const vector<string>& exprs, vector<shared_ptr<const MathExpressionProgram> >& programs);
+    
+#ifdef MATH_EXPRESSION_HAS_STRING_VIEW
+    // lexer only: symbols and functions without compiling, names are views into expr
+    static bool Scan(string_view expr, MathExprNames& names);
+    static bool Scan(const vector<string_view>& exprs, vector<MathExprNames>& names);
+#endif
     
 protected:
+    MathExpressionProgram();
+    MathExprCodeView Code() const;
     bool IsBalanced(const char* lpcszExpr);
-    bool IsValidForNumberBeginning(char chr);
-    bool IsValidForName(char chr, bool bFirst);
+    static bool IsValidForNumberBeginning(char chr);
+    static bool IsValidForName(char chr, bool bFirst);
     bool IsValidOperator(char chr);
-    bool IsValidWhiteSpace(char chr);
+    bool IsValidOperator(const char* lpcszExpr, size_t& nLength);
+    static bool IsValidWhiteSpace(char chr);
     bool IsOperatorWithGreaterPrecedence(const string& A, const string& B);
     bool GetSubExpressionLength(const char* lpcszExpr, size_t& nExprSubLength);
+    static void GetStatements(const char* lpcszExpr, vector<string>& statements);
+    static bool GetAssignment(const string& statement, string& target, size_t& nExprOffset);
     bool GetTokens(const char* lpcszExpr, vector<MathExpressionNode>& nodes, string& error);
     bool ValidatePreviousNext(const vector<MathExpressionNode>& nodes, size_t offset, const MathExprNodeType* pValidPrevious, size_t nValidPrevious, const MathExprNodeType* pValidNext, size_t nValidNext);
     bool Validate(const vector<MathExpressionNode>& nodes);
     bool ShuntingYard(vector<MathExpressionNode>& results, const vector<MathExpressionNode>& nodes, string& error);
-    size_t GetSegmentSize();
-    bool EvaluateEx(vector<double>& results, map<string, MathExprNodeEvalTaskBuffer>& bindings, const vector<MathExpressionNode>& nodes);
+    bool IsPureFunction(const string& repr) const;
+    bool Compact(const vector<MathExpressionNode>& nodes, MathExprCode& code);
+    void Expand(vector<MathExpressionNode>& nodes) const;
+    bool FindSymbol(const string& name, size_t& slot) const;
+    void Optimize(vector<MathExpressionNode>& nodes);
+    bool GetMonomial(const vector<MathExpressionNode>& nodes, size_t end, string& symbol, double& coefficient, size_t& degree) const;
+    bool GetPolynomialTerms(const vector<MathExpressionNode>& nodes, size_t end, double sign, string& symbol, vector<double>& coefficients) const;
+    void LowerPolynomials(vector<MathExpressionNode>& nodes);
+    bool FindReduction(const MathExprOp* ops, size_t nOps, size_t& offset) const;
+    bool GetOperandStart(const vector<MathExpressionNode>& nodes, size_t end, size_t& start) const;
+    bool GetOperandStart(const vector<MathExprOp>& ops, size_t end, size_t& start) const;
+    bool ReduceEx(MathExprReductionPartial& partial, const string& repr, size_t n, const MathExprNodeEvalTaskBuffer* slots, const MathExprOp* ops, size_t nOps, const double* constants, MathExprScratch& scratch) const;
+    double ReducePartials(const string& repr, const MathExprReductionPartial* partials, size_t n) const;
+    size_t GetSegmentSize() const;
+    size_t GetSweepSegmentSize(size_t nColumns) const;
+    double GetRowCost() const;
+    bool PlanEvaluation(const MathExpressionContext& context, size_t nRows, size_t nGathered, size_t nMaxSegmentSize, MathExprPlan& plan, string& error) const;
+    bool PlanMemory(MathExpressionContext& context, size_t nRows, size_t nGathered, size_t& nSegmentSize, size_t& nThreads) const;
+    bool EvaluateBindings(vector<double>& results, const map<string, MathExprNodeEvalTaskBuffer>& bindings, MathExpressionContext& context, vector<vector<double> >* pOutputs = NULL, MathExprProgress* pProgress = NULL, const MathExprNodeEvalTaskBuffer* pTarget = NULL, const vector<MathExpressionSink*>* pSinks = NULL) const;
+    bool EvaluateBindingsAt(double* results, const size_t* rows, size_t nRows, bool bScatter, const map<string, MathExprNodeEvalTaskBuffer>& bindings, MathExpressionContext& context) const;
+    static void Schedule(const shared_ptr<MathExpressionJob>& job);
+    static void Run(MathExpressionJob& job);
+    bool EvaluateEx(double* results, size_t n, const MathExprNodeEvalTaskBuffer* slots, const MathExprOp* ops, size_t nOps, const double* constants, MathExprScratch& scratch) const;
+    bool EvaluateEx(MathExprNodeEvalTaskBuffer& result, const MathExprNodeEvalTaskBuffer* slots, const MathExprOp* ops, size_t nOps, const double* constants, MathExprScratch& scratch) const;
 private:
-    void initialize_f1();
-    void initialize_f2();
     void initialize_constants();
 private:
+    // Names are interned process-wide and function tables are shared by all programs,
+    // a program only owns its code and small index tables.
     string m_error;
-    string m_expr;
-    map<string, MathFunction_1> m_f1;
-    map<string, MathFunction_2> m_f2;
-    vector<MathExpressionNode> m_nodes;
+    MathExprCode m_code;
+    vector<const string*> m_slots;      // symbols, indexed by MathExprOp::index
+    vector<const string*> m_calls;      // user functions, indexed by MathExprOp::index
+    vector<MathExprUserFunction> m_fn;  // parallel to m_calls, f is NULL until registered
+    vector<const string*> m_symbols;
+    vector<const string*> m_functions;
+    vector<const string*> m_locals;     // variables, indexed by MathExprOp::index
+    shared_ptr<const void> m_storage;   // a loaded file, m_mapped points into it
+    MathExprCodeView m_mapped;
     
 };
 
+class MathExpression
+{
+public:
+    MathExpression(const char* lpcszExpr);
+    void Symbols(set<string>& symbols);
+    void Functions(set<string>& functions);
+    void BindSymbols(const map<string, double>& symbols);
+    bool Evaluate(vector<double>& results, const map<string, vector<double> >& symbols);
+    bool Evaluate(vector<double>& results, vector<size_t>& shape, const map<string, MathExprShapedBuffer>& symbols);
+    bool Evaluate(const vector<MathExpressionSink*>& sinks, const map<string, vector<double> >& symbols);
+    // parameters: P names; values: K x P row-major; results: K x N row-major
+    bool EvaluateSweep(vector<double>& results, const map<string, vector<double> >& symbols, const vector<string>& parameters, const vector<double>& values);
+    bool EvaluateAt(vector<double>& results, const vector<size_t>& rows, const map<string, vector<double> >& symbols);
+    bool EvaluateMasked(vector<double>& results, const vector<unsigned long long>& mask, const map<string, vector<double> >& symbols);
+    void Outputs(vector<string>& outputs);
+    bool EvaluateOutputs(map<string, vector<double> >& outputs, const map<string, vector<double> >& symbols);
+    bool Explain(string& text, size_t nRows);
+    bool Sample(vector<double>& x, vector<double>& y, const char* lpcszSymbol, double a, double b, double tolerance, const map<string, double>& parameters = map<string, double>(), size_t nMaxPoints = 100000);
+    shared_ptr<MathExpressionJob> EvaluateAsync(map<string, vector<double> > symbols, MathExprCompletion completion = MathExprCompletion());
+    bool RegisterFunction(const char* lpcszName, MathFunction_n f, size_t nArity = 1, bool bPure = true);
+    shared_ptr<const MathExpressionProgram> Program() const;
+    size_t MemoryUsage() const;
+    
+private:
+    MathExpressionProgram* MutableProgram();
+private:
+    string m_error;
+    shared_ptr<MathExpressionProgram> m_program;
+    MathExpressionContext m_context;
+};
+
 // #pragma GCC visibility pop
 
 
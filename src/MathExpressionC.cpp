@@ -0,0 +1,218 @@
+#include <cstring>
+#include <new>
+#include <algorithm>
+#include "MathExpression.h"
+#include "MathExpressionC.h"
+
+using namespace std;
+
+// Handles own shared pointers, so a context keeps its program and symbol table alive.
+struct MathExprCProgram
+{
+    shared_ptr<const MathExpressionProgram> program;
+    shared_ptr<const vector<string> > symbols;     // sorted, indexed by slot
+};
+
+struct MathExprCContext
+{
+    shared_ptr<const MathExpressionProgram> program;
+    shared_ptr<const vector<string> > symbols;
+    vector<size_t> lengths;     // of the bound columns, 0 while unbound
+    MathExpressionContext context;
+    string error;
+};
+
+// the constants MathExpressionProgram::initialize_constants() knows, bound in every context
+static const double __MathExpressionC_pi__ = 3.14159265358979323846;
+static const struct {
+    const char* name;
+    const double* value;
+} __MathExpressionC_constants__[] = {{"pi", &__MathExpressionC_pi__}, {"PI", &__MathExpressionC_pi__}};
+
+static void CopyError(const string& error, char* lpszError, size_t nErrorSize)
+{
+    if(!lpszError || !nErrorSize)
+        return;
+    size_t nLength = std::min(error.size(), nErrorSize - 1);
+    memcpy(lpszError, error.c_str(), nLength);
+    lpszError[nLength] = '\0';
+}
+
+int MathExprApiVersion(void)
+{
+    return MATH_EXPRESSION_C_API_VERSION;
+}
+int MathExprCompile(const char* lpcszExpr, MathExprProgramHandle* phProgram, char* lpszError, size_t nErrorSize)
+{
+    if(!lpcszExpr || !phProgram)
+        return MathExprStatus_InvalidArgument;
+    *phProgram = NULL;
+    try
+    {
+        shared_ptr<const MathExpressionProgram> program(new MathExpressionProgram(lpcszExpr));
+        if(!program->Error().empty())
+        {
+            CopyError(program->Error(), lpszError, nErrorSize);
+            return MathExprStatus_CompileError;
+        }
+        set<string> names;
+        program->Symbols(names);
+        
+        unique_ptr<MathExprCProgram> handle(new MathExprCProgram);
+        handle->program = program;
+        handle->symbols.reset(new vector<string>(names.begin(), names.end()));
+        *phProgram = handle.release();
+        CopyError("", lpszError, nErrorSize);
+        return MathExprStatus_OK;
+    }
+    catch(const bad_alloc&)
+    {
+        return MathExprStatus_OutOfMemory;
+    }
+    catch(...)
+    {
+        return MathExprStatus_InternalError;
+    }
+}
+void MathExprProgramFree(MathExprProgramHandle hProgram)
+{
+    delete hProgram;
+}
+int MathExprSymbolCount(MathExprProgramHandle hProgram, size_t* pnSymbols)
+{
+    if(!hProgram || !pnSymbols)
+        return MathExprStatus_InvalidArgument;
+    *pnSymbols = hProgram->symbols->size();
+    return MathExprStatus_OK;
+}
+int MathExprSymbolName(MathExprProgramHandle hProgram, size_t nSlot, const char** plpcszName)
+{
+    if(!hProgram || !plpcszName || nSlot >= hProgram->symbols->size())
+        return MathExprStatus_InvalidArgument;
+    *plpcszName = (*hProgram->symbols)[nSlot].c_str();
+    return MathExprStatus_OK;
+}
+int MathExprSymbolSlot(MathExprProgramHandle hProgram, const char* lpcszName, size_t* pnSlot)
+{
+    if(!hProgram || !lpcszName || !pnSlot)
+        return MathExprStatus_InvalidArgument;
+    const vector<string>& symbols = *hProgram->symbols;
+    vector<string>::const_iterator it = std::lower_bound(symbols.begin(), symbols.end(), lpcszName);
+    if(it == symbols.end() || *it != lpcszName)
+        return MathExprStatus_UnknownSymbol;
+    *pnSlot = static_cast<size_t>(it - symbols.begin());
+    return MathExprStatus_OK;
+}
+int MathExprContextCreate(MathExprProgramHandle hProgram, MathExprContextHandle* phContext)
+{
+    if(!hProgram || !phContext)
+        return MathExprStatus_InvalidArgument;
+    *phContext = NULL;
+    try
+    {
+        unique_ptr<MathExprCContext> handle(new MathExprCContext);
+        handle->program = hProgram->program;
+        handle->symbols = hProgram->symbols;
+        handle->lengths.assign(hProgram->symbols->size(), 0);
+        
+        // only the symbols of the caller must be bound, binding a constant overrides it
+        const vector<string>& symbols = *hProgram->symbols;
+        for(size_t i = 0; i < symbols.size(); i++)
+        {
+            for(size_t j = 0; j < sizeof(__MathExpressionC_constants__)/sizeof(__MathExpressionC_constants__[0]); j++)
+            {
+                if(symbols[i] == __MathExpressionC_constants__[j].name)
+                {
+                    handle->context.Bind(symbols[i].c_str(), __MathExpressionC_constants__[j].value, 1);
+                    handle->lengths[i] = 1;
+                }
+            }
+        }
+        *phContext = handle.release();
+        return MathExprStatus_OK;
+    }
+    catch(const bad_alloc&)
+    {
+        return MathExprStatus_OutOfMemory;
+    }
+    catch(...)
+    {
+        return MathExprStatus_InternalError;
+    }
+}
+void MathExprContextFree(MathExprContextHandle hContext)
+{
+    delete hContext;
+}
+int MathExprBind(MathExprContextHandle hContext, size_t nSlot, const double* p, size_t n)
+{
+    if(!hContext || !p || !n || nSlot >= hContext->symbols->size())
+        return MathExprStatus_InvalidArgument;
+    try
+    {
+        hContext->context.Bind((*hContext->symbols)[nSlot].c_str(), p, n);
+        hContext->lengths[nSlot] = n;
+        return MathExprStatus_OK;
+    }
+    catch(const bad_alloc&)
+    {
+        return MathExprStatus_OutOfMemory;
+    }
+    catch(...)
+    {
+        return MathExprStatus_InternalError;
+    }
+}
+int MathExprEvaluate(MathExprContextHandle hContext, double* pResults, size_t nResults)
+{
+    if(!hContext || !pResults || !nResults)
+        return MathExprStatus_InvalidArgument;
+    try
+    {
+        // lengths are checked here, so that each failure has its own status: columns hold
+        // either the rows or a single value, and the results one value per row
+        hContext->error.clear();
+        const vector<size_t>& lengths = hContext->lengths;
+        size_t nRows = 1;
+        for(size_t i = 0; i < lengths.size(); i++)
+        {
+            if(!lengths[i])
+            {
+                hContext->error = "Unbound Symbol.";
+                return MathExprStatus_EvaluationError;
+            }
+            if(lengths[i] > nRows)
+                nRows = lengths[i];
+        }
+        for(size_t i = 0; i < lengths.size(); i++)
+        {
+            if(lengths[i] != 1 && lengths[i] != nRows)
+            {
+                hContext->error = "Symbol Size Mismatch.";
+                return MathExprStatus_SizeMismatch;
+            }
+        }
+        if(!lengths.empty() && nResults != nRows)
+        {
+            hContext->error = "Results Size Mismatch.";
+            return MathExprStatus_SizeMismatch;
+        }
+        if(hContext->program->Evaluate(pResults, nResults, hContext->context))
+            return MathExprStatus_OK;
+        
+        hContext->error = hContext->context.Error();
+        return MathExprStatus_EvaluationError;
+    }
+    catch(const bad_alloc&)
+    {
+        return MathExprStatus_OutOfMemory;
+    }
+    catch(...)
+    {
+        return MathExprStatus_InternalError;
+    }
+}
+const char* MathExprErrorMessage(MathExprContextHandle hContext)
+{
+    return hContext ? hContext->error.c_str() : "";
+}
@@ -0,0 +1,68 @@
+#ifndef _MATH_EXPRESSION_C_H_
+#define _MATH_EXPRESSION_C_H_
+
+/* C interface over MathExpression, for Origin C, Python ctypes, Rust and other FFI callers.
+ * Only opaque handles, pointers and integers cross it: columns are read in place, results
+ * are written in place and errors are status codes. No exception leaves these functions. */
+
+#include <stddef.h>
+
+#if defined(_WIN32) && defined(MATH_EXPRESSION_C_EXPORTS)
+#define MATH_EXPRESSION_C_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define MATH_EXPRESSION_C_API __attribute__((visibility("default")))
+#else
+#define MATH_EXPRESSION_C_API
+#endif
+
+#define MATH_EXPRESSION_C_API_VERSION   1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* values are part of the ABI and never change, new codes are only added */
+typedef enum {
+    MathExprStatus_OK               = 0,
+    MathExprStatus_InvalidArgument  = 1,    /* NULL handle or pointer, slot out of range */
+    MathExprStatus_CompileError     = 2,
+    MathExprStatus_UnknownSymbol    = 3,
+    MathExprStatus_SizeMismatch     = 4,    /* columns or results of different lengths */
+    MathExprStatus_EvaluationError  = 5,    /* e.g. an unbound symbol */
+    MathExprStatus_OutOfMemory      = 6,
+    MathExprStatus_InternalError    = 7
+} MathExprStatus;
+
+typedef struct MathExprCProgram* MathExprProgramHandle;    /* immutable, shared by threads */
+typedef struct MathExprCContext* MathExprContextHandle;    /* bindings, one per thread */
+
+MATH_EXPRESSION_C_API int MathExprApiVersion(void);
+
+/* lpszError, if not NULL, receives the message of a compile error, truncated to nErrorSize */
+MATH_EXPRESSION_C_API int MathExprCompile(const char* lpcszExpr, MathExprProgramHandle* phProgram, char* lpszError, size_t nErrorSize);
+MATH_EXPRESSION_C_API void MathExprProgramFree(MathExprProgramHandle hProgram);
+
+/* Symbols are numbered by slot, in sorted order. Names stay valid while the program lives. */
+MATH_EXPRESSION_C_API int MathExprSymbolCount(MathExprProgramHandle hProgram, size_t* pnSymbols);
+MATH_EXPRESSION_C_API int MathExprSymbolName(MathExprProgramHandle hProgram, size_t nSlot, const char** plpcszName);
+MATH_EXPRESSION_C_API int MathExprSymbolSlot(MathExprProgramHandle hProgram, const char* lpcszName, size_t* pnSlot);
+
+/* A context keeps its program alive, the program handle may be freed first. The constants
+ * pi and PI are bound in a new context, every other symbol must be bound by the caller. */
+MATH_EXPRESSION_C_API int MathExprContextCreate(MathExprProgramHandle hProgram, MathExprContextHandle* phContext);
+MATH_EXPRESSION_C_API void MathExprContextFree(MathExprContextHandle hContext);
+
+/* n values, or 1 to broadcast. The column is not copied and must outlive the evaluations. */
+MATH_EXPRESSION_C_API int MathExprBind(MathExprContextHandle hContext, size_t nSlot, const double* p, size_t n);
+
+/* nResults is the length of the longest bound column, 1 or more for a constant expression */
+MATH_EXPRESSION_C_API int MathExprEvaluate(MathExprContextHandle hContext, double* pResults, size_t nResults);
+
+/* message of the last failed call on the context, empty after a successful one */
+MATH_EXPRESSION_C_API const char* MathExprErrorMessage(MathExprContextHandle hContext);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MATH_EXPRESSION_C_H_ */
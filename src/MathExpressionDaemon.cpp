@@ -0,0 +1,56 @@
+// Local evaluation daemon, e.g. "mexprd /run/mexpr.sock". Built from this file,
+// MathExpressionServer.cpp and MathExpression.cpp, with OpenMP. Stops on SIGINT or SIGTERM.
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <pthread.h>
+#include <unistd.h>
+#include "MathExpressionServer.h"
+
+int main(int argc, char* argv[])
+{
+    if(argc != 2)
+    {
+        fprintf(stderr, "usage: %s <socket path>\n", argv[0]);
+        return 2;
+    }
+    
+    // one thread team serves every client, bound to the cores unless configured otherwise.
+    // The OpenMP runtime reads its environment before main(), libgomp in a constructor,
+    // so the daemon starts over once with the variables set; if it cannot, it runs unbound.
+    if(!getenv("OMP_PROC_BIND") || !getenv("OMP_PLACES"))
+    {
+        setenv("OMP_PROC_BIND", "close", 0);
+        setenv("OMP_PLACES", "cores", 0);
+        execvp(argv[0], argv);
+        fprintf(stderr, "%s: OpenMP threads are not bound to the cores\n", argv[0]);
+    }
+    
+    // signals are taken by one thread, all threads started later inherit the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    
+    // the process only serves clients: one evaluation at a time, each with the whole
+    // thread team, so clients never oversubscribe the cores
+    MathExpressionProgram::SetAsyncConcurrency(1);
+    MathExpressionServer server;
+    if(!server.Listen(argv[1]))
+    {
+        fprintf(stderr, "%s: %s\n", argv[1], server.Error().c_str());
+        return 1;
+    }
+    std::thread waiter([&server, signals]() {
+        int nSignal;
+        sigwait(&signals, &nSignal);
+        server.Stop();
+    });
+    server.Run();
+    
+    // Run() also returns on errors, the waiter is woken to stop the server in either case
+    pthread_kill(waiter.native_handle(), SIGTERM);
+    waiter.join();
+    return 0;
+}
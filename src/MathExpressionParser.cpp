@@ -35,39 +35,88 @@ typedef enum
 	MathExprNodeTypeCount
 } MathExprNodeType;
 
-class MathExprNode
+#define MATH_EXPR_ARENA_INLINE_SIZE		4096
+#define MATH_EXPR_ARENA_BLOCK_SIZE		16384
+
+typedef struct MathExprArenaBlock
+{
+	struct MathExprArenaBlock* next;
+	double data[1];                   // aligned for any token record
+} MathExprArenaBlock;
+
+// Bump-pointer arena. Tokens and their strings of one expression are carved out of an
+// inline buffer first and out of heap blocks once that is used up; nothing is released
+// until the whole arena is, so removing a token costs nothing and freeing is a loop.
+class MathExprArena
 {
 public:
-	MathExprNode()
+	MathExprArena()
 	{
-		unm = 0;
-		repr = NULL;
-		parent = NULL;
-		child = NULL;
-		previous = NULL;
-		next = NULL;
+		blocks = NULL;
+		current = (char*)inline_data;
+		left = MATH_EXPR_ARENA_INLINE_SIZE;
 	}
-
-	~MathExprNode()
+	~MathExprArena()
+	{
+		release();
+	}
+	void* alloc(size_t nBytes)
+	{
+		nBytes = (nBytes + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+		if(nBytes > left)
+		{
+			size_t nBlockSize = nBytes > MATH_EXPR_ARENA_BLOCK_SIZE ? nBytes : MATH_EXPR_ARENA_BLOCK_SIZE;
+			MathExprArenaBlock* block = (MathExprArenaBlock*)malloc(sizeof(MathExprArenaBlock) + nBlockSize);
+			if(!block)
+				return NULL;
+			block->next = blocks;
+			blocks = block;
+			current = (char*)block->data;
+			left = nBlockSize;
+		}
+		void* p = current;
+		current += nBytes;
+		left -= nBytes;
+		memset(p, 0, nBytes);
+		return p;
+	}
+	char* copy(const char* lpcsz, size_t nLength)
 	{
+		char* repr = (char*)alloc(nLength + 1);
 		if(repr)
-			free(repr);
-		if(child)
-			delete child;
-		if(next)
-			delete next;
-		repr = NULL;
-		child = NULL;
-		next = NULL;
+			memcpy(repr, lpcsz, nLength);
+		return repr;
 	}
+	void release()
+	{
+		while(blocks)
+		{
+			MathExprArenaBlock* block = blocks;
+			blocks = block->next;
+			free(block);
+		}
+		current = (char*)inline_data;
+		left = MATH_EXPR_ARENA_INLINE_SIZE;
+	}
+
+	MathExprArenaBlock* blocks;
+	char* current;
+	size_t left;
+	double inline_data[MATH_EXPR_ARENA_INLINE_SIZE / sizeof(double)];
+};
+
+// Token records live in a MathExprArena and are never deleted one by one.
+class MathExprNode
+{
+public:
 	char* repr;
 	bool unm;                        // valid only if type is number, expression, symbol, or function
 	MathExprNodeType type;
 	MathExprNode* parent;
 	MathExprNode* child;          // valid only if type is Expression 
+	MathExprNode* last;           // last child, for O(1) appends
 	MathExprNode* previous;
 	MathExprNode* next;
-	char* error[256];
 
 #ifdef _OC_VER
 	void symbols(vector<string>& tokens)
@@ -135,18 +184,14 @@ public:
 	}
 	void print(size_t nIndent)
 	{
-		size_t nBufferSize = 2 * nIndent + 1;
-		char * lpcszIndentIndent = (char*)calloc(nBufferSize, sizeof(char));
-		for(size_t i = 0; i < nBufferSize - 1; i++)
-			lpcszIndentIndent[i] = ' ';
-		printf("%s%s%s (%s)\n", lpcszIndentIndent, unm ? "-":"", repr, type == MathExprNodeType_Number ? "Number" : \
+		for(size_t i = 0; i < 2 * nIndent; i++)
+			printf(" ");
+		printf("%s%s (%s)\n", unm ? "-":"", repr ? repr : "", type == MathExprNodeType_Number ? "Number" : \
 			                                     (type == MathExprNodeType_Operator ? "Operator" : \
 												 (type == MathExprNodeType_Function ? "Function" : \
 												 (type == MathExprNodeType_Expression ? "Expression" : \
 												 (type == MathExprNodeType_Symbol ? "Symbol" : \
 												 (type == MathExprNodeType_Separator ? "Separator" : "None"))))));
-		free(lpcszIndentIndent);
-		lpcszIndentIndent = NULL;
 
 		if(child)
 		{
@@ -163,49 +208,9 @@ public:
 
 	MathExprNode* lastchild()
 	{
-		if(!child)
-			return NULL;
-		MathExprNode* node = child;
-		while(node)
-		{
-			if(node->next)
-				node = node->next;
-			else
-				return node;
-		}
-
-		return NULL;
-	}
-	size_t count()
-	{
-		size_t n = 0;
-		if(child)
-		{
-			MathExprNode* node = child;
-			while(node)
-			{
-				n++;
-				n += node->count();
-				node = node->next;
-			}
-		}
-		return n;
-	}
-	void children(MathExprNode** nodes, size_t* offset)
-	{
-		if(child)
-		{
-			MathExprNode* node = child;
-			while(node)
-			{
-				nodes[*offset] = node;
-				*offset += 1;
-				node->children(nodes, offset);
-				node = node->next;
-			}
-		}
+		return last;
 	}
-	void remove(bool bReleaseBuffer) {
+	void remove() {
 		if(next)
 			next->previous = previous;
 		if(previous)
@@ -213,43 +218,26 @@ public:
 		if(parent && !previous){
 			parent->child = next;
 		}
-
-		if(bReleaseBuffer)
-		{
-			if(repr)
-				free(repr);
-			repr = NULL;
-		}
-	}
-	void release() {
-#ifndef _OC_VER
-		size_t N = count();
-		
-		MathExprNode** nodes = (MathExprNode**)calloc(N, sizeof(MathExprNode*));
-		size_t offset = 0;
-		children(nodes, &offset);
-		for(size_t i = 0; i < N; i++)
-		{
-			MathExprNode* node = nodes[i];
-			if(node)
-			{
-				if(node->repr)
-				{
-					free(node->repr);
-					node->repr = NULL;
-				}
-
-				free(node);
-				node = NULL;
-			}
-				
+		if(parent && !next){
+			parent->last = previous;
 		}
-#endif
-		
-		return;
+		parent = NULL;
+		previous = NULL;
+		next = NULL;
 	}
 };
 
+static MathExprNode* __z_NewMathExprNode(MathExprArena* arena, MathExprNodeType type, const char* lpcszRepr, size_t nReprLength)
+{
+	MathExprNode* node = (MathExprNode*)arena->alloc(sizeof(MathExprNode));
+	if(!node)
+		return NULL;
+	node->type = type;
+	node->repr = arena->copy(lpcszRepr, nReprLength);
+	if(!node->repr)
+		return NULL;
+	return node;
+}
 
 static bool __z_IsParenthesesPaired(const char* lpcszExpr)
 {
@@ -287,9 +275,8 @@ static bool __z_IsValidOperator(char chr)
 	return chr == '+' || chr == '-' || chr == '*' || chr == '/' || chr == '^' || chr == '&' || chr == '|';
 }
 
-static bool __z_GetSubExpressionLength(const char* lpcszExpr, size_t* pExprSubLength)	// leading '(' and ending ')' included
+static bool __z_GetSubExpressionLength(const char* lpcszExpr, size_t nExprLength, size_t* pExprSubLength)	// leading '(' and ending ')' included
 {
-	size_t nExprLength = strlen(lpcszExpr);
 	if(nExprLength < 2 || lpcszExpr[0] != '(')
 		return 0;
 	
@@ -316,20 +303,15 @@ static bool __z_GetSubExpressionLength(const char* lpcszExpr, size_t* pExprSubLe
 }
 static void __z_PushBackMathExprNode(MathExprNode* expr, MathExprNode* exprSub)
 {
-	if(exprSub->previous)
-		exprSub->previous->next = exprSub->next;
-	if(exprSub->next)
-		exprSub->next->previous = exprSub->previous;
-	if(!exprSub->previous && exprSub->parent)
-		exprSub->parent->child = exprSub->next;
-	
 	MathExprNode* exprLastChild = expr->lastchild();
 	if(!exprLastChild)
 		expr->child = exprSub;
 	else
 		exprLastChild->next = exprSub;
+	expr->last = exprSub;
 	exprSub->parent = expr;
 	exprSub->previous = exprLastChild;
+	exprSub->next = NULL;
 	
 }
 static void __z_CheckUnm(MathExprNode* expr)
@@ -348,12 +330,7 @@ static void __z_CheckUnm(MathExprNode* expr)
 			{
 				if(strcmp(prev->repr, "-") == 0)
 					expr->unm = !expr->unm;
-				prev->remove(1);
-				prev->parent = NULL;
-				prev->child = NULL;
-				prev->previous = NULL;
-				prev->next = NULL;
-				delete prev;
+				prev->remove();
 
 				break;
 			}
@@ -367,12 +344,7 @@ static void __z_CheckUnm(MathExprNode* expr)
 					expr->unm = !expr->unm;
 				}
 
-				prev->remove(1);
-				prev->parent = NULL;
-				prev->child = NULL;
-				prev->previous = NULL;
-				prev->next = NULL;
-				delete prev;
+				prev->remove();
 
 				prev = expr->previous;
 			}
@@ -398,24 +370,22 @@ static void __z_CheckUnm(MathExprNode* expr)
 	return;
 }
 
-bool GetTokens(const char* lpcszExpr, MathExprNode* expr)
+// Sub-expressions are tokenized in place, i.e. as a range of the original string.
+bool GetTokens(const char* lpcszExpr, size_t nExprLength, MathExprNode* expr, MathExprArena* arena)
 {
-	size_t nExprLength = strlen(lpcszExpr);
 	for(size_t i = 0; i < nExprLength;)
 	{
 		char chr = lpcszExpr[i];
+		MathExprNode* exprSub = NULL;
 		if(chr == '(')
 		{
 			size_t nExprSubLength = 0;
-			if(!__z_GetSubExpressionLength(lpcszExpr + i, &nExprSubLength))
+			if(!__z_GetSubExpressionLength(lpcszExpr + i, nExprLength - i, &nExprSubLength))
 				return 0;
 
-			MathExprNode* exprSub = new MathExprNode;
-			exprSub->type = MathExprNodeType_Expression;
-			exprSub->repr = (char*)calloc(nExprSubLength - 1, sizeof(char));
-			for(size_t j = 0; j < nExprSubLength - 2; j++)
-				exprSub->repr[j] = lpcszExpr[i + j + 1];
-			i += nExprSubLength;
+			exprSub = __z_NewMathExprNode(arena, MathExprNodeType_Expression, "", 0);
+			if(!exprSub)
+				return 0;
 
 			__z_PushBackMathExprNode(expr, exprSub);
 
@@ -424,8 +394,9 @@ bool GetTokens(const char* lpcszExpr, MathExprNode* expr)
 
 			__z_CheckUnm(exprSub);
 
-			if(!GetTokens(exprSub->repr, exprSub))
+			if(!GetTokens(lpcszExpr + i + 1, nExprSubLength - 2, exprSub, arena))
 				return 0;
+			i += nExprSubLength;
 		}
 		else if(__z_IsValidForName(chr, 1))
 		{
@@ -436,11 +407,9 @@ bool GetTokens(const char* lpcszExpr, MathExprNode* expr)
 				if(!__z_IsValidForName(chr, 0))
 					break;
 			}
-			MathExprNode* exprSub = new MathExprNode;
-			exprSub->type = MathExprNodeType_Symbol;
-			exprSub->repr = (char*)calloc(j - i + 1, sizeof(char));
-			for(size_t k = i; k < j; k++)
-				exprSub->repr[k - i] = lpcszExpr[k];
+			exprSub = __z_NewMathExprNode(arena, MathExprNodeType_Symbol, lpcszExpr + i, j - i);
+			if(!exprSub)
+				return 0;
 
 			__z_PushBackMathExprNode(expr, exprSub);
 
@@ -450,10 +419,9 @@ bool GetTokens(const char* lpcszExpr, MathExprNode* expr)
 		}
 		else if(__z_IsValidOperator(chr))
 		{
-			MathExprNode* exprSub = new MathExprNode;
-			exprSub->type = MathExprNodeType_Operator;
-			exprSub->repr = (char*)calloc(2, sizeof(char));
-			exprSub->repr[0] = chr;
+			exprSub = __z_NewMathExprNode(arena, MathExprNodeType_Operator, lpcszExpr + i, 1);
+			if(!exprSub)
+				return 0;
 
 			__z_PushBackMathExprNode(expr, exprSub);
 
@@ -464,12 +432,12 @@ bool GetTokens(const char* lpcszExpr, MathExprNode* expr)
 			char* pEnd;
 			double f = strtod(lpcszExpr + i, &pEnd);
 			size_t nNumberLength = pEnd - (lpcszExpr + i);
+			if(!nNumberLength || nNumberLength > nExprLength - i)
+				return 0;
 
-			MathExprNode* exprSub = new MathExprNode;
-			exprSub->type = MathExprNodeType_Number;
-			exprSub->repr = (char*)calloc(nNumberLength + 1, sizeof(char));
-			for(size_t j = 0; j < nNumberLength; j++)
-				exprSub->repr[j] = lpcszExpr[i + j];
+			exprSub = __z_NewMathExprNode(arena, MathExprNodeType_Number, lpcszExpr + i, nNumberLength);
+			if(!exprSub)
+				return 0;
 
 			
 			__z_PushBackMathExprNode(expr, exprSub);
@@ -478,14 +446,13 @@ bool GetTokens(const char* lpcszExpr, MathExprNode* expr)
 			
 			__z_CheckUnm(exprSub);
 
-			i = pEnd - lpcszExpr;
+			i += nNumberLength;
 		}
 		else if(chr == ',')
 		{
-			MathExprNode* exprSub = new MathExprNode;
-			exprSub->type = MathExprNodeType_Separator;
-			exprSub->repr = (char*)calloc(2, sizeof(char));
-			exprSub->repr[0] = chr;
+			exprSub = __z_NewMathExprNode(arena, MathExprNodeType_Separator, lpcszExpr + i, 1);
+			if(!exprSub)
+				return 0;
 
 			__z_PushBackMathExprNode(expr, exprSub);
 
@@ -502,12 +469,12 @@ bool GetTokens(const char* lpcszExpr, MathExprNode* expr)
 	}
 	return 1;
 }
-bool ParseMathExpressionEx(const char* lpcszExpr, MathExprNode* expr)
+bool ParseMathExpressionEx(const char* lpcszExpr, MathExprNode* expr, MathExprArena* arena)
 {
 	if(!__z_IsParenthesesPaired(lpcszExpr))
 		return 0;
 
-	if(!GetTokens(lpcszExpr, expr))
+	if(!GetTokens(lpcszExpr, strlen(lpcszExpr), expr, arena))
 		return 0;
 
 	//bool bRet = expr->validate();
@@ -522,13 +489,11 @@ void ParseMathExpression(const char* lpcszMathExpression, std::set<std::string>&
 #endif
 {
 	// printf("%s\n", lpcszMathExpression);
-	size_t nExprLength = strlen(lpcszMathExpression);
-	MathExprNode* expr = new MathExprNode;
-	expr->type = MathExprNodeType_Expression;
-	expr->repr = (char*)calloc(nExprLength + 1, sizeof(char));
-	for(size_t i = 0; i < nExprLength; i++)
-		expr->repr[i] = lpcszMathExpression[i];
-	bool bRet = ParseMathExpressionEx(lpcszMathExpression, expr);
+	MathExprArena arena;
+	MathExprNode* expr = __z_NewMathExprNode(&arena, MathExprNodeType_Expression, lpcszMathExpression, strlen(lpcszMathExpression));
+	if(!expr)
+		return;
+	bool bRet = ParseMathExpressionEx(lpcszMathExpression, expr, &arena);
 	
 #ifdef _OC_VER
 	expr->symbols(symbols);
@@ -537,7 +502,7 @@ void ParseMathExpression(const char* lpcszMathExpression, std::set<std::string>&
 #endif
 	// expr->print(0);
 	// expr->print();
-	delete expr;
+	arena.release();
 }
 
 //int _tmain(int argc, _TCHAR* argv[])
@@ -576,4 +541,4 @@ int testMathExpressionParser()
 
 	return 0;
 }
-
+
\ No newline at end of file
@@ -0,0 +1,467 @@
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "MathExpressionServer.h"
+
+using namespace std;
+
+static bool ReadAll(int fd, void* p, size_t n)
+{
+    char* pBytes = static_cast<char*>(p);
+    while(n)
+    {
+        ssize_t nRead = recv(fd, pBytes, n, 0);
+        if(nRead < 0 && errno == EINTR)
+            continue;
+        if(nRead <= 0)
+            return false;
+        pBytes += nRead;
+        n -= static_cast<size_t>(nRead);
+    }
+    return true;
+}
+static bool WriteAll(int fd, const void* p, size_t n)
+{
+    // MSG_NOSIGNAL: a peer that went away is an error, not a SIGPIPE
+    const char* pBytes = static_cast<const char*>(p);
+    while(n)
+    {
+        ssize_t nWritten = send(fd, pBytes, n, MSG_NOSIGNAL);
+        if(nWritten < 0 && errno == EINTR)
+            continue;
+        if(nWritten <= 0)
+            return false;
+        pBytes += nWritten;
+        n -= static_cast<size_t>(nWritten);
+    }
+    return true;
+}
+static bool IsTerminated(const char* lpcsz, size_t nSize)
+{
+    return memchr(lpcsz, 0, nSize) != NULL;
+}
+static bool PeerCredentials(int fd, uid_t& uid, pid_t& pid)
+{
+#if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t nSize = sizeof(cred);
+    if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &nSize) != 0)
+        return false;
+    uid = cred.uid;
+    pid = cred.pid;
+    return true;
+#elif defined(LOCAL_PEERPID)
+    gid_t gid;
+    socklen_t nSize = sizeof(pid);
+    return getpeereid(fd, &uid, &gid) == 0 && getsockopt(fd, SOL_LOCAL, LOCAL_PEERPID, &pid, &nSize) == 0;
+#else
+    return false;
+#endif
+}
+static string SessionPrefix(pid_t pid)
+{
+    char szPrefix[32];
+    snprintf(szPrefix, sizeof(szPrefix), "/mexpr.%ld.", static_cast<long>(pid));
+    return szPrefix;
+}
+
+MathExpressionSharedBuffer::MathExpressionSharedBuffer() : m_view(NULL), m_nViewSize(0), m_data(NULL), m_n(0)
+{
+}
+MathExpressionSharedBuffer::~MathExpressionSharedBuffer()
+{
+    if(m_view)
+        munmap(m_view, m_nViewSize);
+    if(!m_shm.empty())
+        shm_unlink(m_shm.c_str());
+}
+bool MathExpressionSharedBuffer::Create(const char* lpcszShm, size_t n)
+{
+    if(m_view || !n)
+        return false;
+    int fd = shm_open(lpcszShm, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if(fd < 0)
+        return false;
+    m_shm = lpcszShm;
+    if(ftruncate(fd, static_cast<off_t>(n * sizeof(double))) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    void* pView = mmap(NULL, n * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pView == MAP_FAILED)
+        return false;
+    m_view = pView;
+    m_nViewSize = n * sizeof(double);
+    m_data = static_cast<double*>(pView);
+    m_n = n;
+    return true;
+}
+bool MathExpressionSharedBuffer::Open(const char* lpcszShm, size_t nOffset, size_t n, bool bWritable)
+{
+    // the mapping starts at 0, offsets need not be page aligned, only double aligned
+    if(m_view || !n || nOffset % sizeof(double) || n > (numeric_limits<size_t>::max)() / sizeof(double) - nOffset / sizeof(double))
+        return false;
+    int fd = shm_open(lpcszShm, bWritable ? O_RDWR : O_RDONLY, 0);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    size_t nSize = nOffset + n * sizeof(double);
+    if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < nSize)
+    {
+        close(fd);
+        return false;
+    }
+    void* pView = mmap(NULL, nSize, bWritable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pView == MAP_FAILED)
+        return false;
+    m_view = pView;
+    m_nViewSize = nSize;
+    m_data = reinterpret_cast<double*>(static_cast<char*>(pView) + nOffset);
+    m_n = n;
+    return true;
+}
+double* MathExpressionSharedBuffer::Data() const
+{
+    return m_data;
+}
+size_t MathExpressionSharedBuffer::Size() const
+{
+    return m_n;
+}
+
+// Connections are served by threads of their own, but evaluations are queued on the
+// scheduler of the library, whose concurrency is left to the process hosting the server.
+MathExpressionServer::MathExpressionServer(size_t nMaxPrograms) : m_fd(-1), m_stop(false), m_nMaxPrograms(nMaxPrograms ? nMaxPrograms : 1), m_nLastProgram(0), m_nActive(0)
+{
+}
+MathExpressionServer::~MathExpressionServer()
+{
+    Stop();
+    if(m_fd >= 0)
+        close(m_fd);
+    if(!m_path.empty())
+        unlink(m_path.c_str());
+}
+bool MathExpressionServer::Listen(const char* lpcszPath)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(lpcszPath) >= sizeof(addr.sun_path))
+    {
+        m_error = "Socket Path Too Long.";
+        return false;
+    }
+    strcpy(addr.sun_path, lpcszPath);
+    
+    // a socket left behind by a daemon that did not exit cleanly is replaced, the new one
+    // can only be connected to by the user running the daemon
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(lpcszPath);
+    if(fd < 0 || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || chmod(lpcszPath, 0600) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        if(fd >= 0)
+            close(fd);
+        m_error = "Cannot Listen.";
+        return false;
+    }
+    m_fd = fd;
+    m_path = lpcszPath;
+    return true;
+}
+void MathExpressionServer::Run()
+{
+    while(!m_stop)
+    {
+        int fd = accept(m_fd, NULL, NULL);
+        if(fd < 0)
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        
+        // other users are turned away, the shared memory a client names must be its own
+        uid_t uid;
+        pid_t pid;
+        if(!PeerCredentials(fd, uid, pid) || uid != geteuid())
+        {
+            close(fd);
+            continue;
+        }
+        
+        std::lock_guard<std::mutex> guard(m_lock);
+        if(m_stop)
+        {
+            close(fd);
+            break;
+        }
+        m_clients.insert(fd);
+        m_nActive++;
+        std::thread(&MathExpressionServer::Serve, this, fd, SessionPrefix(pid)).detach();
+    }
+}
+void MathExpressionServer::Stop()
+{
+    // wakes accept() and every connection blocked in recv(), then waits for them to finish
+    std::unique_lock<std::mutex> guard(m_lock);
+    m_stop = true;
+    if(m_fd >= 0)
+        shutdown(m_fd, SHUT_RDWR);
+    for(set<int>::const_iterator it = m_clients.begin(); it != m_clients.end(); it++)
+        shutdown(*it, SHUT_RDWR);
+    m_idle.wait(guard, [this]{ return m_nActive == 0; });
+}
+size_t MathExpressionServer::CacheSize() const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_programs.size();
+}
+const string& MathExpressionServer::Error() const
+{
+    return m_error;
+}
+void MathExpressionServer::Serve(int fd, const string& prefix)
+{
+    MathExprServerRequest request;
+    while(ReadAll(fd, &request, sizeof(request)))
+    {
+        if(request.magic != MATH_EXPRESSION_SERVER_MAGIC || request.nexpr > MATH_EXPRESSION_SERVER_MAX_EXPR || request.nbuffers > MATH_EXPRESSION_SERVER_MAX_BUFFERS)
+            break;
+        string expr(request.nexpr, '\0');
+        vector<MathExprServerBuffer> buffers(request.nbuffers);
+        if((request.nexpr && !ReadAll(fd, &expr[0], expr.size())) || (request.nbuffers && !ReadAll(fd, buffers.data(), buffers.size() * sizeof(MathExprServerBuffer))))
+            break;
+        
+        MathExprServerResponse response;
+        memset(&response, 0, sizeof(response));
+        response.magic = MATH_EXPRESSION_SERVER_MAGIC;
+        response.ok = Handle(request, expr, buffers, prefix, response) ? 1 : 0;
+        if(!WriteAll(fd, &response, sizeof(response)))
+            break;
+    }
+    
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_clients.erase(fd);
+    close(fd);
+    if(--m_nActive == 0)
+        m_idle.notify_all();
+}
+bool MathExpressionServer::Handle(const MathExprServerRequest& request, const string& expr, const vector<MathExprServerBuffer>& buffers, const string& prefix, MathExprServerResponse& response)
+{
+    string error;
+    unsigned long long nProgram = request.program;
+    shared_ptr<const MathExpressionProgram> program = nProgram ? Find(nProgram) : Compile(expr, nProgram, error);
+    if(!program && error.empty())
+        error = "Unknown Program.";
+    if(program && request.kind == MathExprServerRequest_Evaluate)
+    {
+        // the first buffer receives the results, the others are mapped read only and bound,
+        // names are within the session of the client and cannot reach other objects
+        vector<shared_ptr<MathExpressionSharedBuffer> > mapped(buffers.size());
+        MathExpressionContext context;
+        for(size_t i = 0; i < buffers.size() && error.empty(); i++)
+        {
+            const MathExprServerBuffer& buffer = buffers[i];
+            mapped[i].reset(new MathExpressionSharedBuffer);
+            if(!IsTerminated(buffer.symbol, sizeof(buffer.symbol)) || !IsTerminated(buffer.shm, sizeof(buffer.shm)) || (i > 0) == !buffer.symbol[0] || !buffer.shm[0] || strchr(buffer.shm, '/'))
+                error = "Invalid Request.";
+            else if(!mapped[i]->Open((prefix + buffer.shm).c_str(), static_cast<size_t>(buffer.offset), static_cast<size_t>(buffer.n), i == 0))
+                error = "Invalid Shared Buffer.";
+            else if(i > 0)
+                context.Bind(buffer.symbol, mapped[i]->Data(), mapped[i]->Size());
+        }
+        if(buffers.empty())
+            error = "Invalid Request.";
+        
+        shared_ptr<MathExpressionJob> job;
+        if(error.empty())
+            job = MathExpressionProgram::EvaluateAsync(program, context);
+        if(job && !job->Wait())
+            error = job->Error();
+        else if(job)
+        {
+            const vector<double>& results = job->Results();
+            double* pOutput = mapped[0]->Data();
+            size_t n = mapped[0]->Size();
+            if(results.size() == n)
+                std::copy(results.begin(), results.end(), pOutput);
+            else if(results.size() == 1)
+                std::fill(pOutput, pOutput + n, results[0]);
+            else
+                error = "Output Size Mismatch.";
+            response.rows = error.empty() ? n : 0;
+        }
+    }
+    else if(request.kind != MathExprServerRequest_Compile && request.kind != MathExprServerRequest_Evaluate)
+        error = "Invalid Request.";
+    
+    response.program = program ? nProgram : 0;
+    strncpy(response.error, error.c_str(), sizeof(response.error) - 1);
+    return error.empty();
+}
+shared_ptr<const MathExpressionProgram> MathExpressionServer::Compile(const string& expr, unsigned long long& nProgram, string& error)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        map<string, unsigned long long>::const_iterator it = m_ids.find(expr);
+        if(it != m_ids.end())
+        {
+            nProgram = it->second;
+            return Use(nProgram);
+        }
+    }
+    
+    // compiled outside the lock, when two clients race the first one to finish is kept
+    shared_ptr<const MathExpressionProgram> program(new MathExpressionProgram(expr.c_str()));
+    if(!program->Error().empty())
+    {
+        error = program->Error();
+        return shared_ptr<const MathExpressionProgram>();
+    }
+    std::lock_guard<std::mutex> guard(m_lock);
+    map<string, unsigned long long>::const_iterator it = m_ids.find(expr);
+    if(it != m_ids.end())
+    {
+        nProgram = it->second;
+        return Use(nProgram);
+    }
+    nProgram = ++m_nLastProgram;
+    MathExprServerProgram& entry = m_programs[nProgram];
+    entry.program = program;
+    entry.expr = expr;
+    entry.recent = m_recent.insert(m_recent.begin(), nProgram);
+    m_ids[expr] = nProgram;
+    
+    // evaluations still running on a dropped program keep it alive until they are done
+    while(m_programs.size() > m_nMaxPrograms)
+    {
+        map<unsigned long long, MathExprServerProgram>::iterator itOld = m_programs.find(m_recent.back());
+        m_recent.pop_back();
+        m_ids.erase(itOld->second.expr);
+        m_programs.erase(itOld);
+    }
+    return program;
+}
+shared_ptr<const MathExpressionProgram> MathExpressionServer::Find(unsigned long long nProgram)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return Use(nProgram);
+}
+shared_ptr<const MathExpressionProgram> MathExpressionServer::Use(unsigned long long nProgram)
+{
+    map<unsigned long long, MathExprServerProgram>::iterator it = m_programs.find(nProgram);
+    if(it == m_programs.end())
+        return shared_ptr<const MathExpressionProgram>();
+    m_recent.splice(m_recent.begin(), m_recent, it->second.recent);
+    return it->second.program;
+}
+
+MathExpressionClient::MathExpressionClient() : m_fd(-1)
+{
+}
+MathExpressionClient::~MathExpressionClient()
+{
+    if(m_fd >= 0)
+        close(m_fd);
+}
+bool MathExpressionClient::Connect(const char* lpcszPath)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(lpcszPath) >= sizeof(addr.sun_path))
+    {
+        m_error = "Socket Path Too Long.";
+        return false;
+    }
+    strcpy(addr.sun_path, lpcszPath);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        if(fd >= 0)
+            close(fd);
+        m_error = "Cannot Connect.";
+        return false;
+    }
+    if(m_fd >= 0)
+        close(m_fd);
+    m_fd = fd;
+    return true;
+}
+bool MathExpressionClient::Compile(const char* lpcszExpr, unsigned long long& nProgram)
+{
+    MathExprServerRequest request;
+    memset(&request, 0, sizeof(request));
+    request.kind = MathExprServerRequest_Compile;
+    MathExprServerResponse response;
+    if(!Call(request, lpcszExpr, vector<MathExprServerBuffer>(), response))
+        return false;
+    nProgram = response.program;
+    return true;
+}
+bool MathExpressionClient::Evaluate(unsigned long long nProgram, const vector<MathExprServerBuffer>& buffers, size_t& nRows)
+{
+    MathExprServerRequest request;
+    memset(&request, 0, sizeof(request));
+    request.kind = MathExprServerRequest_Evaluate;
+    request.program = nProgram;
+    MathExprServerResponse response;
+    if(!Call(request, "", buffers, response))
+        return false;
+    nRows = static_cast<size_t>(response.rows);
+    return true;
+}
+bool MathExpressionClient::Evaluate(const char* lpcszExpr, const vector<MathExprServerBuffer>& buffers, size_t& nRows)
+{
+    MathExprServerRequest request;
+    memset(&request, 0, sizeof(request));
+    request.kind = MathExprServerRequest_Evaluate;
+    MathExprServerResponse response;
+    if(!Call(request, lpcszExpr, buffers, response))
+        return false;
+    nRows = static_cast<size_t>(response.rows);
+    return true;
+}
+const string& MathExpressionClient::Error() const
+{
+    return m_error;
+}
+string MathExpressionClient::SharedName(const char* lpcszName)
+{
+    return SessionPrefix(getpid()) + lpcszName;
+}
+bool MathExpressionClient::Call(const MathExprServerRequest& request, const char* lpcszExpr, const vector<MathExprServerBuffer>& buffers, MathExprServerResponse& response)
+{
+    size_t nExpr = strlen(lpcszExpr);
+    if(nExpr > MATH_EXPRESSION_SERVER_MAX_EXPR || buffers.size() > MATH_EXPRESSION_SERVER_MAX_BUFFERS)
+    {
+        m_error = "Invalid Request.";
+        return false;
+    }
+    MathExprServerRequest header = request;
+    header.magic = MATH_EXPRESSION_SERVER_MAGIC;
+    header.nexpr = static_cast<unsigned int>(nExpr);
+    header.nbuffers = static_cast<unsigned int>(buffers.size());
+    if(m_fd < 0 || !WriteAll(m_fd, &header, sizeof(header)) || !WriteAll(m_fd, lpcszExpr, nExpr) || \
+       !WriteAll(m_fd, buffers.data(), buffers.size() * sizeof(MathExprServerBuffer)) || \
+       !ReadAll(m_fd, &response, sizeof(response)) || response.magic != MATH_EXPRESSION_SERVER_MAGIC)
+    {
+        m_error = "Connection Lost.";
+        return false;
+    }
+    response.error[sizeof(response.error) - 1] = '\0';
+    m_error = response.error;
+    return response.ok != 0;
+}
@@ -0,0 +1,138 @@
+#ifndef _MATH_EXPRESSION_SERVER_H_
+#define _MATH_EXPRESSION_SERVER_H_
+
+// Optional local evaluation daemon, POSIX only. Processes on a host share one compile cache
+// and one scheduler: requests travel over a Unix domain socket, columns and results stay
+// in POSIX shared memory and are mapped by the daemon, never copied through the socket.
+// Only processes of the user running the daemon are served, each one within its own objects.
+
+#include <list>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "MathExpression.h"
+
+#define MATH_EXPRESSION_SERVER_MAGIC        0x5358454Du   // "MEXS"
+#define MATH_EXPRESSION_SERVER_MAX_NAME     64
+#define MATH_EXPRESSION_SERVER_MAX_EXPR     (1 << 20)
+#define MATH_EXPRESSION_SERVER_MAX_BUFFERS  1024
+
+typedef enum {
+    MathExprServerRequest_Compile   = 1,    // expression text to a program ID
+    MathExprServerRequest_Evaluate  = 2     // a program ID, or text, on shared buffers
+} MathExprServerRequestKind;
+
+// n doubles at a byte offset in a shared memory object of the client, named as passed to
+// MathExpressionClient::SharedName(), e.g. "x" for "/mexpr.1234.x" created by process 1234
+typedef struct MathExprServerBuffer
+{
+    char symbol[MATH_EXPRESSION_SERVER_MAX_NAME];   // empty for the results
+    char shm[MATH_EXPRESSION_SERVER_MAX_NAME];
+    unsigned long long offset;
+    unsigned long long n;
+} MathExprServerBuffer;
+
+// Wire format: a request is followed by nexpr bytes of expression text and nbuffers
+// buffers, the first of which receives the results. Both ends are on the same host.
+typedef struct MathExprServerRequest
+{
+    unsigned int magic;
+    unsigned int kind;          // MathExprServerRequestKind
+    unsigned long long program; // 0 to use the text
+    unsigned int nexpr;
+    unsigned int nbuffers;
+} MathExprServerRequest;
+
+typedef struct MathExprServerResponse
+{
+    unsigned int magic;
+    unsigned int ok;
+    unsigned long long program;
+    unsigned long long rows;    // results written
+    char error[128];
+} MathExprServerResponse;
+
+// A mapped shared memory object of doubles. Created ones are unlinked when destroyed.
+class MathExpressionSharedBuffer
+{
+public:
+    MathExpressionSharedBuffer();
+    ~MathExpressionSharedBuffer();
+    bool Create(const char* lpcszShm, size_t n);
+    bool Open(const char* lpcszShm, size_t nOffset, size_t n, bool bWritable);
+    double* Data() const;
+    size_t Size() const;
+    
+protected:
+    MathExpressionSharedBuffer(const MathExpressionSharedBuffer&);
+    MathExpressionSharedBuffer& operator=(const MathExpressionSharedBuffer&);
+    void* m_view;
+    size_t m_nViewSize;
+    double* m_data;
+    size_t m_n;
+    string m_shm;           // set when created here
+};
+
+// a compiled program of the cache, with its text and its place in the order of use
+typedef struct MathExprServerProgram
+{
+    shared_ptr<const MathExpressionProgram> program;
+    string expr;
+    list<unsigned long long>::iterator recent;
+} MathExprServerProgram;
+
+// The compile cache keeps the nMaxPrograms programs used last. The ID of a program that was
+// dropped is unknown from then on, IDs are never reused.
+class MathExpressionServer
+{
+public:
+    MathExpressionServer(size_t nMaxPrograms = 1024);
+    ~MathExpressionServer();
+    bool Listen(const char* lpcszPath);
+    void Run();             // serves until Stop(), one thread per connection
+    void Stop();
+    size_t CacheSize() const;
+    const string& Error() const;
+    
+protected:
+    void Serve(int fd, const string& prefix);
+    bool Handle(const MathExprServerRequest& request, const string& expr, const vector<MathExprServerBuffer>& buffers, const string& prefix, MathExprServerResponse& response);
+    shared_ptr<const MathExpressionProgram> Compile(const string& expr, unsigned long long& nProgram, string& error);
+    shared_ptr<const MathExpressionProgram> Find(unsigned long long nProgram);
+    shared_ptr<const MathExpressionProgram> Use(unsigned long long nProgram);   // m_lock held
+    
+    int m_fd;
+    string m_path;
+    string m_error;
+    atomic<bool> m_stop;
+    mutable std::mutex m_lock;  // the cache and the connections
+    size_t m_nMaxPrograms;
+    unsigned long long m_nLastProgram;
+    map<string, unsigned long long> m_ids;
+    map<unsigned long long, MathExprServerProgram> m_programs;
+    list<unsigned long long> m_recent;  // IDs, the most recently used first
+    set<int> m_clients;
+    size_t m_nActive;           // connections still being served
+    std::condition_variable m_idle;
+};
+
+class MathExpressionClient
+{
+public:
+    MathExpressionClient();
+    ~MathExpressionClient();
+    bool Connect(const char* lpcszPath);
+    bool Compile(const char* lpcszExpr, unsigned long long& nProgram);
+    // buffers[0] receives the results, the others are bound by symbol
+    bool Evaluate(unsigned long long nProgram, const vector<MathExprServerBuffer>& buffers, size_t& nRows);
+    bool Evaluate(const char* lpcszExpr, const vector<MathExprServerBuffer>& buffers, size_t& nRows);
+    const string& Error() const;
+    static string SharedName(const char* lpcszName);   // of a buffer to create for the daemon
+    
+protected:
+    bool Call(const MathExprServerRequest& request, const char* lpcszExpr, const vector<MathExprServerBuffer>& buffers, MathExprServerResponse& response);
+    int m_fd;
+    string m_error;
+};
+
+#endif // _MATH_EXPRESSION_SERVER_H_
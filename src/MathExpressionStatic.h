@@ -0,0 +1,850 @@
+#ifndef _MATH_EXPRESSION_STATIC_H_
+#define _MATH_EXPRESSION_STATIC_H_
+
+// Compile-time front end for formulas fixed in code. The string literal is parsed while
+// compiling into a type-level tree, parse errors are compile errors, and evaluation is
+// plain inlined code without tokens, RPN or operand buffers.
+//
+//     constexpr auto f = ME_EXPR("a * exp(-b * x) + t");
+//     // f.symbols == {"a", "b", "x", "t"}, in order of first appearance
+//     double r = f(2.0, 0.5, 1.0, 0.1);
+//     f.Evaluate(results, n, 2.0, 0.5, x.data(), 0.1);   // pointers are columns, doubles broadcast
+//
+// The grammar, precedence and built-in functions are the same as MathExpression. Reductions
+// and user functions are only available at runtime.
+
+#if !(__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L))
+#error MathExpressionStatic.h requires C++17
+#endif
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+typedef enum {
+    MathExprStaticOp_Or,
+    MathExprStaticOp_And,
+    MathExprStaticOp_Equal,
+    MathExprStaticOp_NotEqual,
+    MathExprStaticOp_LessEqual,
+    MathExprStaticOp_GreaterEqual,
+    MathExprStaticOp_Less,
+    MathExprStaticOp_Greater,
+    MathExprStaticOp_Plus,
+    MathExprStaticOp_Minus,
+    MathExprStaticOp_Multiply,
+    MathExprStaticOp_Divide,
+    MathExprStaticOp_Power,
+    MathExprStaticOp_Not,
+    
+    MathExprStaticOp_None = -1
+} MathExprStaticOp;
+
+typedef enum {
+    MathExprStaticFn_acos,
+    MathExprStaticFn_asin,
+    MathExprStaticFn_atan,
+    MathExprStaticFn_cos,
+    MathExprStaticFn_cosh,
+    MathExprStaticFn_exp,
+    MathExprStaticFn_abs,
+    MathExprStaticFn_log,
+    MathExprStaticFn_log10,
+    MathExprStaticFn_ln,
+    MathExprStaticFn_sin,
+    MathExprStaticFn_sinh,
+    MathExprStaticFn_tan,
+    MathExprStaticFn_tanh,
+    MathExprStaticFn_sqrt,
+    MathExprStaticFn_j0,
+    MathExprStaticFn_j1,
+    MathExprStaticFn_y0,
+    MathExprStaticFn_y1,
+    MathExprStaticFn_atan2,
+    MathExprStaticFn_if,        // and where
+    MathExprStaticFn_min,
+    MathExprStaticFn_max,
+    MathExprStaticFn_hypot,
+    MathExprStaticFn_poly,
+    MathExprStaticFn_Reduction, // sum, mean, norm, and min/max with a single argument
+    
+    MathExprStaticFn_Unknown = -1
+} MathExprStaticFn;
+
+typedef enum {
+    MathExprStaticError_None,
+    MathExprStaticError_Operand,        // an operand is missing or invalid
+    MathExprStaticError_Parenthesis,    // a ')' is missing
+    MathExprStaticError_Trailing,       // characters left after the expression
+    MathExprStaticError_Number,
+    MathExprStaticError_Function,       // unknown function
+    MathExprStaticError_Arguments,      // wrong number of arguments
+    MathExprStaticError_Reduction
+} MathExprStaticError;
+
+typedef struct MathExprStaticResult
+{
+    size_t end;     // past the last token and the white space after it
+    int error;      // MathExprStaticError
+} MathExprStaticResult;
+
+// Grammar levels, from low to high precedence. A sign + or - applies to the terms joined by
+// '*', '/' and '^' after it, '!' to its operand alone, and '^' is right-associative, as in
+// MathExpression.
+#define MATH_EXPR_STATIC_LEVEL_OR           1
+#define MATH_EXPR_STATIC_LEVEL_ADDITIVE     5
+#define MATH_EXPR_STATIC_LEVEL_UNARY        6
+#define MATH_EXPR_STATIC_LEVEL_MULTIPLY     7
+#define MATH_EXPR_STATIC_LEVEL_POWER        8
+#define MATH_EXPR_STATIC_LEVEL_EXPONENT     9   // right operand of '^'
+#define MATH_EXPR_STATIC_LEVEL_PRIMARY      10
+#define MATH_EXPR_STATIC_LEVEL_NOT          11  // operand of '!', a primary with signs
+
+typedef enum {
+    MathExprStaticForm_Binary,
+    MathExprStaticForm_Sign,
+    MathExprStaticForm_Next,
+    MathExprStaticForm_Power,
+    MathExprStaticForm_Number,
+    MathExprStaticForm_Symbol,
+    MathExprStaticForm_Call,
+    MathExprStaticForm_Group
+} MathExprStaticForm;
+
+struct MathExprStaticLexer
+{
+    static constexpr bool IsWhiteSpace(char chr)
+    {
+        return chr == ' ' || chr == '\n' || chr == '\r' || chr == '\t' || chr == '\f' || chr == '\v';
+    }
+    static constexpr bool IsDigit(char chr)
+    {
+        return chr >= '0' && chr <= '9';
+    }
+    static constexpr bool IsValidForName(char chr, bool bFirst)
+    {
+        return (chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || chr == '_' || (!bFirst && IsDigit(chr));
+    }
+    static constexpr size_t SkipWhiteSpace(std::string_view s, size_t p)
+    {
+        while(p < s.size() && IsWhiteSpace(s[p]))
+            p++;
+        return p;
+    }
+    static constexpr bool IsAt(std::string_view s, size_t p, char chr)
+    {
+        return p < s.size() && s[p] == chr;
+    }
+    static constexpr size_t NameEnd(std::string_view s, size_t p)
+    {
+        while(p < s.size() && IsValidForName(s[p], false))
+            p++;
+        return p;
+    }
+    static constexpr size_t NumberEnd(std::string_view s, size_t p)
+    {
+        // decimal digits, fraction and exponent as accepted by strtod()
+        while(p < s.size() && (IsDigit(s[p]) || s[p] == '.'))
+            p++;
+        if(p < s.size() && (s[p] == 'e' || s[p] == 'E'))
+        {
+            size_t q = p + 1;
+            if(q < s.size() && (s[q] == '+' || s[q] == '-'))
+                q++;
+            if(q < s.size() && IsDigit(s[q]))
+            {
+                p = q;
+                while(p < s.size() && IsDigit(s[p]))
+                    p++;
+            }
+        }
+        return p;
+    }
+    static constexpr bool IsValidNumber(std::string_view s, size_t b, size_t e)
+    {
+        size_t nDigits = 0, nPoints = 0;
+        for(size_t i = b; i < e && s[i] != 'e' && s[i] != 'E'; i++)
+        {
+            if(s[i] == '.')
+                nPoints++;
+            else
+                nDigits++;
+        }
+        return nDigits && nPoints <= 1;
+    }
+    static constexpr double Number(std::string_view s, size_t b, size_t e)
+    {
+        // exact for up to 15 significant digits and decimal exponents within +-22,
+        // the common case, otherwise within an ulp or so of strtod()
+        const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        unsigned long long mantissa = 0;
+        long long exponent = 0;
+        size_t nSignificant = 0;
+        bool bFraction = false;
+        size_t i = b;
+        for(; i < e && s[i] != 'e' && s[i] != 'E'; i++)
+        {
+            if(s[i] == '.')
+            {
+                bFraction = true;
+                continue;
+            }
+            if(nSignificant < 19)
+            {
+                mantissa = mantissa * 10 + (s[i] - '0');
+                if(mantissa)
+                    nSignificant++;
+                if(bFraction)
+                    exponent--;
+            }
+            else if(!bFraction)
+                exponent++;
+        }
+        if(i < e)
+        {
+            bool bNegative = s[++i] == '-';
+            if(s[i] == '+' || s[i] == '-')
+                i++;
+            long long n = 0;
+            for(; i < e && n < 100000; i++)
+                n = n * 10 + (s[i] - '0');
+            exponent += bNegative ? -n : n;
+        }
+        
+        if(!mantissa)
+            return 0;
+        if(mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22)
+        {
+            double value = static_cast<double>(mantissa);
+            return exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+        }
+        long double value = static_cast<long double>(mantissa);
+        for(; exponent > 0; exponent--)
+            value *= 10;
+        for(; exponent < 0; exponent++)
+            value /= 10;
+        return static_cast<double>(value);
+    }
+    static constexpr int SignAt(std::string_view s, size_t p)
+    {
+        if(p >= s.size())
+            return MathExprStaticOp_None;
+        if(s[p] == '-')
+            return MathExprStaticOp_Minus;
+        if(s[p] == '+')
+            return MathExprStaticOp_Plus;
+        if(s[p] == '!' && !IsAt(s, p + 1, '='))
+            return MathExprStaticOp_Not;
+        return MathExprStaticOp_None;
+    }
+    static constexpr int OperatorAt(std::string_view s, size_t p, int nLevel)
+    {
+        // binary operator of the given level at p
+        char chr = p < s.size() ? s[p] : '\0';
+        char next = p + 1 < s.size() ? s[p + 1] : '\0';
+        switch(nLevel)
+        {
+            case 1:
+                return chr == '|' && next == '|' ? MathExprStaticOp_Or : MathExprStaticOp_None;
+            case 2:
+                return chr == '&' && next == '&' ? MathExprStaticOp_And : MathExprStaticOp_None;
+            case 3:
+                if(chr == '=' && next == '=')
+                    return MathExprStaticOp_Equal;
+                return chr == '!' && next == '=' ? MathExprStaticOp_NotEqual : MathExprStaticOp_None;
+            case 4:
+                if(chr == '<')
+                    return next == '=' ? MathExprStaticOp_LessEqual : MathExprStaticOp_Less;
+                if(chr == '>')
+                    return next == '=' ? MathExprStaticOp_GreaterEqual : MathExprStaticOp_Greater;
+                return MathExprStaticOp_None;
+            case MATH_EXPR_STATIC_LEVEL_ADDITIVE:
+                if(chr == '+')
+                    return MathExprStaticOp_Plus;
+                return chr == '-' ? MathExprStaticOp_Minus : MathExprStaticOp_None;
+            case MATH_EXPR_STATIC_LEVEL_MULTIPLY:
+                if(chr == '*')
+                    return MathExprStaticOp_Multiply;
+                return chr == '/' ? MathExprStaticOp_Divide : MathExprStaticOp_None;
+            default:
+                return MathExprStaticOp_None;
+        }
+    }
+    static constexpr size_t OperatorLength(int op)
+    {
+        return op <= MathExprStaticOp_GreaterEqual ? 2 : 1;
+    }
+    static constexpr bool IsArithmeticSign(std::string_view s, size_t p)
+    {
+        return SignAt(s, p) == MathExprStaticOp_Plus || SignAt(s, p) == MathExprStaticOp_Minus;
+    }
+    static constexpr int Operand(std::string_view s, size_t p, int nLevel)
+    {
+        // level of the operands of a binary level
+        if(nLevel < MATH_EXPR_STATIC_LEVEL_ADDITIVE)
+            return nLevel + 1;
+        if(nLevel == MATH_EXPR_STATIC_LEVEL_ADDITIVE)
+            return MATH_EXPR_STATIC_LEVEL_UNARY;
+        return IsArithmeticSign(s, p) ? MATH_EXPR_STATIC_LEVEL_UNARY : MATH_EXPR_STATIC_LEVEL_POWER;
+    }
+    static constexpr int SignOperand(int nLevel)
+    {
+        // + and - take the terms of their level, ! only a primary
+        return nLevel == MATH_EXPR_STATIC_LEVEL_PRIMARY ? MATH_EXPR_STATIC_LEVEL_NOT : nLevel;
+    }
+    static constexpr bool IsCall(std::string_view s, size_t p)
+    {
+        return IsAt(s, SkipWhiteSpace(s, NameEnd(s, p)), '(');
+    }
+    static constexpr int Form(std::string_view s, size_t p, int nLevel)
+    {
+        if(nLevel <= MATH_EXPR_STATIC_LEVEL_ADDITIVE || nLevel == MATH_EXPR_STATIC_LEVEL_MULTIPLY)
+            return MathExprStaticForm_Binary;
+        if(nLevel == MATH_EXPR_STATIC_LEVEL_UNARY || nLevel == MATH_EXPR_STATIC_LEVEL_EXPONENT)
+            return IsArithmeticSign(s, p) ? MathExprStaticForm_Sign : MathExprStaticForm_Next;
+        if(nLevel == MATH_EXPR_STATIC_LEVEL_POWER)
+            return MathExprStaticForm_Power;
+        if(SignAt(s, p) == MathExprStaticOp_Not || (nLevel == MATH_EXPR_STATIC_LEVEL_NOT && SignAt(s, p) != MathExprStaticOp_None))
+            return MathExprStaticForm_Sign;
+        if(IsAt(s, p, '('))
+            return MathExprStaticForm_Group;
+        if(p < s.size() && IsValidForName(s[p], true))
+            return IsCall(s, p) ? MathExprStaticForm_Call : MathExprStaticForm_Symbol;
+        return MathExprStaticForm_Number;
+    }
+    static constexpr int Function(std::string_view name, size_t nArgs)
+    {
+        const std::string_view names[] = {"acos", "asin", "atan", "cos", "cosh", "exp", "abs", "log", "log10", "ln",
+                                          "sin", "sinh", "tan", "tanh", "sqrt", "j0", "j1", "y0", "y1"};
+        for(size_t i = 0; i < sizeof(names)/sizeof(names[0]); i++)
+        {
+            if(name == names[i])
+                return static_cast<int>(i);
+        }
+        if(name == "atan2")
+            return MathExprStaticFn_atan2;
+        if(name == "if" || name == "where")
+            return MathExprStaticFn_if;
+        if((name == "min" || name == "max") && nArgs == 1)
+            return MathExprStaticFn_Reduction;
+        if(name == "min")
+            return MathExprStaticFn_min;
+        if(name == "max")
+            return MathExprStaticFn_max;
+        if(name == "hypot")
+            return MathExprStaticFn_hypot;
+        if(name == "poly")
+            return MathExprStaticFn_poly;
+        if(name == "sum" || name == "mean" || name == "norm")
+            return MathExprStaticFn_Reduction;
+        return MathExprStaticFn_Unknown;
+    }
+    static constexpr bool IsValidArity(int fn, size_t nArgs)
+    {
+        if(fn < MathExprStaticFn_atan2)
+            return nArgs == 1;
+        if(fn == MathExprStaticFn_atan2)
+            return nArgs == 2;
+        if(fn == MathExprStaticFn_if)
+            return nArgs == 3;
+        if(fn == MathExprStaticFn_hypot)
+            return nArgs >= 1;
+        return nArgs >= 2;
+    }
+    static constexpr size_t Arguments(std::string_view s, size_t p)
+    {
+        // number of arguments of the call whose '(' is at p, the call is valid
+        size_t nArgs = 1, nDepth = 0;
+        for(; p < s.size(); p++)
+        {
+            if(s[p] == '(')
+                nDepth++;
+            else if(s[p] == ')' && --nDepth == 0)
+                break;
+            else if(s[p] == ',' && nDepth == 1)
+                nArgs++;
+        }
+        return nArgs;
+    }
+    
+    // Validation, the same grammar as the type-level parser below
+    static constexpr MathExprStaticResult Check(std::string_view s, size_t p, int nLevel)
+    {
+        MathExprStaticResult result = {p, MathExprStaticError_None};
+        switch(Form(s, p, nLevel))
+        {
+            case MathExprStaticForm_Binary:
+            {
+                result = Check(s, p, Operand(s, p, nLevel));
+                while(!result.error && OperatorAt(s, result.end, nLevel) != MathExprStaticOp_None)
+                {
+                    size_t q = SkipWhiteSpace(s, result.end + OperatorLength(OperatorAt(s, result.end, nLevel)));
+                    result = Check(s, q, Operand(s, q, nLevel));
+                }
+                return result;
+            }
+            case MathExprStaticForm_Sign:
+                return Check(s, SkipWhiteSpace(s, p + 1), SignOperand(nLevel));
+            case MathExprStaticForm_Next:
+                return Check(s, p, nLevel == MATH_EXPR_STATIC_LEVEL_UNARY ? MATH_EXPR_STATIC_LEVEL_MULTIPLY : MATH_EXPR_STATIC_LEVEL_POWER);
+            case MathExprStaticForm_Power:
+                result = Check(s, p, MATH_EXPR_STATIC_LEVEL_PRIMARY);
+                if(!result.error && IsAt(s, result.end, '^'))
+                    return Check(s, SkipWhiteSpace(s, result.end + 1), MATH_EXPR_STATIC_LEVEL_EXPONENT);
+                return result;
+            case MathExprStaticForm_Group:
+                result = Check(s, SkipWhiteSpace(s, p + 1), MATH_EXPR_STATIC_LEVEL_OR);
+                if(result.error)
+                    return result;
+                if(!IsAt(s, result.end, ')'))
+                    return MathExprStaticResult{result.end, MathExprStaticError_Parenthesis};
+                return MathExprStaticResult{SkipWhiteSpace(s, result.end + 1), MathExprStaticError_None};
+            case MathExprStaticForm_Call:
+            {
+                size_t nArgs = 0;
+                size_t q = SkipWhiteSpace(s, NameEnd(s, p));
+                do
+                {
+                    result = Check(s, SkipWhiteSpace(s, q + 1), MATH_EXPR_STATIC_LEVEL_OR);
+                    if(result.error)
+                        return result;
+                    nArgs++;
+                    q = result.end;
+                } while(IsAt(s, q, ','));
+                if(!IsAt(s, q, ')'))
+                    return MathExprStaticResult{q, MathExprStaticError_Parenthesis};
+                
+                int fn = Function(s.substr(p, NameEnd(s, p) - p), nArgs);
+                if(fn == MathExprStaticFn_Unknown)
+                    return MathExprStaticResult{p, MathExprStaticError_Function};
+                if(fn == MathExprStaticFn_Reduction)
+                    return MathExprStaticResult{p, MathExprStaticError_Reduction};
+                if(!IsValidArity(fn, nArgs))
+                    return MathExprStaticResult{p, MathExprStaticError_Arguments};
+                return MathExprStaticResult{SkipWhiteSpace(s, q + 1), MathExprStaticError_None};
+            }
+            case MathExprStaticForm_Symbol:
+                return MathExprStaticResult{SkipWhiteSpace(s, NameEnd(s, p)), MathExprStaticError_None};
+            default:
+                if(p >= s.size() || !(IsDigit(s[p]) || s[p] == '.'))
+                    return MathExprStaticResult{p, MathExprStaticError_Operand};
+                if(!IsValidNumber(s, p, NumberEnd(s, p)))
+                    return MathExprStaticResult{p, MathExprStaticError_Number};
+                return MathExprStaticResult{SkipWhiteSpace(s, NumberEnd(s, p)), MathExprStaticError_None};
+        }
+    }
+    static constexpr int Check(std::string_view s)
+    {
+        MathExprStaticResult result = Check(s, SkipWhiteSpace(s, 0), MATH_EXPR_STATIC_LEVEL_OR);
+        if(!result.error && result.end != s.size())
+            return IsAt(s, result.end, ')') ? MathExprStaticError_Parenthesis : MathExprStaticError_Trailing;
+        return result.error;
+    }
+    
+    // Symbols in order of first appearance, this order is the binding order
+    static constexpr bool NextSymbol(std::string_view s, size_t& p, std::string_view& name)
+    {
+        while(p < s.size())
+        {
+            if(IsDigit(s[p]) || s[p] == '.')
+                p = NumberEnd(s, p);
+            else if(IsValidForName(s[p], true))
+            {
+                size_t b = p;
+                p = NameEnd(s, p);
+                name = s.substr(b, p - b);
+                if(!IsCall(s, b))
+                    return true;
+            }
+            else
+                p++;
+        }
+        return false;
+    }
+    static constexpr bool IsFirstSymbol(std::string_view s, std::string_view name, size_t offset)
+    {
+        size_t p = 0;
+        std::string_view next;
+        while(NextSymbol(s, p, next))
+        {
+            if(next == name)
+                return p - next.size() == offset;
+        }
+        return false;
+    }
+    static constexpr size_t SymbolCount(std::string_view s)
+    {
+        size_t p = 0, n = 0;
+        std::string_view name;
+        while(NextSymbol(s, p, name))
+            n += IsFirstSymbol(s, name, p - name.size());
+        return n;
+    }
+    static constexpr size_t SymbolIndex(std::string_view s, std::string_view symbol)
+    {
+        size_t p = 0, n = 0;
+        std::string_view name;
+        while(NextSymbol(s, p, name) && name != symbol)
+            n += IsFirstSymbol(s, name, p - name.size());
+        return n;
+    }
+    static constexpr std::string_view SymbolName(std::string_view s, size_t nIndex)
+    {
+        size_t p = 0, n = 0;
+        std::string_view name;
+        while(NextSymbol(s, p, name))
+        {
+            if(IsFirstSymbol(s, name, p - name.size()) && n++ == nIndex)
+                return name;
+        }
+        return std::string_view();
+    }
+};
+
+// 1 or 0. Written so that GCC does not turn a product with a comparison into a branch,
+// which would keep the loop from being vectorized.
+inline double MathExprStaticTruth(bool b)
+{
+    return static_cast<double>(1 - static_cast<int>(!b));
+}
+
+// Operands of Evaluate: a pointer is a column indexed by row, a number is broadcast
+inline double MathExprStaticValue(double value, size_t)
+{
+    return value;
+}
+inline double MathExprStaticValue(const double* p, size_t i)
+{
+    return p[i];
+}
+
+template<size_t I> struct MathExprStaticSymbol
+{
+    template<class A> static double Eval(const A& args, size_t i)
+    {
+        return MathExprStaticValue(std::get<I>(args), i);
+    }
+};
+template<class S, size_t B, size_t E> struct MathExprStaticNumber
+{
+    static constexpr double value = MathExprStaticLexer::Number(S::str(), B, E);
+    template<class A> static double Eval(const A&, size_t)
+    {
+        return value;
+    }
+};
+template<int Op, class T> struct MathExprStaticSign
+{
+    template<class A> static double Eval(const A& args, size_t i)
+    {
+        double value = T::Eval(args, i);
+        if constexpr(Op == MathExprStaticOp_Minus)
+            return -value;
+        else if constexpr(Op == MathExprStaticOp_Not)
+            return MathExprStaticTruth(value == 0);
+        else
+            return value;
+    }
+};
+template<int Op, class L, class R> struct MathExprStaticOperator
+{
+    template<class A> static double Eval(const A& args, size_t i)
+    {
+        // comparison and logical operators yield 1 or 0 without branching
+        double l = L::Eval(args, i);
+        double r = R::Eval(args, i);
+        if constexpr(Op == MathExprStaticOp_Plus)
+            return l + r;
+        else if constexpr(Op == MathExprStaticOp_Minus)
+            return l - r;
+        else if constexpr(Op == MathExprStaticOp_Multiply)
+            return l * r;
+        else if constexpr(Op == MathExprStaticOp_Divide)
+            return l / r;
+        else if constexpr(Op == MathExprStaticOp_Power)
+            return std::pow(l, r);
+        else if constexpr(Op == MathExprStaticOp_Less)
+            return MathExprStaticTruth(l < r);
+        else if constexpr(Op == MathExprStaticOp_LessEqual)
+            return MathExprStaticTruth(l <= r);
+        else if constexpr(Op == MathExprStaticOp_Greater)
+            return MathExprStaticTruth(l > r);
+        else if constexpr(Op == MathExprStaticOp_GreaterEqual)
+            return MathExprStaticTruth(l >= r);
+        else if constexpr(Op == MathExprStaticOp_Equal)
+            return MathExprStaticTruth(l == r);
+        else if constexpr(Op == MathExprStaticOp_NotEqual)
+            return MathExprStaticTruth(l != r);
+        else if constexpr(Op == MathExprStaticOp_And)
+            return MathExprStaticTruth((l != 0) & (r != 0));
+        else
+            return MathExprStaticTruth((l != 0) | (r != 0));
+    }
+};
+template<int Fn, class... T> struct MathExprStaticFunction
+{
+    template<class A> static double Eval(const A& args, size_t i)
+    {
+        const double v[] = {T::Eval(args, i)...};
+        const size_t n = sizeof...(T);
+        if constexpr(Fn == MathExprStaticFn_acos)
+            return std::acos(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_asin)
+            return std::asin(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_atan)
+            return std::atan(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_cos)
+            return std::cos(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_cosh)
+            return std::cosh(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_exp)
+            return std::exp(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_abs)
+            return std::fabs(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_log)
+            return std::log(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_log10)
+            return std::log10(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_ln)
+            return std::log(v[0]) / std::log(std::exp(1.0));
+        else if constexpr(Fn == MathExprStaticFn_sin)
+            return std::sin(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_sinh)
+            return std::sinh(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_tan)
+            return std::tan(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_tanh)
+            return std::tanh(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_sqrt)
+            return std::sqrt(v[0]);
+#ifdef _MSC_VER
+        else if constexpr(Fn == MathExprStaticFn_j0)
+            return _j0(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_j1)
+            return _j1(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_y0)
+            return _y0(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_y1)
+            return _y1(v[0]);
+#else
+        else if constexpr(Fn == MathExprStaticFn_j0)
+            return j0(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_j1)
+            return j1(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_y0)
+            return y0(v[0]);
+        else if constexpr(Fn == MathExprStaticFn_y1)
+            return y1(v[0]);
+#endif
+        else if constexpr(Fn == MathExprStaticFn_atan2)
+            return std::atan2(v[0], v[1]);
+        else if constexpr(Fn == MathExprStaticFn_if)
+            return v[0] != 0 ? v[1] : v[2];
+        else if constexpr(Fn == MathExprStaticFn_min)
+        {
+            // NaN propagates
+            double r = v[0];
+            for(size_t j = 1; j < n; j++)
+                r = (v[j] < r || v[j] != v[j]) ? v[j] : r;
+            return r;
+        }
+        else if constexpr(Fn == MathExprStaticFn_max)
+        {
+            double r = v[0];
+            for(size_t j = 1; j < n; j++)
+                r = (v[j] > r || v[j] != v[j]) ? v[j] : r;
+            return r;
+        }
+        else if constexpr(Fn == MathExprStaticFn_hypot)
+        {
+            // scaled by the largest magnitude so that squares neither overflow nor underflow
+            double r = 0, sum = 0;
+            for(size_t j = 0; j < n; j++)
+                r = (std::fabs(v[j]) > r || v[j] != v[j]) ? std::fabs(v[j]) : r;
+            for(size_t j = 0; j < n; j++)
+            {
+                double q = r > 0 && r <= (std::numeric_limits<double>::max)() ? v[j] / r : 0;
+                sum += q * q;
+            }
+            return sum > 0 ? r * std::sqrt(sum) : r;
+        }
+        else
+        {
+            // poly(x, c0, c1, ..., cd) by Horner's rule
+            double r = v[n - 1];
+            for(size_t j = n - 1; j >= 2; j--)
+            {
+#ifdef FP_FAST_FMA
+                r = std::fma(r, v[0], v[j - 1]);
+#else
+                r = r * v[0] + v[j - 1];
+#endif
+            }
+            return r;
+        }
+    }
+};
+
+// Type-level parser, only instantiated for a valid expression. P is the position of the
+// first token, end is past the last token and the white space after it.
+template<class S, size_t P, int L, int F = MathExprStaticLexer::Form(S::str(), P, L)> struct MathExprStaticParse;
+
+template<class S, int L, class Lhs, size_t P, int Op = MathExprStaticLexer::OperatorAt(S::str(), P, L)> struct MathExprStaticTail
+{
+    static constexpr size_t q = MathExprStaticLexer::SkipWhiteSpace(S::str(), P + MathExprStaticLexer::OperatorLength(Op));
+    typedef MathExprStaticParse<S, q, MathExprStaticLexer::Operand(S::str(), q, L)> rhs;
+    typedef MathExprStaticTail<S, L, MathExprStaticOperator<Op, Lhs, typename rhs::type>, rhs::end> tail;
+    typedef typename tail::type type;
+    static constexpr size_t end = tail::end;
+};
+template<class S, int L, class Lhs, size_t P> struct MathExprStaticTail<S, L, Lhs, P, MathExprStaticOp_None>
+{
+    typedef Lhs type;
+    static constexpr size_t end = P;
+};
+
+template<class S, size_t P, int L> struct MathExprStaticParse<S, P, L, MathExprStaticForm_Binary>
+{
+    // left-associative
+    typedef MathExprStaticParse<S, P, MathExprStaticLexer::Operand(S::str(), P, L)> lhs;
+    typedef MathExprStaticTail<S, L, typename lhs::type, lhs::end> tail;
+    typedef typename tail::type type;
+    static constexpr size_t end = tail::end;
+};
+template<class S, size_t P, int L> struct MathExprStaticParse<S, P, L, MathExprStaticForm_Sign>
+{
+    typedef MathExprStaticParse<S, MathExprStaticLexer::SkipWhiteSpace(S::str(), P + 1), MathExprStaticLexer::SignOperand(L)> operand;
+    typedef MathExprStaticSign<MathExprStaticLexer::SignAt(S::str(), P), typename operand::type> type;
+    static constexpr size_t end = operand::end;
+};
+template<class S, size_t P, int L> struct MathExprStaticParse<S, P, L, MathExprStaticForm_Next>
+{
+    typedef MathExprStaticParse<S, P, L == MATH_EXPR_STATIC_LEVEL_UNARY ? MATH_EXPR_STATIC_LEVEL_MULTIPLY : MATH_EXPR_STATIC_LEVEL_POWER> next;
+    typedef typename next::type type;
+    static constexpr size_t end = next::end;
+};
+
+template<class S, class Base, size_t P, bool bPower = MathExprStaticLexer::IsAt(S::str(), P, '^')> struct MathExprStaticExponent
+{
+    // right-associative: the exponent level takes signs and further '^'
+    typedef MathExprStaticParse<S, MathExprStaticLexer::SkipWhiteSpace(S::str(), P + 1), MATH_EXPR_STATIC_LEVEL_EXPONENT> exponent;
+    typedef MathExprStaticOperator<MathExprStaticOp_Power, Base, typename exponent::type> type;
+    static constexpr size_t end = exponent::end;
+};
+template<class S, class Base, size_t P> struct MathExprStaticExponent<S, Base, P, false>
+{
+    typedef Base type;
+    static constexpr size_t end = P;
+};
+template<class S, size_t P, int L> struct MathExprStaticParse<S, P, L, MathExprStaticForm_Power>
+{
+    typedef MathExprStaticParse<S, P, MATH_EXPR_STATIC_LEVEL_PRIMARY> base;
+    typedef MathExprStaticExponent<S, typename base::type, base::end> exponent;
+    typedef typename exponent::type type;
+    static constexpr size_t end = exponent::end;
+};
+
+template<class S, size_t P, int L> struct MathExprStaticParse<S, P, L, MathExprStaticForm_Number>
+{
+    typedef MathExprStaticNumber<S, P, MathExprStaticLexer::NumberEnd(S::str(), P)> type;
+    static constexpr size_t end = MathExprStaticLexer::SkipWhiteSpace(S::str(), MathExprStaticLexer::NumberEnd(S::str(), P));
+};
+template<class S, size_t P, int L> struct MathExprStaticParse<S, P, L, MathExprStaticForm_Symbol>
+{
+    typedef MathExprStaticSymbol<MathExprStaticLexer::SymbolIndex(S::str(), S::str().substr(P, MathExprStaticLexer::NameEnd(S::str(), P) - P))> type;
+    static constexpr size_t end = MathExprStaticLexer::SkipWhiteSpace(S::str(), MathExprStaticLexer::NameEnd(S::str(), P));
+};
+template<class S, size_t P, int L> struct MathExprStaticParse<S, P, L, MathExprStaticForm_Group>
+{
+    typedef MathExprStaticParse<S, MathExprStaticLexer::SkipWhiteSpace(S::str(), P + 1), MATH_EXPR_STATIC_LEVEL_OR> inner;
+    typedef typename inner::type type;
+    static constexpr size_t end = MathExprStaticLexer::SkipWhiteSpace(S::str(), inner::end + 1);
+};
+
+template<class S, int Fn, size_t P, bool bLast, class... T> struct MathExprStaticArguments
+{
+    // P is past '(' or ','
+    typedef MathExprStaticParse<S, MathExprStaticLexer::SkipWhiteSpace(S::str(), P), MATH_EXPR_STATIC_LEVEL_OR> argument;
+    typedef MathExprStaticArguments<S, Fn, argument::end + 1, !MathExprStaticLexer::IsAt(S::str(), argument::end, ','), T..., typename argument::type> next;
+    typedef typename next::type type;
+    static constexpr size_t end = next::end;
+};
+template<class S, int Fn, size_t P, class... T> struct MathExprStaticArguments<S, Fn, P, true, T...>
+{
+    // P is past ')'
+    typedef MathExprStaticFunction<Fn, T...> type;
+    static constexpr size_t end = MathExprStaticLexer::SkipWhiteSpace(S::str(), P);
+};
+template<class S, size_t P, int L> struct MathExprStaticParse<S, P, L, MathExprStaticForm_Call>
+{
+    static constexpr size_t q = MathExprStaticLexer::SkipWhiteSpace(S::str(), MathExprStaticLexer::NameEnd(S::str(), P));
+    static constexpr int fn = MathExprStaticLexer::Function(S::str().substr(P, MathExprStaticLexer::NameEnd(S::str(), P) - P), MathExprStaticLexer::Arguments(S::str(), q));
+    typedef MathExprStaticArguments<S, fn, q + 1, false> arguments;
+    typedef typename arguments::type type;
+    static constexpr size_t end = arguments::end;
+};
+
+template<class S, bool bValid = MathExprStaticLexer::Check(S::str()) == MathExprStaticError_None> struct MathExprStaticTree
+{
+    typedef typename MathExprStaticParse<S, MathExprStaticLexer::SkipWhiteSpace(S::str(), 0), MATH_EXPR_STATIC_LEVEL_OR>::type type;
+};
+template<class S> struct MathExprStaticTree<S, false>
+{
+    typedef MathExprStaticSymbol<0> type;  // not evaluated, the static_asserts below have failed
+};
+
+template<class S> class MathExprStaticExpression
+{
+public:
+    static constexpr int error = MathExprStaticLexer::Check(S::str());
+    static_assert(error != MathExprStaticError_Operand, "ME_EXPR: missing or invalid operand");
+    static_assert(error != MathExprStaticError_Parenthesis, "ME_EXPR: parentheses not balanced");
+    static_assert(error != MathExprStaticError_Trailing, "ME_EXPR: unexpected characters after the expression");
+    static_assert(error != MathExprStaticError_Number, "ME_EXPR: invalid number");
+    static_assert(error != MathExprStaticError_Function, "ME_EXPR: unknown function");
+    static_assert(error != MathExprStaticError_Arguments, "ME_EXPR: wrong number of arguments");
+    static_assert(error != MathExprStaticError_Reduction, "ME_EXPR: reductions are only supported by MathExpression");
+    
+    typedef typename MathExprStaticTree<S>::type tree;
+    static constexpr std::string_view expression = S::str();
+    static constexpr size_t nsymbols = MathExprStaticLexer::SymbolCount(S::str());
+    static constexpr std::array<std::string_view, nsymbols> symbols = MathExprStaticExpression::Names(std::make_index_sequence<nsymbols>());
+    
+    // one value per symbol, in the order of symbols
+    template<class... T> double operator()(T... values) const
+    {
+        static_assert(sizeof...(T) == nsymbols, "ME_EXPR: one value per symbol");
+        const std::array<double, sizeof...(T)> args = {{static_cast<double>(values)...}};
+        return tree::Eval(args, 0);
+    }
+    // one operand per symbol: const double* for n values or double for a single value
+    template<class... T> void Evaluate(double* results, size_t n, T... operands) const
+    {
+        static_assert(sizeof...(T) == nsymbols, "ME_EXPR: one operand per symbol");
+        static_assert((... && (std::is_arithmetic<T>::value || std::is_convertible<T, const double*>::value)), "ME_EXPR: operands are const double* or double");
+        const std::tuple<T...> args(operands...);
+        for(size_t i = 0; i < n; i++)
+            results[i] = tree::Eval(args, i);
+    }
+
+private:
+    template<size_t... I> static constexpr std::array<std::string_view, nsymbols> Names(std::index_sequence<I...>)
+    {
+        return {{MathExprStaticLexer::SymbolName(S::str(), I)...}};
+    }
+};
+
+// The literal becomes the body of a local class so that it can parameterize a template.
+#define ME_EXPR(expr) \
+    ([]() { \
+        struct MathExprStaticSource { static constexpr std::string_view str() { return expr; } }; \
+        return MathExprStaticExpression<MathExprStaticSource>(); \
+    }())
+
+#endif //_MATH_EXPRESSION_STATIC_H_
@@ -0,0 +1,191 @@
+// Arrow C Data Interface: float64 columns in place, float32 widened, validity bitmaps at any
+// offset, record batches, and the exported nullable result.
+// g++ -std=c++11 -fopenmp tests/ArrowTest.cpp src/MathExpression.cpp -o ArrowTest
+#include <cstdio>
+#include <cstring>
+#include "../src/MathExpression.h"
+
+static int g_nFailed = 0;
+
+static void Expect(const char* lpcszName, bool bOK)
+{
+    printf("%s: %s\n", lpcszName, bOK ? "ok" : "FAILED");
+    if(!bOK)
+        g_nFailed++;
+}
+
+// the test owns every buffer, release only marks the structs as released
+static void ReleaseSchema(struct ArrowSchema* pSchema)
+{
+    pSchema->release = NULL;
+}
+static void ReleaseArray(struct ArrowArray* pArray)
+{
+    pArray->release = NULL;
+}
+
+typedef struct Column
+{
+    struct ArrowSchema schema;
+    struct ArrowArray array;
+    const void* buffers[2];
+} Column;
+
+static void MakeColumn(Column& column, const char* lpcszFormat, const char* lpcszName, const void* pData, const unsigned char* pBits, int64_t nLength, int64_t nOffset, int64_t nNulls)
+{
+    memset(&column, 0, sizeof(column));
+    column.schema.format = lpcszFormat;
+    column.schema.name = lpcszName;
+    column.schema.flags = ARROW_FLAG_NULLABLE;
+    column.schema.release = ReleaseSchema;
+    column.buffers[0] = pBits;
+    column.buffers[1] = pData;
+    column.array.length = nLength;
+    column.array.null_count = nNulls;
+    column.array.offset = nOffset;
+    column.array.n_buffers = 2;
+    column.array.buffers = column.buffers;
+    column.array.release = ReleaseArray;
+}
+
+static bool IsValid(const struct ArrowArray& array, size_t i)
+{
+    const unsigned char* bits = static_cast<const unsigned char*>(array.buffers[0]);
+    return !bits || (bits[i / 8] >> (i % 8) & 1);
+}
+
+int main()
+{
+    const size_t n = 100;
+    const size_t nPhysical = n + 16;
+    vector<double> x(nPhysical);
+    vector<float> y(nPhysical);
+    for(size_t i = 0; i < nPhysical; i++)
+    {
+        x[i] = static_cast<double>(i) * 0.5;
+        y[i] = static_cast<float>(i) * 0.1f;
+    }
+    // row i of the physical buffers is null where i % 7 == 2 in x and where i % 5 == 0 in y
+    vector<unsigned char> xBits((nPhysical + 7) / 8, 0), yBits((nPhysical + 7) / 8, 0);
+    size_t nNulls = 0;
+    for(size_t i = 0; i < nPhysical; i++)
+    {
+        if(i % 7 != 2)
+            xBits[i / 8] |= static_cast<unsigned char>(1 << (i % 8));
+        if(i % 5 != 0)
+            yBits[i / 8] |= static_cast<unsigned char>(1 << (i % 8));
+    }
+    
+    MathExpressionProgram program("x + y");
+    struct ArrowArray result;
+    struct ArrowSchema resultSchema;
+    
+    // float64 in place, float32 widened once when bound
+    Column cx, cy;
+    MakeColumn(cx, "g", "x", x.data(), NULL, n, 0, 0);
+    MakeColumn(cy, "f", "y", y.data(), NULL, n, 0, 0);
+    MathExpressionContext context;
+    Expect("bind", context.BindArrow("x", &cx.schema, &cx.array) && context.BindArrow("y", &cy.schema, &cy.array));
+    // changed after binding: x is read from the buffer, y was copied
+    double fSavedX = x[4];
+    float fSavedY = y[4];
+    x[4] = 1000;
+    y[4] = 1000;
+    bool bOK = program.EvaluateArrow(&result, &resultSchema, context);
+    x[4] = fSavedX;
+    y[4] = fSavedY;
+    const double* pValues = bOK ? static_cast<const double*>(result.buffers[1]) : NULL;
+    Expect("export", bOK && result.length == static_cast<int64_t>(n) && !result.null_count && !result.buffers[0] && result.n_buffers == 2 && !strcmp(resultSchema.format, "g"));
+    bool bSame = pValues != NULL;
+    for(size_t i = 0; i < n && bSame; i++)
+        bSame = i == 4 || pValues[i] == x[i] + static_cast<double>(y[i]);
+    Expect("float32 widened", bSame && pValues[3] == 1.5 + static_cast<double>(0.3f) && pValues[3] != 1.8);
+    Expect("float64 in place", bSame && pValues[4] == 1000 + static_cast<double>(y[4]));
+    result.release(&result);
+    resultSchema.release(&resultSchema);
+    Expect("released", !result.release && !resultSchema.release);
+    
+    // offsets 3 and 5, neither byte-aligned, so row i reads bits i + 3 and i + 5
+    MakeColumn(cx, "g", "x", x.data(), xBits.data(), n, 3, -1);
+    MakeColumn(cy, "f", "y", y.data(), yBits.data(), n, 5, 1);
+    Expect("bind offsets", context.BindArrow("x", &cx.schema, &cx.array) && context.BindArrow("y", &cy.schema, &cy.array));
+    bOK = program.EvaluateArrow(&result, &resultSchema, context);
+    pValues = bOK ? static_cast<const double*>(result.buffers[1]) : NULL;
+    bSame = pValues != NULL && result.buffers[0] != NULL;
+    nNulls = 0;
+    for(size_t i = 0; i < n && bSame; i++)
+    {
+        bool bValid = (i + 3) % 7 != 2 && (i + 5) % 5 != 0;
+        nNulls += !bValid;
+        bSame = IsValid(result, i) == bValid && (!bValid || pValues[i] == x[i + 3] + static_cast<double>(y[i + 5]));
+    }
+    Expect("unaligned validity", bSame && result.null_count == static_cast<int64_t>(nNulls));
+    const unsigned char* pBits = bSame ? static_cast<const unsigned char*>(result.buffers[0]) : NULL;
+    Expect("padding bits cleared", pBits && !(pBits[n / 8] >> (n % 8)));
+    result.release(&result);
+    resultSchema.release(&resultSchema);
+    
+    // a byte-aligned offset takes the bitmap a byte at a time
+    MakeColumn(cx, "g", "x", x.data(), xBits.data(), n, 8, 1);
+    double fZero = 0;
+    context.Bind("y", &fZero, 1);
+    bOK = context.BindArrow("x", &cx.schema, &cx.array) && program.EvaluateArrow(&result, &resultSchema, context);
+    bSame = bOK;
+    for(size_t i = 0; i < n && bSame; i++)
+        bSame = IsValid(result, i) == ((i + 8) % 7 != 2);
+    Expect("aligned validity", bSame);
+    result.release(&result);
+    resultSchema.release(&resultSchema);
+    
+    // a record batch: the offset of the struct applies to its fields, on top of their own
+    Column cb;
+    struct ArrowSchema* schemas[2] = {&cx.schema, &cy.schema};
+    struct ArrowArray* arrays[2] = {&cx.array, &cy.array};
+    MakeColumn(cx, "g", "x", x.data(), xBits.data(), n + 4, 1, 1);
+    MakeColumn(cy, "f", "y", y.data(), yBits.data(), n + 4, 0, 1);
+    MakeColumn(cb, "+s", "", NULL, NULL, n, 2, 0);
+    cb.schema.n_children = cb.array.n_children = 2;
+    cb.schema.children = schemas;
+    cb.array.children = arrays;
+    cb.array.n_buffers = 1;
+    MathExpressionContext batch;
+    bOK = batch.BindArrow(&cb.schema, &cb.array) && program.EvaluateArrow(&result, &resultSchema, batch);
+    pValues = bOK ? static_cast<const double*>(result.buffers[1]) : NULL;
+    bSame = bOK && result.length == static_cast<int64_t>(n);
+    for(size_t i = 0; i < n && bSame; i++)
+    {
+        bool bValid = (i + 3) % 7 != 2 && (i + 2) % 5 != 0;
+        bSame = IsValid(result, i) == bValid && (!bValid || pValues[i] == x[i + 3] + static_cast<double>(y[i + 2]));
+    }
+    Expect("record batch", bSame);
+    result.release(&result);
+    resultSchema.release(&resultSchema);
+    
+    // a null single value makes every row null
+    unsigned char nullBit = 0;
+    Column cs;
+    MakeColumn(cs, "g", "y", x.data(), &nullBit, 1, 0, 1);
+    bOK = batch.BindArrow("y", &cs.schema, &cs.array) && program.EvaluateArrow(&result, &resultSchema, batch);
+    Expect("null single value", bOK && result.null_count == static_cast<int64_t>(n));
+    result.release(&result);
+    resultSchema.release(&resultSchema);
+    
+    // a plain column replaces the bitmap of an Arrow one
+    batch.Bind("y", &fZero, 1);
+    bOK = program.EvaluateArrow(&result, &resultSchema, batch);
+    Expect("rebound", bOK && result.null_count != static_cast<int64_t>(n));
+    result.release(&result);
+    resultSchema.release(&resultSchema);
+    
+    MathExpressionProgram reduction("x - mean(x)");
+    Expect("reduction with nulls", !reduction.EvaluateArrow(&result, &resultSchema, batch) && batch.Error() == "Reductions Not Supported.");
+    Column ci;
+    MakeColumn(ci, "i", "x", x.data(), NULL, n, 0, 0);
+    Expect("unsupported type", !batch.BindArrow("x", &ci.schema, &ci.array) && batch.Error() == "Unsupported Arrow Type.");
+    MakeColumn(cb, "+s", "", NULL, NULL, n + 8, 0, 0);
+    cb.schema.n_children = cb.array.n_children = 2;
+    cb.schema.children = schemas;
+    cb.array.children = arrays;
+    Expect("batch longer than fields", !batch.BindArrow(&cb.schema, &cb.array) && batch.Error() == "Invalid Arrow Array.");
+    return g_nFailed ? 1 : 0;
+}
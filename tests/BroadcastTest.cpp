@@ -0,0 +1,79 @@
+// Broadcast evaluation against an element-wise reference.
+// g++ -std=c++11 -fopenmp tests/BroadcastTest.cpp src/MathExpression.cpp -o BroadcastTest
+#include <cstdio>
+#include <cmath>
+#include "../src/MathExpression.h"
+
+// element [i, j] of an operand of at most two dimensions, right-aligned
+static double At(const MathExprShapedBuffer& x, size_t i, size_t j)
+{
+    size_t nRows = x.shape.size() == 2 ? x.shape[0] : 1;
+    size_t nCols = x.shape.empty() ? 1 : x.shape.back();
+    return x.p[(nRows == 1 ? 0 : i) * nCols + (nCols == 1 ? 0 : j)];
+}
+
+static bool Check(const char* lpcszName, const MathExprShapedBuffer& x, const MathExprShapedBuffer& y, size_t nRows, size_t nCols)
+{
+    map<string, MathExprShapedBuffer> symbols;
+    symbols["x"] = x;
+    symbols["y"] = y;
+    MathExpressionProgram program("x * 2 + y");
+    MathExpressionContext context;
+    vector<double> results;
+    vector<size_t> shape;
+    if(!program.Evaluate(results, shape, symbols, context) || shape.size() != 2 || shape[0] != nRows || shape[1] != nCols || results.size() != nRows * nCols)
+    {
+        printf("%s: failed '%s'\n", lpcszName, context.Error().c_str());
+        return false;
+    }
+    for(size_t i = 0; i < nRows; i++)
+    {
+        for(size_t j = 0; j < nCols; j++)
+        {
+            double expected = At(x, i, j) * 2 + At(y, i, j);
+            if(results[i * nCols + j] != expected)
+            {
+                printf("%s: [%zu, %zu] is %g, not %g\n", lpcszName, i, j, results[i * nCols + j], expected);
+                return false;
+            }
+        }
+    }
+    printf("%s: ok\n", lpcszName);
+    return true;
+}
+
+int main()
+{
+    const size_t nRows = 1000, nCols = 1000, nLong = 2000000;
+    vector<double> xs(nRows * nCols), ys(nCols), zs(nLong), scalar(1, 0.5);
+    for(size_t i = 0; i < xs.size(); i++)
+        xs[i] = static_cast<double>(i % 977);
+    for(size_t j = 0; j < nCols; j++)
+        ys[j] = static_cast<double>(j) * 0.25;
+    for(size_t i = 0; i < nLong; i++)
+        zs[i] = static_cast<double>(i % 1013) * 0.5;
+    
+    MathExprShapedBuffer x = {xs.data(), vector<size_t>()};
+    x.shape.push_back(nRows);
+    x.shape.push_back(nCols);
+    MathExprShapedBuffer s = {scalar.data(), vector<size_t>(1, 1)};
+    MathExprShapedBuffer row = {ys.data(), vector<size_t>(1, nCols)};
+    MathExprShapedBuffer column = {ys.data(), vector<size_t>()};
+    column.shape.push_back(nRows);
+    column.shape.push_back(1);
+    
+    bool bOK = Check("2-D and scalar", x, s, nRows, nCols);
+    bOK = Check("2-D and row", x, row, nRows, nCols) && bOK;
+    bOK = Check("2-D and column", x, column, nRows, nCols) && bOK;
+    bOK = Check("column and row", column, row, nRows, nCols) && bOK;
+    
+    // a column against a scalar is one run, not one tile per element
+    MathExprShapedBuffer z = {zs.data(), vector<size_t>()};
+    z.shape.push_back(nLong);
+    z.shape.push_back(1);
+    MathExprShapedBuffer one = {scalar.data(), vector<size_t>()};
+    one.shape.push_back(1);
+    one.shape.push_back(1);
+    bOK = Check("long column and scalar", z, one, nLong, 1) && bOK;
+    return bOK ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+/* The C interface called from C, including its failure statuses.
+ * gcc -std=c99 -c tests/CApiTest.c -o CApiTest.o
+ * g++ -std=c++11 -fopenmp CApiTest.o src/MathExpressionC.cpp src/MathExpression.cpp -o CApiTest */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "../src/MathExpressionC.h"
+
+static int g_nFailed = 0;
+
+static void Expect(const char* lpcszName, int bOK)
+{
+    printf("%s: %s\n", lpcszName, bOK ? "ok" : "FAILED");
+    if(!bOK)
+        g_nFailed++;
+}
+
+int main(void)
+{
+    double a[3] = {3, 5, 8}, b[3] = {4, 12, 15}, shorter[2] = {1, 2}, y = 2, results[3];
+    char error[128];
+    size_t nSymbols = 0, nSlotA = 0, nSlotB = 0, nSlotY = 0, i;
+    const char* lpcszName = NULL;
+    int bSame = 1;
+    MathExprProgramHandle hProgram = NULL, hPi = NULL, hConstant = NULL, hBad = NULL;
+    MathExprContextHandle hContext = NULL, hPiContext = NULL, hConstantContext = NULL;
+    
+    Expect("version", MathExprApiVersion() == MATH_EXPRESSION_C_API_VERSION);
+    Expect("compile error", MathExprCompile("sqrt(a^2+", &hBad, error, sizeof(error)) == MathExprStatus_CompileError && error[0] && !hBad);
+    Expect("compile", MathExprCompile("sqrt(a^2+b^2)", &hProgram, error, sizeof(error)) == MathExprStatus_OK);
+    
+    Expect("symbols", MathExprSymbolCount(hProgram, &nSymbols) == MathExprStatus_OK && nSymbols == 2);
+    Expect("symbol name", MathExprSymbolName(hProgram, 1, &lpcszName) == MathExprStatus_OK && !strcmp(lpcszName, "b"));
+    Expect("symbol slots", MathExprSymbolSlot(hProgram, "a", &nSlotA) == MathExprStatus_OK && MathExprSymbolSlot(hProgram, "b", &nSlotB) == MathExprStatus_OK && nSlotA == 0 && nSlotB == 1);
+    Expect("unknown symbol", MathExprSymbolSlot(hProgram, "c", &nSlotA) == MathExprStatus_UnknownSymbol);
+    Expect("slot out of range", MathExprSymbolName(hProgram, 2, &lpcszName) == MathExprStatus_InvalidArgument);
+    
+    /* the context keeps the program alive */
+    Expect("context", MathExprContextCreate(hProgram, &hContext) == MathExprStatus_OK);
+    MathExprProgramFree(hProgram);
+    Expect("unbound", MathExprEvaluate(hContext, results, 3) == MathExprStatus_EvaluationError && strlen(MathExprErrorMessage(hContext)) > 0);
+    Expect("bind out of range", MathExprBind(hContext, 2, a, 3) == MathExprStatus_InvalidArgument);
+    Expect("bind", MathExprBind(hContext, 0, a, 3) == MathExprStatus_OK && MathExprBind(hContext, 1, b, 3) == MathExprStatus_OK);
+    Expect("evaluate", MathExprEvaluate(hContext, results, 3) == MathExprStatus_OK && !MathExprErrorMessage(hContext)[0]);
+    for(i = 0; i < 3; i++)
+        bSame = bSame && results[i] == sqrt(a[i] * a[i] + b[i] * b[i]);
+    Expect("results", bSame);
+    Expect("results size mismatch", MathExprEvaluate(hContext, results, 2) == MathExprStatus_SizeMismatch);
+    Expect("no results", MathExprEvaluate(hContext, NULL, 3) == MathExprStatus_InvalidArgument);
+    
+    /* columns of lengths 3 and 2 */
+    Expect("bind shorter", MathExprBind(hContext, 1, shorter, 2) == MathExprStatus_OK);
+    Expect("symbol size mismatch", MathExprEvaluate(hContext, results, 3) == MathExprStatus_SizeMismatch && !strcmp(MathExprErrorMessage(hContext), "Symbol Size Mismatch."));
+    
+    /* a single value is broadcast */
+    Expect("bind single", MathExprBind(hContext, 1, &y, 1) == MathExprStatus_OK);
+    Expect("broadcast", MathExprEvaluate(hContext, results, 3) == MathExprStatus_OK && results[0] == sqrt(13.0) && results[2] == sqrt(68.0));
+    MathExprContextFree(hContext);
+    
+    /* pi is bound in a new context */
+    Expect("compile pi", MathExprCompile("cos(pi / y)", &hPi, NULL, 0) == MathExprStatus_OK);
+    Expect("context pi", MathExprContextCreate(hPi, &hPiContext) == MathExprStatus_OK && MathExprSymbolSlot(hPi, "y", &nSlotY) == MathExprStatus_OK);
+    Expect("bind y", MathExprBind(hPiContext, nSlotY, &y, 1) == MathExprStatus_OK);
+    Expect("default pi", MathExprEvaluate(hPiContext, results, 1) == MathExprStatus_OK && fabs(results[0]) < 1e-15);
+    MathExprContextFree(hPiContext);
+    MathExprProgramFree(hPi);
+    
+    /* a constant expression fills any number of results */
+    Expect("compile constant", MathExprCompile("2 + 3", &hConstant, NULL, 0) == MathExprStatus_OK);
+    Expect("constant", MathExprContextCreate(hConstant, &hConstantContext) == MathExprStatus_OK && MathExprEvaluate(hConstantContext, results, 3) == MathExprStatus_OK && results[2] == 5);
+    MathExprContextFree(hConstantContext);
+    MathExprProgramFree(hConstant);
+    
+    Expect("null handles", MathExprContextCreate(NULL, &hContext) == MathExprStatus_InvalidArgument && MathExprEvaluate(NULL, results, 1) == MathExprStatus_InvalidArgument);
+    return g_nFailed ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+// Logical, comparison and sign operators, in MathExpression and in ME_EXPR, against C.
+// g++ -std=c++17 -fopenmp tests/OperatorTest.cpp src/MathExpression.cpp -o OperatorTest
+#include <cstdio>
+#include <cmath>
+#include "../src/MathExpression.h"
+#include "../src/MathExpressionStatic.h"
+
+static int g_nFailed = 0;
+
+// symbols a, b and c, in that order of appearance for ME_EXPR
+#define CHECK(expr, reference) Check(expr, ME_EXPR(expr), [](double a, double b, double c) { return static_cast<double>(reference); })
+
+template<class F, class R> static void Check(const char* lpcszExpr, const F& f, const R& reference)
+{
+    const double values[] = {0, 1, 2, -3};
+    MathExpression me(lpcszExpr);
+    map<string, vector<double> > symbols;
+    for(double a : values)
+    {
+        for(double b : values)
+        {
+            for(double c : values)
+            {
+                symbols["a"].push_back(a);
+                symbols["b"].push_back(b);
+                symbols["c"].push_back(c);
+            }
+        }
+    }
+    vector<double> results;
+    bool bOK = me.Evaluate(results, symbols) && results.size() == symbols["a"].size();
+    for(size_t i = 0; i < results.size() && bOK; i++)
+    {
+        double a = symbols["a"][i], b = symbols["b"][i], c = symbols["c"][i];
+        double expected = reference(a, b, c);
+        bOK = results[i] == expected && f(a, b, c) == expected;
+        if(!bOK)
+            printf("%s at a=%g b=%g c=%g: %g and %g, not %g\n", lpcszExpr, a, b, c, results[i], f(a, b, c), expected);
+    }
+    printf("%s: %s\n", lpcszExpr, bOK ? "ok" : "FAILED");
+    if(!bOK)
+        g_nFailed++;
+}
+
+int main()
+{
+    // ! applies to its operand only
+    CHECK("!a * b + c", !a * b + c);
+    CHECK("!a + b * c", !a + b * c);
+    CHECK("!a^2 + b + c", pow(!a, 2) + b + c);
+    CHECK("-!a * b + c", -(!a * b) + c);
+    CHECK("!-a * b + c", !(-a) * b + c);
+    CHECK("!!a + b + c", !!a + b + c);
+    CHECK("!(a * b) + c", (a * b == 0) + c);
+    CHECK("!sin(a) * b + c", !sin(a) * b + c);
+    CHECK("a * !b + c", a * !b + c);
+    CHECK("a^!b + c", pow(a, !b) + c);
+    
+    // && binds tighter than ||, both yield 0 or 1
+    CHECK("a && b || c", (a && b) || c);
+    CHECK("a || b && c", a || (b && c));
+    CHECK("a && !b || !c", (a && !b) || !c);
+    CHECK("(a || b) * 3 + c", (a || b) * 3 + c);
+    
+    // comparisons below + -, equality below ordering
+    CHECK("a < b == b < c", (a < b) == (b < c));
+    CHECK("a + 1 <= b * c", a + 1 <= b * c);
+    CHECK("a >= b != c > a", (a >= b) != (c > a));
+    CHECK("a == b && b != c", a == b && b != c);
+    CHECK("-a^2 + b + c", -pow(a, 2) + b + c);
+    return g_nFailed ? 1 : 0;
+}
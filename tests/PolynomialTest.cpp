@@ -0,0 +1,66 @@
+// Polynomials lowered to poly(): rounding differences for finite values, limits for infinite ones.
+// g++ -std=c++11 -fopenmp tests/PolynomialTest.cpp src/MathExpression.cpp -o PolynomialTest
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include "../src/MathExpression.h"
+
+static int g_nFailed = 0;
+
+static void Expect(const char* lpcszName, bool bOK)
+{
+    printf("%s: %s\n", lpcszName, bOK ? "ok" : "FAILED");
+    if(!bOK)
+        g_nFailed++;
+}
+
+static bool Evaluate(const char* lpcszExpr, const vector<double>& x, vector<double>& results)
+{
+    MathExpressionProgram program(lpcszExpr);
+    MathExpressionContext context;
+    map<string, vector<double> > symbols;
+    symbols["x"] = x;
+    return program.Error().empty() && program.Evaluate(results, symbols, context);
+}
+
+int main()
+{
+    const double inf = numeric_limits<double>::infinity();
+    vector<double> x, results;
+    for(int i = -1000; i <= 1000; i++)
+        x.push_back(i * 0.013);
+    
+    // lowered, and still reported as written
+    MathExpressionProgram program("x^2 - 2*x + 1");
+    set<string> functions;
+    program.Functions(functions);
+    Expect("names as written", functions.empty());
+    
+    bool bOK = Evaluate("x^2 - 2*x + 1", x, results);
+    bool bClose = bOK && results.size() == x.size();
+    for(size_t i = 0; i < x.size() && bClose; i++)
+        bClose = fabs(results[i] - (x[i] * x[i] - 2 * x[i] + 1)) <= 1e-12 * (1 + fabs(results[i]));
+    Expect("finite values", bClose);
+    
+    bOK = Evaluate("3*x^3 + x - 5", x, results);
+    bClose = bOK && results.size() == x.size();
+    for(size_t i = 0; i < x.size() && bClose; i++)
+        bClose = fabs(results[i] - (3 * x[i] * x[i] * x[i] + x[i] - 5)) <= 1e-12 * (1 + fabs(results[i]));
+    Expect("odd degree", bClose);
+    
+    // the limit of the polynomial, where the terms as written give inf - inf
+    vector<double> special;
+    special.push_back(inf);
+    special.push_back(-inf);
+    special.push_back(1e200);
+    special.push_back(numeric_limits<double>::quiet_NaN());
+    bOK = Evaluate("x^2 - 2*x + 1", special, results);
+    Expect("inf - inf is the limit", bOK && results[0] == inf && results[1] == inf && results[2] == inf && results[3] != results[3]);
+    bOK = Evaluate("-x^3 + x^2", special, results);
+    Expect("sign of the leading term", bOK && results[0] == -inf && results[1] == inf && results[2] == -inf && results[3] != results[3]);
+    
+    // terms that cancel are dropped
+    bOK = Evaluate("x^3 + x - x + 1", special, results);
+    Expect("cancelled terms", bOK && results[0] == inf && results[1] == -inf);
+    return g_nFailed ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+// rand() and randn(): Philox4x32-10 against the Random123 known-answer vectors, and draws
+// that depend on the seed only, not on the threads, the segments or the selected rows.
+// g++ -std=c++11 -fopenmp tests/RandomTest.cpp src/MathExpression.cpp -o RandomTest
+#include <cstdio>
+#include <omp.h>
+#include "../src/MathExpression.h"
+
+static int g_nFailed = 0;
+
+static void Expect(const char* lpcszName, bool bOK)
+{
+    printf("%s: %s\n", lpcszName, bOK ? "ok" : "FAILED");
+    if(!bOK)
+        g_nFailed++;
+}
+
+static bool Philox(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t k0, uint32_t k1, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+{
+    uint32_t counter[4] = {c0, c1, c2, c3};
+    uint32_t key[2] = {k0, k1};
+    MathExprPhilox4x32(counter, key);
+    return counter[0] == r0 && counter[1] == r1 && counter[2] == r2 && counter[3] == r3;
+}
+
+static bool Draw(vector<double>& results, const MathExpressionProgram& program, const vector<double>& x, unsigned long long nSeed, size_t nThreads, size_t nBudget, MathExprPlan& plan)
+{
+    omp_set_num_threads(static_cast<int>(nThreads));
+    MathExpressionContext context;
+    context.SetSeed(nSeed);
+    context.SetMemoryBudget(nBudget);
+    context.Bind("x", x.data(), x.size());
+    results.assign(x.size(), 0);
+    bool bOK = program.Evaluate(results.data(), results.size(), context);
+    plan = context.Plan();
+    return bOK;
+}
+
+int main()
+{
+    // kat_vectors of Random123: counter, key, result
+    Expect("philox zeros", Philox(0, 0, 0, 0, 0, 0, 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8));
+    Expect("philox ones", Philox(0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd));
+    Expect("philox pi", Philox(0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344, 0xa4093822, 0x299f31d0, 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1));
+    
+    // rand(k) at row i is the first two words of counter {i, i >> 32, k, 0} under the seed
+    const unsigned long long nSeed = 0x0123456789abcdefull;
+    const size_t n = 1000000;
+    vector<double> x(n, 0.0), results;
+    MathExprPlan plan;
+    MathExpressionProgram stream("rand(5) + x");
+    bool bOK = Draw(results, stream, x, nSeed, 1, 0, plan);
+    bool bSame = bOK;
+    for(size_t i = 0; i < n && bSame; i += 997)
+    {
+        uint32_t counter[4] = {static_cast<uint32_t>(i), 0, 5, 0};
+        uint32_t key[2] = {static_cast<uint32_t>(nSeed), static_cast<uint32_t>(nSeed >> 32)};
+        MathExprPhilox4x32(counter, key);
+        bSame = results[i] == static_cast<double>(counter[0] >> 10) / 4194304.0 + static_cast<double>(counter[1] >> 1) / 9007199254740992.0;
+    }
+    Expect("rand is philox", bSame);
+    
+    // one thread and whole segments, then many threads with small segments
+    MathExpressionProgram program("rand() + 10 * randn() + 100 * rand(7) + x");
+    vector<double> serial, parallel;
+    MathExprPlan serialPlan, parallelPlan;
+    bOK = Draw(serial, program, x, nSeed, 1, 0, serialPlan);
+    Expect("serial plan", bOK && serialPlan.threads == 1);
+    bOK = Draw(parallel, program, x, nSeed, 8, 0, parallelPlan);
+    Expect("threads", bOK && parallelPlan.threads > 1 && parallel == serial);
+    bOK = Draw(parallel, program, x, nSeed, 8, 1 << 20, plan);
+    Expect("small segments", bOK && plan.segment < parallelPlan.segment && parallel == serial);
+    bOK = Draw(parallel, program, x, nSeed, 3, 1 << 18, plan);
+    Expect("three threads", bOK && parallel == serial);
+    bOK = Draw(parallel, program, x, nSeed + 1, 8, 0, plan);
+    Expect("other seed", bOK && parallel != serial);
+    
+    // the selected rows draw what they draw in a full pass
+    vector<size_t> rows;
+    for(size_t i = 3; i < n; i += 1009)
+        rows.push_back(i);
+    MathExpressionContext context;
+    context.SetSeed(nSeed);
+    context.Bind("x", x.data(), x.size());
+    vector<double> selected(rows.size());
+    bOK = program.EvaluateAt(selected.data(), rows.data(), rows.size(), false, context);
+    bSame = bOK;
+    for(size_t k = 0; k < rows.size() && bSame; k++)
+        bSame = selected[k] == serial[rows[k]];
+    Expect("selected rows", bSame);
+    
+    // a stream out of range draws NaN
+    MathExpressionProgram negative("rand(-1) + x");
+    bOK = Draw(results, negative, x, nSeed, 1, 0, plan);
+    Expect("negative stream", bOK && results[0] != results[0]);
+    return g_nFailed ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+// Adaptive sampling: refinement where the curve bends or jumps, the edges of the domain, the
+// nMaxPoints cap and the same points on any number of threads.
+// g++ -std=c++11 -fopenmp tests/SampleTest.cpp src/MathExpression.cpp -o SampleTest
+#include <cstdio>
+#include <cmath>
+#include <omp.h>
+#include "../src/MathExpression.h"
+
+static int g_nFailed = 0;
+
+static void Expect(const char* lpcszName, bool bOK)
+{
+    printf("%s: %s\n", lpcszName, bOK ? "ok" : "FAILED");
+    if(!bOK)
+        g_nFailed++;
+}
+
+static bool Sample(vector<double>& x, vector<double>& y, const char* lpcszExpr, double a, double b, double tolerance, size_t nMaxPoints = 100000, const map<string, double>& parameters = map<string, double>())
+{
+    MathExpressionProgram program(lpcszExpr);
+    MathExpressionContext context;
+    return program.Sample(x, y, "x", a, b, tolerance, parameters, context, nMaxPoints);
+}
+
+static bool IsSorted(const vector<double>& x, double a, double b)
+{
+    bool bSorted = !x.empty() && x.front() == a && x.back() == b;
+    for(size_t i = 1; i < x.size() && bSorted; i++)
+        bSorted = x[i - 1] < x[i];
+    return bSorted;
+}
+
+// the widest gap between the last x where bFirst holds and the first one where it does not
+static double Edge(const vector<double>& x, const vector<double>& y, bool (*bFirst)(double))
+{
+    for(size_t i = 1; i < x.size(); i++)
+    {
+        if(bFirst(y[i - 1]) && !bFirst(y[i]))
+            return x[i] - x[i - 1];
+    }
+    return HUGE_VAL;
+}
+static bool IsZero(double y)
+{
+    return y == 0;
+}
+static bool IsNaN(double y)
+{
+    return y != y;
+}
+
+int main()
+{
+    vector<double> x, y;
+    
+    // a line is not refined past the midpoints of the initial 32 intervals
+    Expect("line", Sample(x, y, "2 * x + 1", -1, 3, 1e-9) && x.size() == 65 && IsSorted(x, -1, 3) && y[16] == 2 * x[16] + 1);
+    
+    // the chords of a peak stay close to it, with a fraction of the 7000 points a uniform
+    // grid needs for the same error
+    Expect("curve", Sample(x, y, "exp(-50 * x^2)", -5, 5, 1e-4) && IsSorted(x, -5, 5));
+    bool bSame = true;
+    for(size_t i = 0; i < x.size() && bSame; i++)
+        bSame = y[i] == exp(-50 * x[i] * x[i]);
+    double fMaxError = 0;
+    for(size_t i = 1; i < x.size(); i++)
+    {
+        for(size_t k = 1; k < 8; k++)
+        {
+            double t = static_cast<double>(k) / 8, xt = x[i - 1] + t * (x[i] - x[i - 1]);
+            fMaxError = std::max(fMaxError, fabs(exp(-50 * xt * xt) - (y[i - 1] + t * (y[i] - y[i - 1]))));
+        }
+    }
+    Expect("curve values", bSame);
+    Expect("curve error", fMaxError < 1e-4 && x.size() < 1000);
+    
+    // where the curve bends most the points are closest
+    double fNearPeak = 1, fFlat = 0;
+    for(size_t i = 1; i < x.size(); i++)
+    {
+        if(x[i - 1] <= 0.1 && x[i] > 0.1)
+            fNearPeak = x[i] - x[i - 1];
+        if(x[i - 1] <= 4 && x[i] > 4)
+            fFlat = x[i] - x[i - 1];
+    }
+    Expect("denser where curved", fNearPeak * 16 < fFlat);
+    
+    // a jump and the edge of the domain are located to about 1e-11 of its width
+    Expect("jump", Sample(x, y, "if(x < 0.3, 0, 1)", 0, 1, 1e-3) && IsSorted(x, 0, 1) && Edge(x, y, IsZero) < 1e-9 && x.size() < 200);
+    Expect("domain edge", Sample(x, y, "sqrt(x)", -1, 1, 1e-3) && Edge(x, y, IsNaN) < 1e-9 && y.back() == 1);
+    
+    // nMaxPoints bounds the points of a function that never settles
+    Expect("max points", Sample(x, y, "sin(1 / x)", 1e-4, 1, 0, 500) && x.size() <= 500 && x.size() > 33 && IsSorted(x, 1e-4, 1));
+    
+    // other symbols are bound to single values
+    map<string, double> parameters;
+    parameters["k"] = 3;
+    vector<double> x3, y3;
+    Expect("parameters", Sample(x, y, "sin(k * x)", 0, 5, 1e-4, 100000, parameters) && Sample(x3, y3, "sin(3 * x)", 0, 5, 1e-4) && x == x3 && y == y3);
+    
+    // the rounds are split over threads, the points do not depend on them
+    omp_set_num_threads(1);
+    Sample(x, y, "tan(x)", -3, 3, 1e-3);
+    omp_set_num_threads(8);
+    Expect("threads", Sample(x3, y3, "tan(x)", -3, 3, 1e-3) && x == x3 && y == y3);
+    
+    MathExpressionProgram program("x * x");
+    MathExpressionContext context;
+    Expect("invalid domain", !program.Sample(x, y, "x", 1, 1, 1e-3, map<string, double>(), context) && context.Error() == "Invalid Domain." && x.empty());
+    Expect("invalid tolerance", !program.Sample(x, y, "x", 0, 1, -1, map<string, double>(), context) && context.Error() == "Invalid Domain.");
+    return g_nFailed ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+// Programs saved and loaded again, through a file and a buffer, and files that must not load.
+// g++ -std=c++11 -fopenmp tests/SaveLoadTest.cpp src/MathExpression.cpp -o SaveLoadTest
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include "../src/MathExpression.h"
+
+static int g_nFailed = 0;
+
+static void Expect(const char* lpcszName, bool bOK)
+{
+    printf("%s: %s\n", lpcszName, bOK ? "ok" : "FAILED");
+    if(!bOK)
+        g_nFailed++;
+}
+
+// Load() uses the code in place, the storage is 8-byte aligned like a mapped file
+static bool LoadBuffer(const vector<char>& buffer, vector<shared_ptr<const MathExpressionProgram> >& programs, string& error)
+{
+    shared_ptr<vector<unsigned long long> > storage = make_shared<vector<unsigned long long> >((buffer.size() + 7) / 8);
+    if(!buffer.empty())
+        memcpy(storage->data(), buffer.data(), buffer.size());
+    return MathExpressionProgram::Load(shared_ptr<const void>(storage, storage->data()), buffer.size(), programs, error);
+}
+
+static bool SameProgram(const MathExpressionProgram& a, const MathExpressionProgram& b, const map<string, vector<double> >& symbols)
+{
+    set<string> symbolsA, symbolsB, functionsA, functionsB;
+    a.Symbols(symbolsA);
+    b.Symbols(symbolsB);
+    a.Functions(functionsA);
+    b.Functions(functionsB);
+    if(a.Error() != b.Error() || symbolsA != symbolsB || functionsA != functionsB)
+        return false;
+    if(!a.Error().empty())
+        return true;
+    
+    MathExpressionContext contextA, contextB;
+    vector<double> resultsA, resultsB;
+    bool bA = a.Evaluate(resultsA, symbols, contextA);
+    bool bB = b.Evaluate(resultsB, symbols, contextB);
+    return bA == bB && resultsA == resultsB;
+}
+
+int main()
+{
+    const char* exprs[] = {"sqrt(a^2 + b^2)", "r = a * 2; r + sin(r)", "if(a > b, max(a, b, 1), -a) + sum(b)", "pi * a^3 - 2*a + 1", "sin(a"};
+    const size_t nPrograms = sizeof(exprs) / sizeof(exprs[0]);
+    vector<shared_ptr<const MathExpressionProgram> > programs;
+    for(size_t i = 0; i < nPrograms; i++)
+        programs.push_back(make_shared<MathExpressionProgram>(exprs[i]));
+    map<string, vector<double> > symbols;
+    for(size_t i = 0; i < 1000; i++)
+    {
+        symbols["a"].push_back(static_cast<double>(i) * 0.01 - 3);
+        symbols["b"].push_back(static_cast<double>(i % 17) * 0.25);
+    }
+    
+    string error;
+    vector<char> buffer;
+    vector<shared_ptr<const MathExpressionProgram> > loaded;
+    Expect("save buffer", MathExpressionProgram::Save(buffer, programs, error));
+    Expect("load buffer", LoadBuffer(buffer, loaded, error) && loaded.size() == nPrograms);
+    bool bSame = loaded.size() == nPrograms;
+    for(size_t i = 0; i < loaded.size() && bSame; i++)
+        bSame = SameProgram(*programs[i], *loaded[i], symbols);
+    Expect("buffer round trip", bSame);
+    Expect("compile error kept", loaded.size() == nPrograms && loaded[nPrograms - 1]->Error() == programs[nPrograms - 1]->Error() && !loaded[nPrograms - 1]->Error().empty());
+    
+    char szPath[64];
+    snprintf(szPath, sizeof(szPath), "/tmp/mexpr-test.%ld.bin", static_cast<long>(getpid()));
+    Expect("save file", MathExpressionProgram::Save(szPath, programs, error));
+    Expect("load file", MathExpressionProgram::Load(szPath, loaded, error) && loaded.size() == nPrograms);
+    bSame = loaded.size() == nPrograms;
+    for(size_t i = 0; i < loaded.size() && bSame; i++)
+        bSame = SameProgram(*programs[i], *loaded[i], symbols);
+    Expect("file round trip", bSame);
+    
+    // a loaded program is saved again to the same bytes
+    vector<char> again;
+    Expect("save loaded", MathExpressionProgram::Save(again, loaded, error) && again == buffer);
+    
+    // truncated anywhere, in the header or in the code
+    bool bRejected = true;
+    for(size_t nSize = 0; nSize < buffer.size() && bRejected; nSize += 8)
+        bRejected = !LoadBuffer(vector<char>(buffer.begin(), buffer.begin() + nSize), loaded, error) && error == "Invalid File." && loaded.empty();
+    Expect("truncated buffer", bRejected);
+    if(truncate(szPath, static_cast<off_t>(buffer.size() / 2)) == 0)
+        Expect("truncated file", !MathExpressionProgram::Load(szPath, loaded, error) && error == "Invalid File.");
+    else
+        Expect("truncated file", false);
+    unlink(szPath);
+    
+    // header: magic[8], version at 8, byteorder at 12, opsize at 16, nbuiltins at 20,
+    // builtins at 24, programs at 32; a program record starts with its ops at 0 and nops at 8
+    vector<char> patched = buffer;
+    unsigned int nVersion = 0;
+    memcpy(&nVersion, &patched[8], sizeof(nVersion));
+    nVersion++;
+    memcpy(&patched[8], &nVersion, sizeof(nVersion));
+    Expect("version mismatch", !LoadBuffer(patched, loaded, error) && error == "Unsupported File Version.");
+    
+    patched = buffer;
+    patched[0] = 'X';
+    Expect("bad magic", !LoadBuffer(patched, loaded, error) && error == "Invalid File.");
+    
+    // sqrt takes one argument, the evaluator is never reached with two
+    patched = buffer;
+    unsigned long long nRecords = 0, nOps = 0, nCount = 0;
+    memcpy(&nRecords, &patched[32], sizeof(nRecords));
+    memcpy(&nOps, &patched[nRecords], sizeof(nOps));
+    memcpy(&nCount, &patched[nRecords + 8], sizeof(nCount));
+    bool bPatched = false;
+    for(unsigned long long i = 0; i < nCount && !bPatched; i++)
+    {
+        MathExprOp op;
+        memcpy(&op, &patched[nOps + i * sizeof(op)], sizeof(op));
+        if(op.type == MathExprNodeType_Function)
+        {
+            op.nargs = 2;
+            memcpy(&patched[nOps + i * sizeof(op)], &op, sizeof(op));
+            bPatched = true;
+        }
+    }
+    Expect("built-in arity", bPatched && !LoadBuffer(patched, loaded, error) && error == "Invalid Program.");
+    
+    MathExpressionProgram arity("sqrt(a, b)");
+    Expect("arity at compile", arity.Error() == "Invalid Number of Arguments.");
+    return g_nFailed ? 1 : 0;
+}
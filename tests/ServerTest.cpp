@@ -0,0 +1,102 @@
+// Round trips to a server over a Unix socket, with columns and results in shared memory.
+// g++ -std=c++11 -fopenmp tests/ServerTest.cpp src/MathExpressionServer.cpp src/MathExpression.cpp -o ServerTest -lrt
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <unistd.h>
+#include "../src/MathExpressionServer.h"
+
+static int g_nFailed = 0;
+
+static void Expect(const char* lpcszName, bool bOK)
+{
+    printf("%s: %s\n", lpcszName, bOK ? "ok" : "FAILED");
+    if(!bOK)
+        g_nFailed++;
+}
+
+static MathExprServerBuffer Buffer(const char* lpcszSymbol, const char* lpcszShm, size_t nOffset, size_t n)
+{
+    MathExprServerBuffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    strcpy(buffer.symbol, lpcszSymbol);
+    strcpy(buffer.shm, lpcszShm);
+    buffer.offset = nOffset;
+    buffer.n = n;
+    return buffer;
+}
+
+int main()
+{
+    char szPath[64];
+    snprintf(szPath, sizeof(szPath), "/tmp/mexpr-test.%ld.sock", static_cast<long>(getpid()));
+    MathExpressionServer server(2);
+    if(!server.Listen(szPath))
+    {
+        printf("listen: %s\n", server.Error().c_str());
+        return 1;
+    }
+    std::thread runner(&MathExpressionServer::Run, &server);
+    
+    const size_t n = 10000;
+    MathExpressionSharedBuffer x, results;
+    Expect("create", x.Create(MathExpressionClient::SharedName("test.x").c_str(), n + 2) && results.Create(MathExpressionClient::SharedName("test.results").c_str(), n));
+    for(size_t i = 0; i < n + 2; i++)
+        x.Data()[i] = static_cast<double>(i) * 0.001;
+    
+    MathExpressionClient client;
+    Expect("connect", client.Connect(szPath));
+    unsigned long long nProgram = 0, nAgain = 0;
+    bool bOK = client.Compile("sin(x) + 1", nProgram);
+    Expect("compile", bOK && nProgram != 0);
+    bOK = client.Compile("sin(x) + 1", nAgain);
+    Expect("compile cached", bOK && nAgain == nProgram && server.CacheSize() == 1);
+    bOK = client.Compile("sin(x", nAgain);
+    Expect("compile error", !bOK && !client.Error().empty());
+    
+    // x is read from an offset of two values
+    vector<MathExprServerBuffer> buffers;
+    buffers.push_back(Buffer("", "test.results", 0, n));
+    buffers.push_back(Buffer("x", "test.x", 2 * sizeof(double), n));
+    size_t nRows = 0;
+    bOK = client.Evaluate(nProgram, buffers, nRows);
+    bool bSame = true;
+    for(size_t i = 0; i < n && bSame; i++)
+        bSame = fabs(results.Data()[i] - (sin(static_cast<double>(i + 2) * 0.001) + 1)) < 1e-15;
+    Expect("evaluate", bOK && nRows == n && bSame);
+    bOK = client.Evaluate("x * 2", buffers, nRows);
+    Expect("evaluate text", bOK && nRows == n && results.Data()[10] == 0.024);
+    
+    bOK = client.Evaluate(nProgram + 100, buffers, nRows);
+    Expect("unknown program", !bOK && client.Error() == "Unknown Program.");
+    buffers[1] = Buffer("x", "test.missing", 0, n);
+    bOK = client.Evaluate(nProgram, buffers, nRows);
+    Expect("missing buffer", !bOK && client.Error() == "Invalid Shared Buffer.");
+    buffers[1] = Buffer("x", "test.x", 8 * sizeof(double), n);
+    bOK = client.Evaluate(nProgram, buffers, nRows);
+    Expect("buffer too short", !bOK && client.Error() == "Invalid Shared Buffer.");
+    
+    // names are within the session of the client
+    buffers[1] = Buffer("x", "/test.x", 0, n);
+    bOK = client.Evaluate(nProgram, buffers, nRows);
+    Expect("absolute name", !bOK && client.Error() == "Invalid Request.");
+    buffers[1] = Buffer("x", "../test.x", 0, n);
+    bOK = client.Evaluate(nProgram, buffers, nRows);
+    Expect("relative name", !bOK && client.Error() == "Invalid Request.");
+    
+    // the cache keeps the two programs used last
+    unsigned long long nSecond = 0, nThird = 0;
+    bOK = client.Compile("x + 2", nSecond) && client.Compile("sin(x) + 1", nAgain) && client.Compile("x + 3", nThird);
+    Expect("cache bounded", bOK && server.CacheSize() == 2 && nAgain == nProgram && nThird > nSecond);
+    buffers[1] = Buffer("x", "test.x", 0, n);
+    bOK = client.Evaluate(nSecond, buffers, nRows);
+    Expect("least recently used dropped", !bOK && client.Error() == "Unknown Program.");
+    bOK = client.Evaluate(nProgram, buffers, nRows);
+    Expect("recently used kept", bOK && nRows == n);
+    
+    server.Stop();
+    runner.join();
+    bOK = client.Compile("x + 4", nAgain);
+    Expect("stopped", !bOK && client.Error() == "Connection Lost.");
+    return g_nFailed ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+// The built-in sinks against a pass over the full results, on one thread and on many threads
+// with small segments, including ties among the largest values.
+// g++ -std=c++11 -fopenmp tests/SinkTest.cpp src/MathExpression.cpp -o SinkTest
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <omp.h>
+#include "../src/MathExpression.h"
+
+static int g_nFailed = 0;
+
+static void Expect(const char* lpcszName, bool bOK)
+{
+    printf("%s: %s\n", lpcszName, bOK ? "ok" : "FAILED");
+    if(!bOK)
+        g_nFailed++;
+}
+
+static bool Near(double a, double b)
+{
+    return fabs(a - b) <= 1e-12 * fabs(b);
+}
+
+typedef struct Sinks
+{
+    MathExpressionHistogramSink histogram;
+    MathExpressionStatisticsSink statistics;
+    MathExpressionTopKSink top;
+    MathExpressionThresholdSink above;
+    MathExprPlan plan;
+    Sinks() : histogram(-1.0, 1.0, 16), top(25), above(0.75) {}
+} Sinks;
+
+static bool Feed(Sinks& sinks, const MathExpressionProgram& program, const map<string, vector<double> >& symbols, size_t nThreads, size_t nBudget)
+{
+    omp_set_num_threads(static_cast<int>(nThreads));
+    vector<MathExpressionSink*> all;
+    all.push_back(&sinks.histogram);
+    all.push_back(&sinks.statistics);
+    all.push_back(&sinks.top);
+    all.push_back(&sinks.above);
+    MathExpressionContext context;
+    context.SetMemoryBudget(nBudget);
+    bool bOK = program.Evaluate(all, symbols, context);
+    sinks.plan = context.Plan();
+    return bOK;
+}
+
+static bool IsGreaterValueOrEarlierRow(const pair<double, size_t>& a, const pair<double, size_t>& b)
+{
+    return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+int main()
+{
+    // multiples of 1/1024 in [-0.98, 0.98], so that every bin edge is exact, with few distinct
+    // values and thus many ties, and a NaN every 777 rows
+    const size_t n = 1000000;
+    map<string, vector<double> > symbols;
+    vector<double>& x = symbols["x"];
+    x.resize(n);
+    for(size_t i = 0; i < n; i++)
+        x[i] = i % 777 == 5 ? nan("") : static_cast<double>(static_cast<long>(i * 7919 % 2001) - 1000);
+    MathExpressionProgram program("x / 1024");
+    
+    // the full results in one pass
+    vector<size_t> counts(16, 0), rows;
+    vector<pair<double, size_t> > values;
+    size_t nNaN = 0;
+    long double sum = 0;
+    double fMin = HUGE_VAL, fMax = -HUGE_VAL;
+    for(size_t i = 0; i < n; i++)
+    {
+        double v = x[i] / 1024;
+        if(v != v)
+        {
+            nNaN++;
+            continue;
+        }
+        counts[std::min(static_cast<size_t>((v + 1) * 8), static_cast<size_t>(15))]++;
+        sum += v;
+        fMin = std::min(fMin, v);
+        fMax = std::max(fMax, v);
+        values.push_back(make_pair(v, i));
+        if(v > 0.75)
+            rows.push_back(i);
+    }
+    double mean = static_cast<double>(sum / values.size());
+    long double m2 = 0;
+    for(size_t i = 0; i < values.size(); i++)
+        m2 += (values[i].first - mean) * (values[i].first - mean);
+    double variance = static_cast<double>(m2 / (values.size() - 1));
+    sort(values.begin(), values.end(), IsGreaterValueOrEarlierRow);
+    vector<pair<double, size_t> > top(values.begin(), values.begin() + 25);
+    
+    Sinks serial, parallel;
+    Expect("serial", Feed(serial, program, symbols, 1, 0) && serial.plan.threads == 1);
+    Expect("parallel", Feed(parallel, program, symbols, 8, 1 << 20) && parallel.plan.threads > 1 && parallel.plan.segment < n / 8);
+    
+    Expect("histogram", serial.histogram.Counts() == counts && serial.histogram.NaN() == nNaN && !serial.histogram.Below() && !serial.histogram.Above());
+    Expect("histogram threads", parallel.histogram.Counts() == counts && parallel.histogram.NaN() == nNaN);
+    double median = serial.histogram.Quantile(0.5);
+    Expect("quantile", median == parallel.histogram.Quantile(0.5) && fabs(median) < 0.125);
+    
+    Expect("statistics", serial.statistics.Count() == n - nNaN && serial.statistics.Min() == fMin && serial.statistics.Max() == fMax && \
+                         Near(serial.statistics.Mean(), mean) && Near(serial.statistics.Variance(), variance));
+    Expect("statistics threads", parallel.statistics.Count() == n - nNaN && parallel.statistics.Min() == fMin && parallel.statistics.Max() == fMax && \
+                                 Near(parallel.statistics.Mean(), mean) && Near(parallel.statistics.Variance(), variance));
+    
+    // the smallest value kept is shared by more rows than fit, the earliest ones are kept
+    Expect("top ties", values[24].first == values[25].first);
+    Expect("top", serial.top.Top() == top);
+    Expect("top threads", parallel.top.Top() == top);
+    
+    Expect("threshold", serial.above.Rows() == rows);
+    Expect("threshold threads", parallel.above.Rows() == rows);
+    
+    // sinks accumulate across calls, a failed call leaves them as they were
+    Expect("accumulate", Feed(parallel, program, symbols, 8, 1 << 20) && parallel.statistics.Count() == 2 * (n - nNaN) && parallel.histogram.NaN() == 2 * nNaN);
+    map<string, vector<double> > unbound;
+    Expect("failed call", !Feed(parallel, program, unbound, 8, 0) && parallel.statistics.Count() == 2 * (n - nNaN) && parallel.above.Rows().size() == 2 * rows.size());
+    return g_nFailed ? 1 : 0;
+}
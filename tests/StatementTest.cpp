@@ -0,0 +1,91 @@
+// Multi-statement programs: variables, the splitting on ';', folded variables, outputs and errors.
+// g++ -std=c++11 -fopenmp tests/StatementTest.cpp src/MathExpression.cpp -o StatementTest
+#include <cstdio>
+#include <cmath>
+#include <omp.h>
+#include "../src/MathExpression.h"
+
+static int g_nFailed = 0;
+
+static void Expect(const char* lpcszName, bool bOK)
+{
+    printf("%s: %s\n", lpcszName, bOK ? "ok" : "FAILED");
+    if(!bOK)
+        g_nFailed++;
+}
+
+static bool Evaluate(vector<double>& results, const char* lpcszExpr, const map<string, vector<double> >& symbols)
+{
+    MathExpressionProgram program(lpcszExpr);
+    MathExpressionContext context;
+    return program.Error().empty() && program.Evaluate(results, symbols, context);
+}
+
+static bool Same(const char* lpcszExpr, const char* lpcszExpected, const map<string, vector<double> >& symbols)
+{
+    vector<double> results, expected;
+    return Evaluate(results, lpcszExpr, symbols) && Evaluate(expected, lpcszExpected, symbols) && results == expected;
+}
+
+static string CompileError(const char* lpcszExpr)
+{
+    MathExpressionProgram program(lpcszExpr);
+    return program.Error();
+}
+
+int main()
+{
+    const size_t n = 100000;
+    map<string, vector<double> > symbols;
+    for(size_t i = 0; i < n; i++)
+    {
+        symbols["x"].push_back(static_cast<double>(i) * 0.001 - 7);
+        symbols["y"].push_back(static_cast<double>(i % 101) * 0.1);
+    }
+    omp_set_num_threads(8);
+    
+    // a variable is the value of its statement, over segments on any thread
+    Expect("variable", Same("r = sqrt(x*x + y*y); r * sin(r)", "sqrt(x*x + y*y) * sin(sqrt(x*x + y*y))", symbols));
+    Expect("chain", Same("a = x + 1; b = a * y; c = b - a; c / 2", "((x + 1) * y - (x + 1)) / 2", symbols));
+    Expect("reassigned", Same("a = x; a = a * 2; a + 1", "x * 2 + 1", symbols));
+    Expect("last assignment", Same("a = x * 3; b = a + y", "x * 3 + y", symbols));
+    Expect("shadowed symbol", Same("x = x + 1; x * 2", "(x + 1) * 2", symbols));
+    Expect("reduction of a variable", Same("d = x - 1; sum(d) + d", "sum(x - 1) + (x - 1)", symbols));
+    
+    // ';' splits at the top level only, blank statements are skipped
+    Expect("blank statements", Same(" ; a = x + y;; a * a ; ", "(x + y) * (x + y)", symbols));
+    Expect("semicolon in parentheses", !CompileError("a = (x; y); a").empty());
+    Expect("comparison is not an assignment", Same("x == y", "x == y", symbols) && CompileError("x == y; x") == "Expression Not Assigned.");
+    Expect("not assigned", CompileError("x + 1; y") == "Expression Not Assigned.");
+    Expect("empty", !CompileError("").empty() && !CompileError(" ; ").empty());
+    
+    // a statement that folds to a number is a constant of the statements after it
+    MathExpressionProgram folded("k = 2 * 3; j = k + 1; j * x");
+    Expect("folded", folded.Error().empty() && Same("k = 2 * 3; j = k + 1; j * x", "7 * x", symbols));
+    set<string> names;
+    folded.Symbols(names);
+    Expect("folded symbols", names.size() == 1 && names.count("x"));
+    MathExpressionProgram constant("k = 2 * 3; k + 1");
+    MathExpressionContext context;
+    vector<double> results;
+    Expect("folded constant", constant.Evaluate(results, map<string, vector<double> >(), context) && results.size() == 1 && results[0] == 7);
+    
+    // every variable from one pass, in order of first assignment
+    MathExpressionProgram program("r = sqrt(x*x + y*y); k = 4; s = r * k; s - y");
+    vector<string> outputs;
+    program.Outputs(outputs);
+    Expect("outputs", outputs.size() == 3 && outputs[0] == "r" && outputs[1] == "k" && outputs[2] == "s");
+    map<string, vector<double> > values;
+    bool bOK = program.EvaluateOutputs(values, symbols, context);
+    bool bSame = bOK && values.size() == 3 && values["r"].size() == n && values["s"].size() == n && !values["k"].empty() && values["k"][0] == 4;
+    for(size_t i = 0; i < n && bSame; i += 97)
+    {
+        double r = sqrt(symbols["x"][i] * symbols["x"][i] + symbols["y"][i] * symbols["y"][i]);
+        bSame = values["r"][i] == r && values["s"][i] == r * 4;
+    }
+    Expect("evaluate outputs", bSame);
+    names.clear();
+    program.Symbols(names);
+    Expect("variables are not symbols", names.size() == 2 && names.count("x") && names.count("y"));
+    return g_nFailed ? 1 : 0;
+}